@@ -61,6 +61,18 @@ void Adafruit_ILI9341::spiWriteByte(uint8_t c) {
     }
 }
 
+// Send color to the next count pixels of the address window. The LCD driver
+// streams it with 16 bit SPI frames instead of two buffered bytes per pixel.
+void Adafruit_ILI9341::spiFill(uint16_t color, uint32_t count) {
+    PjdfLcdFill fill;
+    uint32_t length = sizeof(fill);
+
+    spiFlush();
+    fill.color = color;
+    fill.count = count;
+    Ioctl(hLcd, PJDF_CTRL_LCD_FILL, &fill, &length);
+}
+
 
 void Adafruit_ILI9341::writecommand(uint8_t c) {
     spiFlush();
@@ -306,15 +318,7 @@ void Adafruit_ILI9341::drawFastVLine(int16_t x, int16_t y, int16_t h,
   if (hwSPI) spi_begin();
   setAddrWindow(x, y, x, y+h-1);
 
-  uint8_t hi = color >> 8, lo = color;
-
-
-
-  while (h--) {
-    writedata(hi);
-    writedata(lo);
-  }
-  spiFlush();
+  if (h > 0) spiFill(color, h);
   if (hwSPI) spi_end();
 }
 
@@ -328,15 +332,7 @@ void Adafruit_ILI9341::drawFastHLine(int16_t x, int16_t y, int16_t w,
   if (hwSPI) spi_begin();
   setAddrWindow(x, y, x+w-1, y);
 
-  uint8_t hi = color >> 8, lo = color;
-
-  //digitalWrite(_dc, HIGH);
-  //digitalWrite(_cs, LOW);
-  while (w--) {
-    writedata(hi);
-    writedata(lo);
-  }
-  spiFlush();
+  if (w > 0) spiFill(color, w);
   if (hwSPI) spi_end();
 }
 
@@ -356,16 +352,7 @@ void Adafruit_ILI9341::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
   if (hwSPI) spi_begin();
   setAddrWindow(x, y, x+w-1, y+h-1);
 
-  uint8_t hi = color >> 8, lo = color;
-
-
-  for(y=h; y>0; y--) {
-    for(x=w; x>0; x--) {
-      writedata(hi);
-      writedata(lo);
-    }
-  }
-  spiFlush();
+  if (w > 0 && h > 0) spiFill(color, (uint32_t)w * h);
   if (hwSPI) spi_end();
 }
 
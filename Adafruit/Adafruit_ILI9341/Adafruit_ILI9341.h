@@ -137,6 +137,7 @@ class Adafruit_ILI9341 : public Adafruit_GFX {
   void setPjdfHandle(HANDLE);
   void spiWriteByte(uint8_t);
   void spiFlush();
+  void spiFill(uint16_t color, uint32_t count);
   void writecommand(uint8_t c);
   void writedata(uint8_t d);
   void commandList(uint8_t *addr);
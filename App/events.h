@@ -57,6 +57,9 @@ typedef enum
     EVENT_STATUSBAR_INC,
     EVENT_STATUSBAR_DEC,
     
+    // Elapsed time and stream format update, see Mp3GetDecodeStatus()
+    EVENT_DECODE_STATUS,
+    
     EVENT_NONE
 } Event_Type;
 
@@ -85,6 +88,12 @@ extern OS_FLAG_GRP *mp3Flags;
 extern OS_FLAGS MP3PlayFlag;
 */
 
+// Event flags between the MP3 reader and feeder stages
+extern OS_FLAG_GRP *mp3StreamFlags;
+
+// Held by the MP3 task while a song is open and by the shell's sdbench
+extern OS_EVENT *sdCardSem;
+
 extern OS_EVENT *displayQMsg;
 extern void * displayQMsgPtrs[EVENT_QUEUE_SIZE];
 
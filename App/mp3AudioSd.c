@@ -0,0 +1,90 @@
+/*
+    mp3AudioSd.c
+    Audio source over a file on the SD card.
+
+    The SD library is not task safe: a source is only used by the stage that
+    owns the SD card at the time (see mp3Util.c).
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "mp3AudioSource.h"
+#include "SD.h"
+
+// File objects of the open sources
+static File sdFile[MP3_AUDIO_SD_MAX_OPEN];
+static uint8_t sdFileUsed[MP3_AUDIO_SD_MAX_OPEN];
+
+static int32_t Mp3AudioSdRead(Mp3AudioSource *src, uint8_t *dst, uint32_t len)
+{
+    File *file = (File*)src->handle;
+
+    // SdFile::read() returns int16_t
+    if (len > 0x7FFF) len = 0x7FFF;
+    return file->read(dst, (uint16_t)len);
+}
+
+// Spans point into the SD block cache and end on a block boundary
+static int32_t Mp3AudioSdReadSpan(Mp3AudioSource *src, const uint8_t **span, uint32_t len)
+{
+    File *file = (File*)src->handle;
+
+    if (len > 0x7FFF) len = 0x7FFF;
+    return file->readSpan((uint8_t**)span, (uint16_t)len);
+}
+
+static int32_t Mp3AudioSdSeek(Mp3AudioSource *src, uint32_t pos)
+{
+    File *file = (File*)src->handle;
+
+    return file->seek(pos) ? 0 : -1;
+}
+
+static uint32_t Mp3AudioSdPosition(Mp3AudioSource *src)
+{
+    File *file = (File*)src->handle;
+
+    return file->position();
+}
+
+static void Mp3AudioSdClose(Mp3AudioSource *src)
+{
+    File *file = (File*)src->handle;
+
+    file->close();
+    sdFileUsed[file - sdFile] = 0;
+    src->handle = 0;
+}
+
+static const Mp3AudioSourceOps Mp3AudioSdOps = {
+    Mp3AudioSdRead, Mp3AudioSdReadSpan, Mp3AudioSdSeek, Mp3AudioSdPosition, Mp3AudioSdClose
+};
+
+// Mp3AudioSdOpen
+// Opens a file on the SD card for reading.
+// src: source to open
+// name: file name
+// Returns: nonzero if the file was opened
+uint8_t Mp3AudioSdOpen(Mp3AudioSource *src, const char *name)
+{
+    uint8_t i;
+
+    for (i = 0; i < MP3_AUDIO_SD_MAX_OPEN; i++)
+    {
+        if (!sdFileUsed[i]) break;
+    }
+    if (i == MP3_AUDIO_SD_MAX_OPEN) return 0;
+
+    sdFile[i] = SD.open(name, O_READ);
+    if (!sdFile[i]) return 0;
+    sdFileUsed[i] = 1;
+
+    src->ops = &Mp3AudioSdOps;
+    src->size = sdFile[i].size();
+    src->data = 0;
+    src->pos = 0;
+    src->handle = &sdFile[i];
+    return 1;
+}
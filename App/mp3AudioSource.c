@@ -0,0 +1,141 @@
+/*
+    mp3AudioSource.c
+    Audio source interface and the memory resident implementation, used for
+    clips compiled into flash (see MP3data) and for host tests.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include <string.h>
+#include "mp3AudioSource.h"
+
+uint8_t Mp3AudioIsOpen(const Mp3AudioSource *src)
+{
+    return src->ops != 0;
+}
+
+int32_t Mp3AudioRead(Mp3AudioSource *src, uint8_t *dst, uint32_t len)
+{
+    if (src->ops == 0) return -1;
+    return src->ops->read(src, dst, len);
+}
+
+int32_t Mp3AudioReadSpan(Mp3AudioSource *src, const uint8_t **span, uint32_t len)
+{
+    if (src->ops == 0) return -1;
+    return src->ops->readSpan(src, span, len);
+}
+
+int32_t Mp3AudioSeek(Mp3AudioSource *src, uint32_t pos)
+{
+    if (src->ops == 0) return -1;
+    return src->ops->seek(src, pos);
+}
+
+uint32_t Mp3AudioPosition(Mp3AudioSource *src)
+{
+    if (src->ops == 0) return 0;
+    return src->ops->position(src);
+}
+
+uint32_t Mp3AudioSize(const Mp3AudioSource *src)
+{
+    return src->size;
+}
+
+// Mp3AudioClose
+// Closes the source. Closing a closed source does nothing.
+void Mp3AudioClose(Mp3AudioSource *src)
+{
+    if (src->ops == 0) return;
+    src->ops->close(src);
+    src->ops = 0;
+}
+
+// Mp3AudioReadAt
+// Random access read in the form the stream info parser takes (Mp3InfoRead).
+// ctx: the Mp3AudioSource
+int32_t Mp3AudioReadAt(void *ctx, uint32_t pos, uint8_t *dst, uint32_t len)
+{
+    Mp3AudioSource *src = (Mp3AudioSource*)ctx;
+
+    if (Mp3AudioSeek(src, pos) < 0) return -1;
+    return Mp3AudioRead(src, dst, len);
+}
+
+// Mp3AudioStreamRead
+// Source read in the form the streaming engine takes (Mp3SourceRead).
+// ctx: the Mp3AudioSource
+int32_t Mp3AudioStreamRead(void *ctx, uint8_t *dst, uint32_t len)
+{
+    return Mp3AudioRead((Mp3AudioSource*)ctx, dst, len);
+}
+
+// Mp3AudioStreamSpan
+// Span source in the form the streaming engine takes (Mp3SourceSpan).
+// ctx: the Mp3AudioSource
+int32_t Mp3AudioStreamSpan(void *ctx, const uint8_t **span, uint32_t len)
+{
+    return Mp3AudioReadSpan((Mp3AudioSource*)ctx, span, len);
+}
+
+static int32_t Mp3AudioMemReadSpan(Mp3AudioSource *src, const uint8_t **span, uint32_t len)
+{
+    uint32_t left = src->size - src->pos;
+
+    if (len > left) len = left;
+    *span = &src->data[src->pos];
+    src->pos += len;
+    return (int32_t)len;
+}
+
+static int32_t Mp3AudioMemRead(Mp3AudioSource *src, uint8_t *dst, uint32_t len)
+{
+    const uint8_t *span;
+    int32_t n = Mp3AudioMemReadSpan(src, &span, len);
+
+    memcpy(dst, span, (uint32_t)n);
+    return n;
+}
+
+static int32_t Mp3AudioMemSeek(Mp3AudioSource *src, uint32_t pos)
+{
+    if (pos > src->size) return -1;
+    src->pos = pos;
+    return 0;
+}
+
+static uint32_t Mp3AudioMemPosition(Mp3AudioSource *src)
+{
+    return src->pos;
+}
+
+static void Mp3AudioMemClose(Mp3AudioSource *src)
+{
+    src->data = 0;
+}
+
+static const Mp3AudioSourceOps Mp3AudioMemOps = {
+    Mp3AudioMemRead, Mp3AudioMemReadSpan, Mp3AudioMemSeek, Mp3AudioMemPosition, Mp3AudioMemClose
+};
+
+// Mp3AudioMemOpen
+// Opens a memory resident stream, e.g. one of the arrays in MP3data. Spans
+// point straight into the array.
+// src: source to open
+// data: the stream, must stay valid until the source is closed
+// size: bytes in data
+// Returns: nonzero if the source was opened
+uint8_t Mp3AudioMemOpen(Mp3AudioSource *src, const uint8_t *data, uint32_t size)
+{
+    if (data == 0) return 0;
+
+    src->ops = &Mp3AudioMemOps;
+    src->size = size;
+    src->data = data;
+    src->pos = 0;
+    src->handle = 0;
+    return 1;
+}
@@ -0,0 +1,74 @@
+/*
+    mp3AudioSource.h
+    Audio source interface: what the streaming code reads a song from.
+
+    A source is opened by one of the implementations (SD card file, memory
+    resident array) and then used through the generic calls below, so the
+    streaming code does not care where the bytes live. readSpan returns a
+    pointer into the source's own storage (the SD block cache, or flash for
+    a memory source) instead of copying.
+
+    Like mp3Stream.c the interface and the memory implementation only depend
+    on <stdint.h> so they can be used on a host machine as well. The SD
+    implementation is in mp3AudioSd.c.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __MP3AUDIOSOURCE_H
+#define __MP3AUDIOSOURCE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MP3_AUDIO_SD_MAX_OPEN       2       // SD files open at once: playing and prefetched song
+
+typedef struct _Mp3AudioSource Mp3AudioSource;
+
+typedef struct _Mp3AudioSourceOps
+{
+    // Copy up to len bytes at the current position into dst.
+    // Returns the number of bytes copied, 0 at the end, negative on error.
+    int32_t  (*read)(Mp3AudioSource *src, uint8_t *dst, uint32_t len);
+    // Point span at up to len bytes at the current position without copying.
+    // Returns the number of bytes at span, 0 at the end, negative on error.
+    int32_t  (*readSpan)(Mp3AudioSource *src, const uint8_t **span, uint32_t len);
+    // Returns: 0 on success, negative on error
+    int32_t  (*seek)(Mp3AudioSource *src, uint32_t pos);
+    uint32_t (*position)(Mp3AudioSource *src);
+    void     (*close)(Mp3AudioSource *src);
+} Mp3AudioSourceOps;
+
+struct _Mp3AudioSource
+{
+    const Mp3AudioSourceOps *ops;   // 0 while closed
+    uint32_t size;                  // bytes in the source
+    const uint8_t *data;            // memory source: the array
+    uint32_t pos;                   // memory source: current position
+    void *handle;                   // SD source: the open File
+};
+
+uint8_t  Mp3AudioIsOpen(const Mp3AudioSource *src);
+int32_t  Mp3AudioRead(Mp3AudioSource *src, uint8_t *dst, uint32_t len);
+int32_t  Mp3AudioReadSpan(Mp3AudioSource *src, const uint8_t **span, uint32_t len);
+int32_t  Mp3AudioSeek(Mp3AudioSource *src, uint32_t pos);
+uint32_t Mp3AudioPosition(Mp3AudioSource *src);
+uint32_t Mp3AudioSize(const Mp3AudioSource *src);
+void     Mp3AudioClose(Mp3AudioSource *src);
+int32_t  Mp3AudioReadAt(void *ctx, uint32_t pos, uint8_t *dst, uint32_t len);
+int32_t  Mp3AudioStreamRead(void *ctx, uint8_t *dst, uint32_t len);
+int32_t  Mp3AudioStreamSpan(void *ctx, const uint8_t **span, uint32_t len);
+
+uint8_t  Mp3AudioMemOpen(Mp3AudioSource *src, const uint8_t *data, uint32_t size);
+uint8_t  Mp3AudioSdOpen(Mp3AudioSource *src, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
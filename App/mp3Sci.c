@@ -0,0 +1,236 @@
+/*
+    mp3Sci.c
+    VS1053 SCI register layer.
+
+    Only the MP3 task talks to the decoder through this layer. Other tasks
+    queue register changes with Mp3SciQueue(), which only touches memory; the
+    MP3 task sends them with Mp3SciFlush() once per feed cycle, so a burst of
+    volume presses costs one SCI write and the data stream is interrupted
+    at most once per cycle.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "mp3Sci.h"
+
+static INT16U sciShadow[MP3_SCI_REG_COUNT];     // last value written to or read from each register
+static INT16U sciValid = 0;                     // bit per register: shadow matches the device
+static INT16U sciPending[MP3_SCI_REG_COUNT];    // queued values
+static INT16U sciDirty = 0;                     // bit per register: queued value waiting for a flush
+static INT32U sciWrites = 0;
+static INT32U sciSkipped = 0;
+
+// Mp3SciIsCurrent
+// Returns: OS_TRUE if writing value to reg would not change the device
+static BOOLEAN Mp3SciIsCurrent(INT8U reg, INT16U value)
+{
+    if (!(MP3_SCI_CACHED_MASK & (1u << reg))) return OS_FALSE;
+    if (!(sciValid & (1u << reg))) return OS_FALSE;
+    if (reg == MP3_SCI_MODE && (value & (MP3_SM_RESET | MP3_SM_CANCEL))) return OS_FALSE;
+    return (sciShadow[reg] == value) ? OS_TRUE : OS_FALSE;
+}
+
+// Mp3SciSend
+// Writes a register and updates the shadow. The command interface must be selected.
+static PjdfErrCode Mp3SciSend(HANDLE hMp3, INT8U reg, INT16U value)
+{
+    INT8U cmd[DATA_FRAME];
+    INT32U length = DATA_FRAME;
+    PjdfErrCode retval;
+
+    cmd[0] = MP3_SCI_WRITE;
+    cmd[1] = reg;
+    cmd[2] = (INT8U)(value >> 8);
+    cmd[3] = (INT8U)value;
+    retval = Write(hMp3, cmd, &length);
+    sciWrites++;
+
+    if (reg == MP3_SCI_MODE && (value & MP3_SM_RESET))
+    {
+        // Every register is back at its reset value
+        sciValid = 0;
+    }
+    else if ((MP3_SCI_CACHED_MASK & (1u << reg)) && !(reg == MP3_SCI_MODE && (value & MP3_SM_CANCEL)))
+    {
+        sciShadow[reg] = value;
+        sciValid |= (1u << reg);
+    }
+    else
+    {
+        // SM_CANCEL clears itself, the register no longer holds what was written
+        sciValid &= ~(1u << reg);
+    }
+    return retval;
+}
+
+// Mp3SciInvalidate
+// Forgets the shadow, after a reset of the decoder or a cancelled stream.
+void Mp3SciInvalidate()
+{
+    sciValid = 0;
+}
+
+// Mp3SciWrite
+// Writes a decoder register now unless it already holds the value. A value
+// queued for the same register is superseded.
+// hMp3: an open handle to the MP3 decoder
+// reg: SCI register, MP3_SCI_xxx
+// value: register value
+// Returns: PJDF_ERR_NONE if there was no error, otherwise an error code.
+PjdfErrCode Mp3SciWrite(HANDLE hMp3, INT8U reg, INT16U value)
+{
+    OS_CPU_SR cpu_sr;
+    PjdfErrCode retval;
+
+    if (reg >= MP3_SCI_REG_COUNT) return PJDF_ERR_ARG;
+
+    OS_ENTER_CRITICAL();
+    sciDirty &= ~(1u << reg);
+    OS_EXIT_CRITICAL();
+
+    if (Mp3SciIsCurrent(reg, value))
+    {
+        sciSkipped++;
+        return PJDF_ERR_NONE;
+    }
+
+    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+    retval = Mp3SciSend(hMp3, reg, value);
+    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
+    return retval;
+}
+
+// Mp3SciWriteFrame
+// Mp3SciWrite() for one of the BspMp3 command strings.
+// frame: { MP3_SCI_WRITE, register, value high byte, value low byte }
+PjdfErrCode Mp3SciWriteFrame(HANDLE hMp3, const INT8U *frame)
+{
+    if (frame[0] != MP3_SCI_WRITE) return PJDF_ERR_ARG;
+    return Mp3SciWrite(hMp3, frame[1], ((INT16U)frame[2] << 8) | frame[3]);
+}
+
+// Mp3SciRead
+// Reads a decoder register, from the shadow when it is known to be current.
+// hMp3: an open handle to the MP3 decoder
+// reg: SCI register, MP3_SCI_xxx
+// value: receives the register value
+// Returns: PJDF_ERR_NONE if there was no error, otherwise an error code.
+PjdfErrCode Mp3SciRead(HANDLE hMp3, INT8U reg, INT16U *value)
+{
+    INT8U cmd[DATA_FRAME];
+    INT32U length = DATA_FRAME;
+    PjdfErrCode retval;
+
+    if (reg >= MP3_SCI_REG_COUNT) return PJDF_ERR_ARG;
+
+    if ((MP3_SCI_CACHED_MASK & sciValid & (1u << reg)) != 0)
+    {
+        *value = sciShadow[reg];
+        return PJDF_ERR_NONE;
+    }
+
+    cmd[0] = MP3_SCI_READ;
+    cmd[1] = reg;
+    cmd[2] = 0;
+    cmd[3] = 0;
+    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+    retval = Read(hMp3, cmd, &length);
+    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
+    if (retval != PJDF_ERR_NONE) return retval;
+
+    *value = ((INT16U)cmd[2] << 8) | cmd[3];
+    if ((MP3_SCI_CACHED_MASK & (1u << reg)) && !(reg == MP3_SCI_MODE && (*value & MP3_SM_CANCEL)))
+    {
+        sciShadow[reg] = *value;
+        sciValid |= (1u << reg);
+    }
+    return PJDF_ERR_NONE;
+}
+
+// Mp3SciQueue
+// Queues a register change for the next Mp3SciFlush(). May be called from
+// any task; a later value for the same register replaces the earlier one.
+// reg: SCI register, MP3_SCI_xxx
+// value: register value
+void Mp3SciQueue(INT8U reg, INT16U value)
+{
+    OS_CPU_SR cpu_sr;
+
+    if (reg >= MP3_SCI_REG_COUNT) return;
+
+    OS_ENTER_CRITICAL();
+    if (sciDirty & (1u << reg)) sciSkipped++;  // merged with the queued value
+    sciPending[reg] = value;
+    sciDirty |= (1u << reg);
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3SciQueueFrame
+// Mp3SciQueue() for one of the BspMp3 command strings.
+// frame: { MP3_SCI_WRITE, register, value high byte, value low byte }
+void Mp3SciQueueFrame(const INT8U *frame)
+{
+    if (frame[0] != MP3_SCI_WRITE) return;
+    Mp3SciQueue(frame[1], ((INT16U)frame[2] << 8) | frame[3]);
+}
+
+// Mp3SciFlush
+// Sends the queued register changes that differ from the device, all in one
+// command mode session. Cheap when nothing is queued, so the streaming task
+// calls it once per feed cycle.
+// hMp3: an open handle to the MP3 decoder
+// Returns: PJDF_ERR_NONE if there was no error, otherwise the first error code.
+PjdfErrCode Mp3SciFlush(HANDLE hMp3)
+{
+    OS_CPU_SR cpu_sr;
+    INT16U dirty;
+    INT16U values[MP3_SCI_REG_COUNT];
+    BOOLEAN isCommand = OS_FALSE;
+    PjdfErrCode retval = PJDF_ERR_NONE;
+    PjdfErrCode err;
+    INT8U reg;
+
+    if (sciDirty == 0) return PJDF_ERR_NONE;
+
+    OS_ENTER_CRITICAL();
+    dirty = sciDirty;
+    sciDirty = 0;
+    for (reg = 0; reg < MP3_SCI_REG_COUNT; reg++)
+    {
+        values[reg] = sciPending[reg];
+    }
+    OS_EXIT_CRITICAL();
+
+    for (reg = 0; reg < MP3_SCI_REG_COUNT; reg++)
+    {
+        if (!(dirty & (1u << reg))) continue;
+
+        if (Mp3SciIsCurrent(reg, values[reg]))
+        {
+            sciSkipped++;
+            continue;
+        }
+
+        if (!isCommand)
+        {
+            Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+            isCommand = OS_TRUE;
+        }
+        err = Mp3SciSend(hMp3, reg, values[reg]);
+        if (retval == PJDF_ERR_NONE) retval = err;
+    }
+
+    if (isCommand) Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
+    return retval;
+}
+
+// Mp3SciStats
+// writes: receives the number of SCI writes sent to the decoder
+// skipped: receives the number of writes avoided by the shadow or merged in the queue
+void Mp3SciStats(INT32U *writes, INT32U *skipped)
+{
+    *writes = sciWrites;
+    *skipped = sciSkipped;
+}
@@ -0,0 +1,38 @@
+/*
+    mp3Sci.h
+    VS1053 SCI register layer: a shadow copy of the control registers that
+    skips redundant writes and merges queued changes into one write per
+    register.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __MP3SCI_H
+#define __MP3SCI_H
+
+#include "bsp.h"
+
+#define MP3_SCI_REG_COUNT           16
+
+// SCI_MODE bits that start an action in the decoder instead of setting a mode
+#define MP3_SM_RESET                0x0004
+#define MP3_SM_CANCEL               0x0008
+
+// Registers the shadow may answer for. Status and memory access registers
+// (DECODE_TIME, HDAT0/1, WRAM, WRAMADDR, AIADDR...) always go to the device.
+#define MP3_SCI_CACHED_MASK         ((1u << MP3_SCI_MODE) | (1u << MP3_SCI_BASS) | \
+                                     (1u << MP3_SCI_CLOCKF) | (1u << MP3_SCI_AUDATA) | \
+                                     (1u << MP3_SCI_VOL))
+
+void        Mp3SciInvalidate();
+PjdfErrCode Mp3SciWrite(HANDLE hMp3, INT8U reg, INT16U value);
+PjdfErrCode Mp3SciWriteFrame(HANDLE hMp3, const INT8U *frame);
+PjdfErrCode Mp3SciRead(HANDLE hMp3, INT8U reg, INT16U *value);
+void        Mp3SciQueue(INT8U reg, INT16U value);
+void        Mp3SciQueueFrame(const INT8U *frame);
+PjdfErrCode Mp3SciFlush(HANDLE hMp3);
+void        Mp3SciStats(INT32U *writes, INT32U *skipped);
+
+#endif
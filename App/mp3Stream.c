@@ -0,0 +1,308 @@
+/*
+    mp3Stream.c
+    Ring-buffered streaming engine that decouples the SD reader stage from the
+    MP3 decoder feeder stage.
+
+    The ring is single-producer/single-consumer: only the reader stage moves
+    head and only the feeder stage moves tail. Both are free-running 32-bit
+    counters, so the buffered level is always (head - tail) and no lock is
+    needed between the two stages on a single core. The reader stage can set
+    a mark the feeder stage does not drain past, e.g. where the next song
+    starts.
+
+    A source that holds its data in memory (e.g. an array in flash) can be
+    set as a span source instead. The feeder then hands spans of the source
+    straight to the sink, the ring and the reader stage are not used and
+    head - tail is the part of the current span not yet written.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "mp3Stream.h"
+
+// Mp3StreamSetup
+// Binds a storage buffer to the engine and sets its watermarks.
+// size: ring size, must be a power of two and a multiple of readBlock
+// highWater: reader stage stops filling at this level
+// lowWater: reader stage restarts filling at or below this level
+// readBlock: byte count requested from the source per read
+// sinkChunk: largest write handed to the sink at once
+// Returns: MP3_STREAM_ERR_NONE or MP3_STREAM_ERR_GEOMETRY
+int32_t Mp3StreamSetup(Mp3Stream *s, uint8_t *buf, uint32_t size,
+                       uint32_t highWater, uint32_t lowWater,
+                       uint32_t readBlock, uint32_t sinkChunk)
+{
+    if (size == 0 || (size & (size - 1)) != 0) return MP3_STREAM_ERR_GEOMETRY;
+    if (readBlock == 0 || (size % readBlock) != 0) return MP3_STREAM_ERR_GEOMETRY;
+    if (highWater > size || lowWater >= highWater) return MP3_STREAM_ERR_GEOMETRY;
+    if (sinkChunk == 0) return MP3_STREAM_ERR_GEOMETRY;
+
+    s->buf = buf;
+    s->size = size;
+    s->highWater = highWater;
+    s->lowWater = lowWater;
+    s->readBlock = readBlock;
+    s->sinkChunk = sinkChunk;
+    s->sourceRead = 0;
+    s->sourceSpan = 0;
+    s->sourceCtx = 0;
+    s->sinkWrite = 0;
+    s->sinkCtx = 0;
+    Mp3StreamReset(s);
+
+    return MP3_STREAM_ERR_NONE;
+}
+
+void Mp3StreamSetSource(Mp3Stream *s, Mp3SourceRead read, void *ctx)
+{
+    s->sourceRead = read;
+    s->sourceSpan = 0;
+    s->sourceCtx = ctx;
+}
+
+// Mp3StreamSetSpanSource
+// Makes the feeder stage drain the source without copying it into the ring.
+void Mp3StreamSetSpanSource(Mp3Stream *s, Mp3SourceSpan span, void *ctx)
+{
+    s->sourceRead = 0;
+    s->sourceSpan = span;
+    s->sourceCtx = ctx;
+}
+
+void Mp3StreamSetSink(Mp3Stream *s, Mp3SinkWrite write, void *ctx)
+{
+    s->sinkWrite = write;
+    s->sinkCtx = ctx;
+}
+
+// Mp3StreamReset
+// Empties the ring and clears the end-of-stream state. Must only be called
+// while neither stage is running (e.g. before a start or after a seek).
+void Mp3StreamReset(Mp3Stream *s)
+{
+    s->head = 0;
+    s->tail = 0;
+    s->filling = 1;
+    s->eof = 0;
+    s->error = 0;
+    s->span = 0;
+    s->marked = 0;
+    s->phase = 0;
+}
+
+// Mp3StreamAlign
+// Empties the ring like Mp3StreamReset() and starts it at the same offset
+// within a read block as the source's current position. Ring slots and
+// source blocks then share boundaries, so block reads never straddle the
+// end of the ring.
+// position: byte position the source will read from next
+void Mp3StreamAlign(Mp3Stream *s, uint32_t position)
+{
+    Mp3StreamReset(s);
+    s->head = position % s->readBlock;
+    s->tail = s->head;
+}
+
+// Mp3StreamSetPhase
+// Reader stage: the source continues at a new position from the given ring
+// counter on, e.g. the next song. Reads are cut on the source's block
+// boundaries again; with the ring out of step, the read at the end of the
+// ring is the only one split off a block.
+// counter: ring counter of the first byte read from position
+// position: byte position the source reads from at counter
+void Mp3StreamSetPhase(Mp3Stream *s, uint32_t counter, uint32_t position)
+{
+    s->phase = (position - counter) % s->readBlock;
+}
+
+// Mp3StreamSetMark
+// Reader stage: makes the feeder stage stop at the given counter, e.g. the
+// first byte of the next song, until Mp3StreamClearMark(). Must be called
+// before head moves past the mark.
+// mark: ring counter, at or after head
+void Mp3StreamSetMark(Mp3Stream *s, uint32_t mark)
+{
+    s->mark = mark;
+    s->marked = 1;
+}
+
+// Mp3StreamClearMark
+// Feeder stage: lets the feeder stage drain past the mark again.
+void Mp3StreamClearMark(Mp3Stream *s)
+{
+    s->marked = 0;
+}
+
+uint32_t Mp3StreamLevel(const Mp3Stream *s)
+{
+    return s->head - s->tail;
+}
+
+uint32_t Mp3StreamSpace(const Mp3Stream *s)
+{
+    return s->size - (s->head - s->tail);
+}
+
+// Mp3StreamWantsFill
+// Returns: nonzero if the reader stage should read from the source now.
+// Filling runs from the low watermark up to the high watermark. The reader
+// task does not need it, Mp3StreamFill() applies the same hysteresis; a
+// single threaded driver like Tools/mp3sim uses it to pick the next stage.
+uint8_t Mp3StreamWantsFill(const Mp3Stream *s)
+{
+    uint32_t level = Mp3StreamLevel(s);
+
+    if (s->eof || s->sourceSpan != 0) return 0;
+    if (s->filling) return level < s->highWater;
+    return level <= s->lowWater;
+}
+
+// Mp3StreamReady
+// Returns: nonzero once enough data is buffered to start feeding the sink.
+uint8_t Mp3StreamReady(const Mp3Stream *s)
+{
+    return s->eof || s->sourceSpan != 0 || Mp3StreamLevel(s) >= s->lowWater;
+}
+
+// Mp3StreamFinished
+// Returns: nonzero when the source is exhausted and the ring is empty.
+uint8_t Mp3StreamFinished(const Mp3Stream *s)
+{
+    return s->eof && Mp3StreamLevel(s) == 0;
+}
+
+// Mp3StreamFill
+// Reader stage. Performs at most one source read into the contiguous free
+// region of the ring, ending on a read block boundary.
+// Returns: bytes added, 0 if no fill was needed or at end of stream,
+//     negative on source error.
+int32_t Mp3StreamFill(Mp3Stream *s)
+{
+    uint32_t level, space, idx, len;
+    int32_t n;
+
+    if (s->eof || s->sourceRead == 0) return 0;
+
+    level = Mp3StreamLevel(s);
+    space = s->size - level;
+
+    if (!s->filling)
+    {
+        if (level > s->lowWater) return 0;
+        s->filling = 1;
+    }
+    if (level >= s->highWater || space < s->readBlock)
+    {
+        s->filling = 0;
+        return 0;
+    }
+
+    idx = s->head & (s->size - 1);
+    len = s->size - idx;
+    if (len > space) len = space;
+
+    // End each source read on a source block boundary. With the ring aligned
+    // to the source position (Mp3StreamAlign) every read after the first one
+    // covers whole blocks, which the SD layer transfers straight into the ring.
+    if ((s->head + s->phase + len) % s->readBlock < len) len -= (s->head + s->phase + len) % s->readBlock;
+
+    n = s->sourceRead(s->sourceCtx, &s->buf[idx], len);
+    if (n <= 0)
+    {
+        if (n < 0) s->error = n;
+        s->eof = 1;
+        return n;
+    }
+
+    s->head += (uint32_t)n;
+    return n;
+}
+
+// Mp3StreamDrainSpan
+// Mp3StreamDrain() for a span source: the sink reads the source's memory.
+static int32_t Mp3StreamDrainSpan(Mp3Stream *s, uint32_t max)
+{
+    uint32_t total = 0;
+    uint32_t len;
+    int32_t n;
+
+    while (total < max)
+    {
+        if (Mp3StreamLevel(s) == 0)
+        {
+            if (s->eof) break;
+            n = s->sourceSpan(s->sourceCtx, &s->span, max - total);
+            if (n <= 0)
+            {
+                if (n < 0) s->error = n;
+                s->eof = 1;
+                break;
+            }
+            s->head += (uint32_t)n;
+        }
+
+        len = Mp3StreamLevel(s);
+        if (len > s->sinkChunk) len = s->sinkChunk;
+        if (len > max - total) len = max - total;
+
+        n = s->sinkWrite(s->sinkCtx, (uint8_t*)s->span, len);
+        if (n < 0)
+        {
+            s->error = n;
+            return n;
+        }
+        if (n == 0) break;
+
+        s->span += n;
+        s->tail += (uint32_t)n;
+        total += (uint32_t)n;
+    }
+
+    return (int32_t)total;
+}
+
+// Mp3StreamDrain
+// Feeder stage. Hands buffered data to the sink in chunks of at most
+// sinkChunk bytes until max bytes are written, the ring is empty, the mark
+// is reached or the sink stops accepting data.
+// Returns: bytes consumed, negative on sink error.
+int32_t Mp3StreamDrain(Mp3Stream *s, uint32_t max)
+{
+    uint32_t total = 0;
+    uint32_t head, level, idx, len;
+    int32_t n;
+
+    if (s->sinkWrite == 0) return 0;
+    if (s->sourceSpan != 0) return Mp3StreamDrainSpan(s, max);
+
+    while (total < max)
+    {
+        // head before the mark: the reader sets a mark before head passes it,
+        // so data behind the mark always comes with the mark
+        head = s->head;
+        level = head - s->tail;
+        if (s->marked && s->mark - s->tail < level) level = s->mark - s->tail;
+        if (level == 0) break;
+
+        idx = s->tail & (s->size - 1);
+        len = s->size - idx;
+        if (len > level) len = level;
+        if (len > s->sinkChunk) len = s->sinkChunk;
+        if (len > max - total) len = max - total;
+
+        n = s->sinkWrite(s->sinkCtx, &s->buf[idx], len);
+        if (n < 0)
+        {
+            s->error = n;
+            return n;
+        }
+        if (n == 0) break;
+
+        s->tail += (uint32_t)n;
+        total += (uint32_t)n;
+    }
+
+    return (int32_t)total;
+}
@@ -0,0 +1,105 @@
+/*
+    mp3Stream.h
+    Ring-buffered streaming engine that decouples the SD reader stage from the
+    MP3 decoder feeder stage.
+
+    The engine only depends on <stdint.h> so it can be built and exercised on
+    a host machine with a file-backed source and a simulated decoder sink.
+    The RTOS glue (tasks, event flags) lives in mp3Util.c.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __MP3STREAM_H
+#define __MP3STREAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default engine geometry. The ring size must be a power of two and a
+// multiple of the read block size.
+#ifndef MP3_STREAM_BUF_SIZE
+#define MP3_STREAM_BUF_SIZE         8192u   // ~0.5 s of audio at 128 kbps
+#endif
+#ifndef MP3_STREAM_READ_BLOCK
+#define MP3_STREAM_READ_BLOCK       512u    // one SD block per source read
+#endif
+#ifndef MP3_STREAM_HIGH_WATER
+#define MP3_STREAM_HIGH_WATER       (MP3_STREAM_BUF_SIZE - MP3_STREAM_READ_BLOCK)
+#endif
+#ifndef MP3_STREAM_LOW_WATER
+#define MP3_STREAM_LOW_WATER        (MP3_STREAM_BUF_SIZE / 2u)
+#endif
+
+#define MP3_STREAM_ERR_NONE          0
+#define MP3_STREAM_ERR_GEOMETRY     -1
+
+// Source: copy up to len bytes into dst.
+// Returns the number of bytes copied, 0 at end of stream, negative on error.
+typedef int32_t (*Mp3SourceRead)(void *ctx, uint8_t *dst, uint32_t len);
+
+// Span source: point span at up to len bytes held by the source itself.
+// Returns the number of bytes at span, 0 at end of stream, negative on error.
+typedef int32_t (*Mp3SourceSpan)(void *ctx, const uint8_t **span, uint32_t len);
+
+// Sink: consume up to len bytes from src.
+// Returns the number of bytes accepted (0 if the sink is busy), negative on error.
+typedef int32_t (*Mp3SinkWrite)(void *ctx, uint8_t *src, uint32_t len);
+
+typedef struct _Mp3Stream
+{
+    uint8_t  *buf;
+    uint32_t  size;                 // ring size in bytes, power of two
+    volatile uint32_t head;         // total bytes produced by the reader stage
+    volatile uint32_t tail;         // total bytes consumed by the feeder stage
+    uint32_t  highWater;            // reader pauses once this many bytes are buffered
+    uint32_t  lowWater;             // reader resumes once the level drops to this
+    uint32_t  readBlock;            // source read granularity
+    uint32_t  phase;                // source position - ring counter, modulo readBlock
+    uint32_t  sinkChunk;            // largest single write handed to the sink
+    uint8_t   filling;              // reader hysteresis state
+    volatile uint8_t eof;           // source reported end of stream or an error
+    volatile uint32_t mark;         // the feeder stage stops at this counter while marked
+    volatile uint8_t marked;
+    int32_t   error;                // last negative source/sink return value
+
+    Mp3SourceRead sourceRead;
+    Mp3SourceSpan sourceSpan;       // set: the feeder drains the source directly, no ring
+    void         *sourceCtx;
+    const uint8_t *span;            // span source: data not yet taken by the sink
+
+    Mp3SinkWrite  sinkWrite;
+    void         *sinkCtx;
+} Mp3Stream;
+
+int32_t  Mp3StreamSetup(Mp3Stream *s, uint8_t *buf, uint32_t size,
+                        uint32_t highWater, uint32_t lowWater,
+                        uint32_t readBlock, uint32_t sinkChunk);
+void     Mp3StreamSetSource(Mp3Stream *s, Mp3SourceRead read, void *ctx);
+void     Mp3StreamSetSpanSource(Mp3Stream *s, Mp3SourceSpan span, void *ctx);
+void     Mp3StreamSetSink(Mp3Stream *s, Mp3SinkWrite write, void *ctx);
+void     Mp3StreamReset(Mp3Stream *s);
+void     Mp3StreamAlign(Mp3Stream *s, uint32_t position);
+void     Mp3StreamSetPhase(Mp3Stream *s, uint32_t counter, uint32_t position);
+void     Mp3StreamSetMark(Mp3Stream *s, uint32_t mark);
+void     Mp3StreamClearMark(Mp3Stream *s);
+
+int32_t  Mp3StreamFill(Mp3Stream *s);
+int32_t  Mp3StreamDrain(Mp3Stream *s, uint32_t max);
+
+uint32_t Mp3StreamLevel(const Mp3Stream *s);
+uint32_t Mp3StreamSpace(const Mp3Stream *s);
+uint8_t  Mp3StreamWantsFill(const Mp3Stream *s);
+uint8_t  Mp3StreamReady(const Mp3Stream *s);
+uint8_t  Mp3StreamFinished(const Mp3Stream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,357 @@
+/*
+    mp3StreamInfo.c
+    MPEG audio Layer III stream information: ID3v2 tag size, frame header
+    parsing, Xing/Info and VBRI seek tables and time <-> byte position
+    mapping used for accurate seeking.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "mp3StreamInfo.h"
+
+// Layer III bitrates in kbit/s indexed by [MPEG 1 or 2/2.5][bitrate index]
+static const uint16_t Mp3Bitrates[2][16] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+    { 0,  8, 16, 24, 32, 40, 48, 56,  64,  80,  96, 112, 128, 144, 160, 0 }
+};
+
+// Sample rates in Hz indexed by [MPEG 1, 2, 2.5][sample rate index]
+static const uint32_t Mp3SampleRates[3][3] = {
+    { 44100, 48000, 32000 },
+    { 22050, 24000, 16000 },
+    { 11025, 12000,  8000 }
+};
+
+static uint32_t ReadBE32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t ReadBE16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// TocEntry
+// Returns: offset expressed in 1/256 of total, as stored in a Xing table
+static uint8_t TocEntry(uint32_t offset, uint32_t total)
+{
+    uint32_t x = (uint32_t)((uint64_t)offset * 256 / total);
+    return (uint8_t)((x > 255) ? 255 : x);
+}
+
+// Mp3ParseFrameHeader
+// Decodes a 4 byte MPEG audio Layer III frame header.
+// Returns: 1 if p holds a valid header, 0 otherwise
+uint8_t Mp3ParseFrameHeader(const uint8_t *p, Mp3FrameHeader *hdr)
+{
+    uint8_t versionBits, bitrateIdx, rateIdx;
+
+    if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) return 0;
+    if (((p[1] >> 1) & 0x03) != 0x01) return 0;             // Layer III only
+
+    versionBits = (p[1] >> 3) & 0x03;
+    if (versionBits == 0x01) return 0;                       // reserved
+    hdr->version = (versionBits == 0x03) ? 1 : (versionBits == 0x02) ? 2 : 3;
+
+    bitrateIdx = p[2] >> 4;
+    rateIdx = (p[2] >> 2) & 0x03;
+    if (bitrateIdx == 0 || bitrateIdx == 0x0F || rateIdx == 0x03) return 0;  // free format or reserved
+
+    hdr->bitrate = Mp3Bitrates[hdr->version == 1 ? 0 : 1][bitrateIdx];
+    hdr->sampleRate = Mp3SampleRates[hdr->version - 1][rateIdx];
+    hdr->padding = (p[2] >> 1) & 0x01;
+    hdr->channels = ((p[3] >> 6) == 0x03) ? 1 : 2;
+    hdr->samplesPerFrame = (hdr->version == 1) ? 1152 : 576;
+    hdr->frameLength = (uint16_t)((hdr->samplesPerFrame / 8) * 1000u * hdr->bitrate / hdr->sampleRate + hdr->padding);
+
+    if (hdr->version == 1)
+        hdr->sideInfoEnd = (hdr->channels == 1) ? 4 + 17 : 4 + 32;
+    else
+        hdr->sideInfoEnd = (hdr->channels == 1) ? 4 + 9 : 4 + 17;
+
+    return 1;
+}
+
+// SameStream
+// Returns: 1 if two headers can belong to the same stream
+static uint8_t SameStream(const Mp3FrameHeader *a, const Mp3FrameHeader *b)
+{
+    return a->version == b->version && a->sampleRate == b->sampleRate;
+}
+
+// Mp3InfoFindFrame
+// Searches forward from pos for a frame header that is followed by another
+// valid header of the same stream, so that a stray 0xFFE pattern in the
+// audio data is not taken for a sync. The successor is read from the
+// source even if it lies past the search limit.
+// end: search limit (exclusive), a sync must start before it
+// audioEnd: end of the audio, a frame running up to it needs no successor
+// ref: if not NULL the frame must match this stream
+// found, hdr: position and header of the frame found
+// Returns: 1 if a frame was found, 0 otherwise
+uint8_t Mp3InfoFindFrame(Mp3InfoRead read, void *ctx, uint32_t pos, uint32_t end, uint32_t audioEnd,
+                         const Mp3FrameHeader *ref, uint32_t *found, Mp3FrameHeader *hdr)
+{
+    uint8_t buf[256];
+    uint8_t next[4];
+    Mp3FrameHeader nextHdr;
+    int32_t n, i;
+
+    while (pos + 4 <= end)
+    {
+        n = read(ctx, pos, buf, (end - pos < sizeof(buf)) ? end - pos : sizeof(buf));
+        if (n < 4) return 0;
+
+        for (i = 0; i <= n - 4; i++)
+        {
+            if (buf[i] != 0xFF) continue;
+            if (!Mp3ParseFrameHeader(&buf[i], hdr)) continue;
+            if (ref != 0 && !SameStream(hdr, ref)) continue;
+
+            // A frame running up to the end of the audio has no successor
+            if (pos + i + hdr->frameLength + 4 > audioEnd)
+            {
+                *found = pos + i;
+                return 1;
+            }
+            if (read(ctx, pos + i + hdr->frameLength, next, 4) != 4) continue;
+            if (!Mp3ParseFrameHeader(next, &nextHdr) || !SameStream(hdr, &nextHdr)) continue;
+
+            *found = pos + i;
+            return 1;
+        }
+
+        // Overlap by 3 bytes so a header split across reads is still seen
+        pos += (uint32_t)(n - 3);
+    }
+    return 0;
+}
+
+// ParseVbriToc
+// Converts the VBRI table following the header at tablePos into a Xing style
+// per-percent table.
+static void ParseVbriToc(Mp3StreamInfo *info, Mp3InfoRead read, void *ctx, uint32_t tablePos,
+                         uint16_t entries, uint16_t scale, uint16_t entrySize, uint16_t framesPerEntry)
+{
+    uint8_t buf[64];
+    uint32_t offset = 0;           // bytes covered by the entries processed so far
+    uint32_t frame = 0;            // frames covered by the entries processed so far
+    uint32_t perChunk = sizeof(buf) / entrySize;
+    uint32_t percent = 0;
+    uint32_t i, j, n, entry;
+
+    for (i = 0; i < entries && percent < MP3_INFO_TOC_SIZE; i += n)
+    {
+        n = entries - i;
+        if (n > perChunk) n = perChunk;
+        if (read(ctx, tablePos + i * entrySize, buf, n * entrySize) != (int32_t)(n * entrySize)) break;
+
+        for (j = 0; j < n; j++)
+        {
+            // Fill every percent point reached before this entry
+            while (percent < MP3_INFO_TOC_SIZE &&
+                   (uint64_t)percent * info->totalFrames <= (uint64_t)frame * 100)
+            {
+                info->toc[percent++] = TocEntry(offset, info->tocBytes);
+            }
+
+            entry = 0;
+            for (uint32_t k = 0; k < entrySize; k++) entry = (entry << 8) | buf[j * entrySize + k];
+            offset += entry * scale;
+            frame += framesPerEntry;
+        }
+    }
+
+    while (percent < MP3_INFO_TOC_SIZE)
+    {
+        info->toc[percent++] = TocEntry(offset, info->tocBytes);
+    }
+}
+
+// Mp3InfoParse
+// Locates the audio data and builds the seek information for a stream.
+// fileSize: total size of the stream in bytes
+// Returns: 1 on success, 0 if no MPEG audio Layer III frame was found
+uint8_t Mp3InfoParse(Mp3StreamInfo *info, Mp3InfoRead read, void *ctx, uint32_t fileSize)
+{
+    uint8_t buf[192];
+    uint32_t pos, frames, bitrateSum, i;
+    const uint8_t *tag;
+    Mp3FrameHeader hdr;
+    int32_t n;
+
+    info->audioStart = 0;
+    info->audioEnd = fileSize;
+    info->totalFrames = 0;
+    info->tocType = MP3_INFO_TOC_NONE;
+    info->hasTagFrame = 0;
+
+    // ID3v2 tag: 10 byte header with a syncsafe size, optional 10 byte footer
+    if (read(ctx, 0, buf, 10) == 10 && buf[0] == 'I' && buf[1] == 'D' && buf[2] == '3')
+    {
+        info->audioStart = 10 + (((uint32_t)(buf[6] & 0x7F) << 21) | ((uint32_t)(buf[7] & 0x7F) << 14) |
+                                 ((uint32_t)(buf[8] & 0x7F) << 7) | (buf[9] & 0x7F));
+        if (buf[5] & 0x10) info->audioStart += 10;
+    }
+
+    // ID3v1 tag: last 128 bytes start with "TAG"
+    if (fileSize >= info->audioStart + 128 &&
+        read(ctx, fileSize - 128, buf, 3) == 3 && buf[0] == 'T' && buf[1] == 'A' && buf[2] == 'G')
+    {
+        info->audioEnd = fileSize - 128;
+    }
+
+    // Tags are often followed by padding, so search for the first frame
+    pos = info->audioStart;
+    if (!Mp3InfoFindFrame(read, ctx, pos,
+                          (info->audioEnd - pos > MP3_INFO_SYNC_WINDOW) ? pos + MP3_INFO_SYNC_WINDOW : info->audioEnd,
+                          info->audioEnd, 0, &info->audioStart, &info->first))
+    {
+        return 0;
+    }
+    info->tocBytes = info->audioEnd - info->audioStart;
+
+    n = read(ctx, info->audioStart, buf, sizeof(buf));
+    if (n < 0) return 0;
+
+    // Xing (VBR) or Info (CBR) tag right after the side information
+    tag = &buf[info->first.sideInfoEnd];
+    if (n >= info->first.sideInfoEnd + 8 &&
+        ((tag[0] == 'X' && tag[1] == 'i' && tag[2] == 'n' && tag[3] == 'g') ||
+         (tag[0] == 'I' && tag[1] == 'n' && tag[2] == 'f' && tag[3] == 'o')))
+    {
+        uint32_t flags = ReadBE32(&tag[4]);
+        info->hasTagFrame = 1;
+        tag += 8;
+        // The optional fields follow in flag order, each only if it was read
+        if ((flags & 0x01) && (tag + 4) <= &buf[n]) { info->totalFrames = ReadBE32(tag); tag += 4; }
+        if ((flags & 0x02) && (tag + 4) <= &buf[n]) { info->tocBytes = ReadBE32(tag); tag += 4; }
+        if ((flags & 0x04) && (tag + MP3_INFO_TOC_SIZE) <= &buf[n])
+        {
+            for (i = 0; i < MP3_INFO_TOC_SIZE; i++) info->toc[i] = tag[i];
+            info->tocType = MP3_INFO_TOC_XING;
+        }
+        if (info->tocBytes == 0 || info->tocBytes > info->audioEnd - info->audioStart)
+        {
+            info->tocBytes = info->audioEnd - info->audioStart;
+        }
+    }
+    // VBRI tag at a fixed offset of 32 bytes after the header
+    else if (n >= 4 + 32 + 26 && buf[36] == 'V' && buf[37] == 'B' && buf[38] == 'R' && buf[39] == 'I')
+    {
+        uint32_t vbriBytes = ReadBE32(&buf[36 + 10]);
+        uint16_t entries = ReadBE16(&buf[36 + 18]);
+        uint16_t scale = ReadBE16(&buf[36 + 20]);
+        uint16_t entrySize = ReadBE16(&buf[36 + 22]);
+        uint16_t framesPerEntry = ReadBE16(&buf[36 + 24]);
+
+        info->hasTagFrame = 1;
+        info->totalFrames = ReadBE32(&buf[36 + 14]);
+        if (vbriBytes != 0 && vbriBytes <= info->audioEnd - info->audioStart) info->tocBytes = vbriBytes;
+        if (info->totalFrames != 0 && entries != 0 && entrySize >= 1 && entrySize <= 4 && framesPerEntry != 0)
+        {
+            ParseVbriToc(info, read, ctx, info->audioStart + 36 + 26, entries, scale, entrySize, framesPerEntry);
+            info->tocType = MP3_INFO_TOC_VBRI;
+        }
+    }
+
+    if (info->totalFrames != 0)
+    {
+        info->durationMs = (uint32_t)((uint64_t)info->totalFrames * info->first.samplesPerFrame * 1000 /
+                                      info->first.sampleRate);
+        info->bitrate = (info->durationMs != 0) ?
+                        (uint32_t)((uint64_t)info->tocBytes * 8000 / info->durationMs) : 0;
+    }
+    else
+    {
+        // No frame count: average the bitrate over the first frames
+        pos = info->audioStart;
+        hdr = info->first;
+        bitrateSum = 0;
+        for (frames = 0; frames < MP3_INFO_SCAN_FRAMES; frames++)
+        {
+            bitrateSum += hdr.bitrate;
+            pos += hdr.frameLength;
+            if (pos + 4 > info->audioEnd || read(ctx, pos, buf, 4) != 4) { frames++; break; }
+            if (!Mp3ParseFrameHeader(buf, &hdr) || !SameStream(&hdr, &info->first)) { frames++; break; }
+        }
+        info->bitrate = bitrateSum * 1000 / frames;
+        info->durationMs = (uint32_t)((uint64_t)info->tocBytes * 8000 / info->bitrate);
+    }
+
+    if (info->bitrate == 0) info->bitrate = (uint32_t)info->first.bitrate * 1000;
+    return 1;
+}
+
+// Mp3InfoTimeToByte
+// Returns: the approximate byte position of the given play time
+uint32_t Mp3InfoTimeToByte(const Mp3StreamInfo *info, uint32_t ms)
+{
+    uint32_t permille, i, fa, fb, fx;
+
+    if (ms >= info->durationMs) return info->audioEnd;
+
+    if (info->tocType == MP3_INFO_TOC_NONE)
+    {
+        return info->audioStart + (uint32_t)((uint64_t)ms * info->bitrate / 8000);
+    }
+
+    // Linear interpolation between the two surrounding percent entries
+    permille = (uint32_t)((uint64_t)ms * 100000 / info->durationMs);
+    i = permille / 1000;
+    fa = info->toc[i];
+    fb = (i + 1 < MP3_INFO_TOC_SIZE) ? info->toc[i + 1] : 256;
+    if (fb < fa) fb = fa;
+    fx = fa * 1000 + (fb - fa) * (permille % 1000);
+
+    return info->audioStart + (uint32_t)((uint64_t)fx * info->tocBytes / 256000);
+}
+
+// Mp3InfoByteToTime
+// Returns: the approximate play time in ms at the given byte position
+uint32_t Mp3InfoByteToTime(const Mp3StreamInfo *info, uint32_t pos)
+{
+    uint32_t x, i, fa, fb;
+
+    if (pos <= info->audioStart) return 0;
+    if (pos >= info->audioEnd) return info->durationMs;
+
+    if (info->tocType == MP3_INFO_TOC_NONE)
+    {
+        return (uint32_t)((uint64_t)(pos - info->audioStart) * 8000 / info->bitrate);
+    }
+
+    // Position in 1/256000 of the stream, then find the surrounding entries
+    x = (uint32_t)((uint64_t)(pos - info->audioStart) * 256000 / info->tocBytes);
+    for (i = 0; i + 1 < MP3_INFO_TOC_SIZE && info->toc[i + 1] * 1000u <= x; i++);
+    fa = info->toc[i] * 1000u;
+    fb = ((i + 1 < MP3_INFO_TOC_SIZE) ? info->toc[i + 1] : 256) * 1000u;
+    if (x < fa) x = fa;
+
+    return (uint32_t)(((uint64_t)i * 1000 + ((fb > fa) ? (uint64_t)(x - fa) * 1000 / (fb - fa) : 0)) *
+                      info->durationMs / 100000);
+}
+
+// Mp3InfoSeek
+// Finds the frame boundary at or just after the given play time.
+// pos: receives the byte position to continue streaming from
+// Returns: 1 on success, 0 if no frame was found (pos is left unchanged)
+uint8_t Mp3InfoSeek(const Mp3StreamInfo *info, Mp3InfoRead read, void *ctx,
+                    uint32_t ms, uint32_t *pos)
+{
+    uint32_t start = Mp3InfoTimeToByte(info, ms);
+    Mp3FrameHeader hdr;
+
+    if (start >= info->audioEnd)
+    {
+        *pos = info->audioEnd;
+        return 1;
+    }
+
+    return Mp3InfoFindFrame(read, ctx, start,
+                            (info->audioEnd - start > MP3_INFO_SYNC_WINDOW) ? start + MP3_INFO_SYNC_WINDOW : info->audioEnd,
+                            info->audioEnd, &info->first, pos, &hdr);
+}
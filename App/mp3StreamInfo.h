@@ -0,0 +1,75 @@
+/*
+    mp3StreamInfo.h
+    MPEG audio Layer III stream information: ID3v2 tag size, frame header
+    parsing, Xing/Info and VBRI seek tables and time <-> byte position
+    mapping used for accurate seeking.
+
+    Like mp3Stream.c this module only depends on <stdint.h> so it can be
+    used on a host machine as well.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __MP3STREAMINFO_H
+#define __MP3STREAMINFO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MP3_INFO_TOC_SIZE           100     // Xing style table, one entry per percent
+#define MP3_INFO_SCAN_FRAMES        32      // frames averaged for streams without a seek table
+#define MP3_INFO_SYNC_WINDOW        4096u   // bytes searched for a frame sync
+
+#define MP3_INFO_TOC_NONE           0       // constant bitrate estimate
+#define MP3_INFO_TOC_XING           1       // Xing/Info header
+#define MP3_INFO_TOC_VBRI           2       // Fraunhofer VBRI header
+
+// Random access read: copy up to len bytes at byte position pos into dst.
+// Returns the number of bytes copied, negative on error.
+typedef int32_t (*Mp3InfoRead)(void *ctx, uint32_t pos, uint8_t *dst, uint32_t len);
+
+typedef struct _Mp3FrameHeader
+{
+    uint8_t  version;               // 1 = MPEG 1, 2 = MPEG 2, 3 = MPEG 2.5
+    uint8_t  channels;
+    uint8_t  padding;
+    uint16_t bitrate;               // kbit/s
+    uint32_t sampleRate;            // Hz
+    uint16_t samplesPerFrame;
+    uint16_t frameLength;           // bytes including the header
+    uint8_t  sideInfoEnd;           // offset of the Xing/Info tag from the frame start
+} Mp3FrameHeader;
+
+typedef struct _Mp3StreamInfo
+{
+    uint32_t audioStart;            // first frame, i.e. just past any ID3v2 tag
+    uint32_t audioEnd;              // end of audio, i.e. before any ID3v1 tag
+    Mp3FrameHeader first;           // header of the first frame
+    uint8_t  hasTagFrame;           // the first frame holds a Xing/Info or VBRI tag, no audio
+    uint32_t bitrate;               // average bits per second
+    uint32_t totalFrames;           // 0 if unknown
+    uint32_t durationMs;
+    uint8_t  tocType;               // MP3_INFO_TOC_xxx
+    uint32_t tocBytes;              // bytes covered by toc[]
+    uint8_t  toc[MP3_INFO_TOC_SIZE];// toc[i] * tocBytes / 256 = offset at i percent
+} Mp3StreamInfo;
+
+uint8_t  Mp3ParseFrameHeader(const uint8_t *p, Mp3FrameHeader *hdr);
+uint8_t  Mp3InfoFindFrame(Mp3InfoRead read, void *ctx, uint32_t pos, uint32_t end, uint32_t audioEnd,
+                          const Mp3FrameHeader *ref, uint32_t *found, Mp3FrameHeader *hdr);
+uint8_t  Mp3InfoParse(Mp3StreamInfo *info, Mp3InfoRead read, void *ctx, uint32_t fileSize);
+uint32_t Mp3InfoTimeToByte(const Mp3StreamInfo *info, uint32_t ms);
+uint32_t Mp3InfoByteToTime(const Mp3StreamInfo *info, uint32_t pos);
+uint8_t  Mp3InfoSeek(const Mp3StreamInfo *info, Mp3InfoRead read, void *ctx,
+                     uint32_t ms, uint32_t *pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
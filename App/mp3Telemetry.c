@@ -0,0 +1,273 @@
+/*
+    mp3Telemetry.c
+    Streaming health telemetry for the audio path.
+
+    The feeder stage reports every write to the decoder, the reader stage
+    every SD read and the VS1053 driver every wait for DREQ. The shell's
+    "stats reset" clears the block from another task, so every update runs
+    with interrupts off, each a few loads and stores. Mp3TlmSnapshot() copies
+    the block the same way for a consistent view from the shell.
+
+    Durations are measured with the DWT cycle counter.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "mp3Telemetry.h"
+#include "globals.h"
+#include "mp3Sci.h"
+
+#define MP3_TLM_PRINT_BUF_SIZE      96
+
+static Mp3Telemetry mp3Tlm;
+
+// Mp3TlmCyclesToUs
+// Converts a DWT cycle count to microseconds.
+static INT32U Mp3TlmCyclesToUs(INT32U cycles)
+{
+    return cycles / (SystemCoreClock / 1000000u);
+}
+
+// Mp3TlmHistAdd
+// Counts one duration into a power of two histogram.
+static void Mp3TlmHistAdd(INT32U *hist, INT32U us)
+{
+    INT8U bin = 0;
+
+    us >>= MP3_TLM_HIST_MIN_SHIFT;
+    while (us != 0 && bin < MP3_TLM_HIST_BINS - 1)
+    {
+        us >>= 1;
+        bin++;
+    }
+    hist[bin]++;
+}
+
+// Mp3TlmInit
+// Clears the telemetry block. Hw_init() starts the DWT cycle counter.
+void Mp3TlmInit()
+{
+    Mp3TlmReset(0);
+    mp3Tlm.lastGapMs = 0;
+}
+
+// Mp3TlmReset
+// Starts a new telemetry block, called whenever a song starts playing and
+// by "stats reset" in the shell. The song transition and stop latencies are
+// kept.
+// song: index into listOfSongs of the song starting
+void Mp3TlmReset(INT32U song)
+{
+    OS_CPU_SR cpu_sr;
+    Mp3Telemetry prev;
+
+    OS_ENTER_CRITICAL();
+    prev = mp3Tlm;
+    memset(&mp3Tlm, 0, sizeof(mp3Tlm));
+    mp3Tlm.song = song;
+    mp3Tlm.minSecRate = 0xFFFFFFFF;
+    mp3Tlm.minLevel = 0xFFFFFFFF;
+    mp3Tlm.secStartTick = OSTimeGet();
+    mp3Tlm.lastGapMs = prev.lastGapMs;
+    mp3Tlm.stopTick = prev.stopTick;
+    mp3Tlm.isSwitchTiming = prev.isSwitchTiming;
+    mp3Tlm.lastStopMs = prev.lastStopMs;
+    mp3Tlm.lastSwitchMs = prev.lastSwitchMs;
+    mp3Tlm.cancels = prev.cancels;
+    mp3Tlm.cancelResets = prev.cancelResets;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmStamp
+// Returns: the current cycle count, to be passed back as a difference
+INT32U Mp3TlmStamp()
+{
+    return DWT->CYCCNT;
+}
+
+// Mp3TlmFed
+// Feeder stage: data was handed to the decoder.
+// bytes: bytes written
+// level: bytes left in the ring buffer afterwards
+void Mp3TlmFed(INT32U bytes, INT32U level)
+{
+    OS_CPU_SR cpu_sr;
+    INT32U now = OSTimeGet();
+    INT32U ticks;
+    INT32U rate;
+
+    OS_ENTER_CRITICAL();
+    ticks = now - mp3Tlm.secStartTick;
+    if (mp3Tlm.isSwitchTiming)
+    {
+        mp3Tlm.lastSwitchMs = (now - mp3Tlm.stopTick) * 1000 / OS_TICKS_PER_SEC;
+        mp3Tlm.isSwitchTiming = OS_FALSE;
+    }
+
+    mp3Tlm.bytesFed += bytes;
+    if (level < mp3Tlm.minLevel) mp3Tlm.minLevel = level;
+
+    mp3Tlm.secBytes += bytes;
+    if (ticks >= OS_TICKS_PER_SEC)
+    {
+        // A window stretched by a pause says nothing about the feed rate
+        if (ticks < 2 * OS_TICKS_PER_SEC)
+        {
+            rate = mp3Tlm.secBytes * OS_TICKS_PER_SEC / ticks;
+            mp3Tlm.lastSecRate = rate;
+            if (rate < mp3Tlm.minSecRate) mp3Tlm.minSecRate = rate;
+            if (rate > mp3Tlm.maxSecRate) mp3Tlm.maxSecRate = rate;
+        }
+        mp3Tlm.secBytes = 0;
+        mp3Tlm.secStartTick = now;
+    }
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmUnderrun
+// Feeder stage: the ring buffer ran empty while playing.
+void Mp3TlmUnderrun()
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    mp3Tlm.underruns++;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmDreqWait
+// VS1053 driver: the decoder held DREQ low for the given number of cycles.
+void Mp3TlmDreqWait(INT32U cycles)
+{
+    OS_CPU_SR cpu_sr;
+    INT32U us = Mp3TlmCyclesToUs(cycles);
+
+    OS_ENTER_CRITICAL();
+    mp3Tlm.dreqWaits++;
+    mp3Tlm.dreqWaitTotalUs += us;
+    if (us > mp3Tlm.dreqWaitMaxUs) mp3Tlm.dreqWaitMaxUs = us;
+    Mp3TlmHistAdd(mp3Tlm.dreqWaitHist, us);
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmSdRead
+// Reader stage: one SD file read took the given number of cycles.
+void Mp3TlmSdRead(INT32U cycles)
+{
+    OS_CPU_SR cpu_sr;
+    INT32U us = Mp3TlmCyclesToUs(cycles);
+
+    OS_ENTER_CRITICAL();
+    mp3Tlm.sdReads++;
+    if (us > mp3Tlm.sdReadMaxUs) mp3Tlm.sdReadMaxUs = us;
+    Mp3TlmHistAdd(mp3Tlm.sdReadHist, us);
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmGap
+// Feeder stage: records the time to next audio of a song transition.
+void Mp3TlmGap(INT32U ms)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    mp3Tlm.lastGapMs = ms;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmStopRequest
+// Command task: the user stopped the song or picked another one while
+// playing. Starts the touch to silence and touch to next audio timers.
+// isSwitch: OS_TRUE if another song is to start
+void Mp3TlmStopRequest(BOOLEAN isSwitch)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    mp3Tlm.stopTick = OSTimeGet();
+    mp3Tlm.isStopTiming = OS_TRUE;
+    mp3Tlm.isSwitchTiming = isSwitch;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmStopSilent
+// Feeder stage: the decoder stopped after a stop request.
+// isCancelled: OS_TRUE if it acknowledged SM_CANCEL, OS_FALSE if it was reset
+void Mp3TlmStopSilent(BOOLEAN isCancelled)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    if (mp3Tlm.isStopTiming)
+    {
+        mp3Tlm.lastStopMs = (OSTimeGet() - mp3Tlm.stopTick) * 1000 / OS_TICKS_PER_SEC;
+        mp3Tlm.isStopTiming = OS_FALSE;
+    }
+    if (isCancelled) mp3Tlm.cancels++;
+    else mp3Tlm.cancelResets++;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmSnapshot
+// Copies the telemetry block.
+// out: receives the copy
+void Mp3TlmSnapshot(Mp3Telemetry *out)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();
+    *out = mp3Tlm;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3TlmPrintHist
+// Prints the non empty bins of a histogram, labelled by their lower bound.
+static void Mp3TlmPrintHist(char *buf, const INT32U *hist)
+{
+    INT8U bin;
+
+    for (bin = 0; bin < MP3_TLM_HIST_BINS; bin++)
+    {
+        if (hist[bin] == 0) continue;
+        PrintWithBuf(buf, MP3_TLM_PRINT_BUF_SIZE, "    >= %u us: %u\n",
+                     (unsigned int)(bin == 0 ? 0 : 1u << (bin + MP3_TLM_HIST_MIN_SHIFT - 1)),
+                     (unsigned int)hist[bin]);
+    }
+}
+
+// Mp3TlmPrint
+// Prints the telemetry block on the UART.
+void Mp3TlmPrint()
+{
+    char buf[MP3_TLM_PRINT_BUF_SIZE];
+    Mp3Telemetry tlm;
+    INT32U sciWrites, sciSkipped;
+
+    Mp3TlmSnapshot(&tlm);
+    Mp3SciStats(&sciWrites, &sciSkipped);
+
+    PrintWithBuf(buf, sizeof(buf), "song %u: %s\n", (unsigned int)tlm.song, listOfSongs[tlm.song]);
+    PrintWithBuf(buf, sizeof(buf), "  fed %u bytes, %u B/s (min %u, max %u)\n",
+                 (unsigned int)tlm.bytesFed, (unsigned int)tlm.lastSecRate,
+                 (unsigned int)(tlm.minSecRate == 0xFFFFFFFF ? 0 : tlm.minSecRate),
+                 (unsigned int)tlm.maxSecRate);
+    PrintWithBuf(buf, sizeof(buf), "  ring min level %u bytes, %u underruns\n",
+                 (unsigned int)(tlm.minLevel == 0xFFFFFFFF ? 0 : tlm.minLevel),
+                 (unsigned int)tlm.underruns);
+    PrintWithBuf(buf, sizeof(buf), "  dreq waits %u, total %u us, max %u us\n",
+                 (unsigned int)tlm.dreqWaits, (unsigned int)tlm.dreqWaitTotalUs,
+                 (unsigned int)tlm.dreqWaitMaxUs);
+    Mp3TlmPrintHist(buf, tlm.dreqWaitHist);
+    PrintWithBuf(buf, sizeof(buf), "  sd reads %u, max %u us\n",
+                 (unsigned int)tlm.sdReads, (unsigned int)tlm.sdReadMaxUs);
+    Mp3TlmPrintHist(buf, tlm.sdReadHist);
+    PrintWithBuf(buf, sizeof(buf), "  last song transition %u ms\n", (unsigned int)tlm.lastGapMs);
+    PrintWithBuf(buf, sizeof(buf), "  last stop %u ms to silence, %u ms to next audio\n",
+                 (unsigned int)tlm.lastStopMs, (unsigned int)tlm.lastSwitchMs);
+    PrintWithBuf(buf, sizeof(buf), "  stops %u cancelled, %u reset\n",
+                 (unsigned int)tlm.cancels, (unsigned int)tlm.cancelResets);
+    PrintWithBuf(buf, sizeof(buf), "  sci writes %u, %u skipped or merged\n",
+                 (unsigned int)sciWrites, (unsigned int)sciSkipped);
+}
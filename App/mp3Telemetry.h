@@ -0,0 +1,63 @@
+/*
+    mp3Telemetry.h
+    Streaming health telemetry for the audio path: feed rate, DREQ stall and
+    SD read latency histograms, ring buffer low watermark and underruns.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __MP3TELEMETRY_H
+#define __MP3TELEMETRY_H
+
+#include "bsp.h"
+
+// Latency histograms use power of two bins: bin 0 counts waits below 16 us,
+// bin i counts waits of 2^(i+3) us up to 2^(i+4) us, the last bin is open ended
+#define MP3_TLM_HIST_BINS           12
+#define MP3_TLM_HIST_MIN_SHIFT      4       // bin 0 covers up to 2^4 us
+
+typedef struct _Mp3Telemetry
+{
+    INT32U song;                            // listOfSongs index the block belongs to
+    INT32U bytesFed;                        // bytes handed to the decoder
+    INT32U secBytes;                        // bytes fed in the current one second window
+    INT32U secStartTick;
+    INT32U lastSecRate;                     // bytes/s of the last full window
+    INT32U minSecRate;                      // lowest bytes/s over a full window
+    INT32U maxSecRate;
+    INT32U minLevel;                        // fewest bytes buffered while playing
+    INT32U underruns;                       // ring ran dry while playing
+    INT32U dreqWaits;
+    INT32U dreqWaitTotalUs;
+    INT32U dreqWaitMaxUs;
+    INT32U dreqWaitHist[MP3_TLM_HIST_BINS];
+    INT32U sdReads;
+    INT32U sdReadMaxUs;
+    INT32U sdReadHist[MP3_TLM_HIST_BINS];
+    INT32U lastGapMs;                       // time to next audio of the last song transition
+    // Kept across songs like lastGapMs: a stop or switch spans two blocks
+    INT32U stopTick;                        // tick of the last stop or switch touch
+    BOOLEAN isStopTiming;                   // waiting for the decoder to go silent
+    BOOLEAN isSwitchTiming;                 // waiting for the next song's first audio
+    INT32U lastStopMs;                      // touch to silence
+    INT32U lastSwitchMs;                    // touch to next audio
+    INT32U cancels;                         // stops acknowledged through SM_CANCEL
+    INT32U cancelResets;                    // stops that needed a soft reset
+} Mp3Telemetry;
+
+void   Mp3TlmInit();
+void   Mp3TlmReset(INT32U song);
+INT32U Mp3TlmStamp();
+void   Mp3TlmFed(INT32U bytes, INT32U level);
+void   Mp3TlmUnderrun();
+void   Mp3TlmDreqWait(INT32U cycles);
+void   Mp3TlmSdRead(INT32U cycles);
+void   Mp3TlmGap(INT32U ms);
+void   Mp3TlmStopRequest(BOOLEAN isSwitch);
+void   Mp3TlmStopSilent(BOOLEAN isCancelled);
+void   Mp3TlmSnapshot(Mp3Telemetry *out);
+void   Mp3TlmPrint();
+
+#endif
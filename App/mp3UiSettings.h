@@ -169,6 +169,13 @@ Alternatively,
 #define STATUS_XCOORD    80U
 #define STATUS_YCOORD    272U
 
+// Elapsed time and stream format, below the play status
+#define TIME_XCOORD      80U
+#define TIME_YCOORD      284U
+
+#define FORMAT_XCOORD    80U
+#define FORMAT_YCOORD    296U
+
 #define VOLBOX_XCOORD    225U
 #define VOLBOX_YCOORD    260U
 
@@ -49,6 +49,7 @@ static void updateVolumeBar(Adafruit_GFX_Button *vol, BOOLEAN state);
 static void setMenuToInactiveState(Adafruit_GFX_Button *menu);
 static INT8U getActiveButtonCount (boolean upDownFlag);
 static void drawPlayStatus(char *status);
+static void drawDecodeStatus(const Mp3DecodeStatus *status);
 static void PrintCharToLcd(char c);
 
 void InitMenuLabels(PlayerWindow *pWindow, boolean upDownFlag);
@@ -458,6 +459,35 @@ static void drawPlayStatus(char *status)
     PrintToLcdWithBuf(buf, BUFFERSIZE, status);
 }
 
+// Shows the elapsed time, song length and stream format under the play
+// status, or clears them if status is NULL. Trailing spaces overwrite the
+// previous, possibly longer, text.
+static void drawDecodeStatus(const Mp3DecodeStatus *status)
+{
+    char buf[BUFFERSIZE];
+    
+    lcdCtrl.setTextColor(ILI9341_BLACK, ILI9341_WHITE);  
+    lcdCtrl.setTextSize(1);
+    
+    lcdCtrl.setCursor(TIME_XCOORD, TIME_YCOORD);
+    if (status == NULL)
+        PrintToLcdWithBuf(buf, BUFFERSIZE, "           ");
+    else if (status->durationSec != 0)
+        PrintToLcdWithBuf(buf, BUFFERSIZE, "%d:%d%d/%d:%d%d ",
+                          status->elapsedSec / 60, (status->elapsedSec % 60) / 10, status->elapsedSec % 10,
+                          status->durationSec / 60, (status->durationSec % 60) / 10, status->durationSec % 10);
+    else
+        PrintToLcdWithBuf(buf, BUFFERSIZE, "%d:%d%d      ",
+                          status->elapsedSec / 60, (status->elapsedSec % 60) / 10, status->elapsedSec % 10);
+    
+    lcdCtrl.setCursor(FORMAT_XCOORD, FORMAT_YCOORD);
+    if (status == NULL || status->sampleRate == 0)
+        PrintToLcdWithBuf(buf, BUFFERSIZE, "           ");
+    else
+        PrintToLcdWithBuf(buf, BUFFERSIZE, "%dk %d.%dk  ",
+                          status->bitrate, status->sampleRate / 1000, (status->sampleRate % 1000) / 100);
+}
+
 // Renders a character at the current cursor position on the LCD
 static void PrintCharToLcd(char c)
 {
@@ -490,6 +520,7 @@ void PrintToLcdWithBuf(char *buf, int size, char *format, ...)
 void PlayerWindowStateMachine(PlayerWindow *pWindow, Event_Type winEvent)
 {
     OS_CPU_SR cpu_sr;
+    Mp3DecodeStatus decodeStatus;
     switch (winEvent)
     {
     case EVENT_PLAY_PRESS:
@@ -532,6 +563,7 @@ void PlayerWindowStateMachine(PlayerWindow *pWindow, Event_Type winEvent)
         statusBarBtnCnt = -1;
         
         drawPlayStatus(player_status[STOPPED]);
+        drawDecodeStatus(NULL);
         break;
     case EVENT_REWIND_PRESS:
         buttonPressResponse(&pWindow->button_list[REWIND]);
@@ -706,6 +738,10 @@ void PlayerWindowStateMachine(PlayerWindow *pWindow, Event_Type winEvent)
             statusBarBtnCnt--;
         }
         
+        break;
+    case EVENT_DECODE_STATUS:
+        Mp3GetDecodeStatus(&decodeStatus);
+        drawDecodeStatus(&decodeStatus);
         break;
     case EVENT_NONE:
         break;
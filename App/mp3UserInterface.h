@@ -18,6 +18,7 @@
 
 #include "mp3UserInterface.h"
 #include "mp3UiSettings.h"
+#include "mp3Util.h"
 
 #define BUFFERSIZE  32U
 
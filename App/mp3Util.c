@@ -7,18 +7,56 @@
     2016/2 Nick Strathy wrote/arranged it
 
     2021/2 Abhilash Sahoo updated to support MP3 Streaming task for the project
+
+    2021/3 Abhilash Sahoo split streaming into an SD reader stage and a decoder
+           feeder stage connected by a ring buffer (see mp3Stream.c)
+
+    2021/3 Abhilash Sahoo added gapless transitions to the next song of the list
 */
 
+#include <string.h>
 #include "mp3Util.h"
+#include "mp3Telemetry.h"
+#include "mp3Sci.h"
+#include "mp3AudioSource.h"
 
 #define DEFAULT_VOLUME_INDEX 8
 
 void delay(uint32_t time);
 
 
-static File dataFile;
-static INT8U  mp3Buf[MP3_DECODER_BUF_SIZE];
-static INT32U iBufPos = 0;
+// The feeder plays playSrc while the reader reads readSrc. They only differ
+// while the next song is queued in the ring behind the end of the current one.
+static Mp3AudioSource trackSrc[2];
+static Mp3AudioSource *playSrc = &trackSrc[0];
+static Mp3AudioSource *readSrc = &trackSrc[0];
+static Mp3AudioSource * volatile prevSrc = 0;   // finished song, closed by the reader
+static INT32U readEnd = 0;                      // reader stops reading readSrc here
+static INT32U readSongPntr = 0;                 // song of the list in readSrc
+static Mp3StreamInfo nextInfo;
+static BOOLEAN isNextValid = OS_FALSE;
+static INT32U nextBegPos = 0;
+static volatile BOOLEAN isNextQueued = OS_FALSE;   // the ring's mark is the first byte of the next song
+static volatile BOOLEAN isNextNewFormat = OS_FALSE;    // the queued song needs endFillBytes before it
+static INT8U  endFillByte = 0;
+static BOOLEAN isEndFillRead = OS_FALSE;
+static INT32U mp3AutoNextSong = INT_MAX;        // song to start after a soft reset transition
+static INT32U lastFedTick = 0;
+static INT32U gapStartTick = 0;
+static BOOLEAN isGapTiming = OS_FALSE;
+static Event_Type mp3NextEvent = EVENT_DOWN_RELEASE;
+static Event_Type mp3StatusEvent = EVENT_DECODE_STATUS;
+static Mp3DecodeStatus mp3Status;
+static INT32U statusPollTick = 0;
+static INT8U  scanSpeed = 1;                    // decoder playSpeed, 1 when not scanning
+static BOOLEAN isScanTiming = OS_FALSE;
+static INT32U scanTick = 0;
+static BOOLEAN isDecoderReady = OS_FALSE;       // last stream was cancelled cleanly, no reset needed
+static INT8U  mp3RingBuf[MP3_STREAM_BUF_SIZE];
+static Mp3Stream mp3Stream;
+static volatile BOOLEAN isReaderStop = OS_FALSE;
+static Mp3StreamInfo mp3Info;
+static BOOLEAN isInfoValid = OS_FALSE;
 static INT32U iDataFileMovPos = 0;
 static INT32U iDataFileCurPos = 0;
 static INT32U iDataFileBegPos = 0;
@@ -31,72 +69,72 @@ extern BOOLEAN isFileStart;
 extern BOOLEAN isPlaying;
 extern BOOLEAN isStopSong;
 extern BOOLEAN isFastForward;
+extern BOOLEAN isScan;
 extern BOOLEAN isRewind;
-extern BOOLEAN isVolUp;
-extern BOOLEAN isVolDown;
 
 extern INT32U currPlayingSongFilePntr;
 
+// Mp3SoftReset
+// Soft resets the decoder and forgets the SCI shadow: every register is back
+// at its reset value, or unknown if the write did not go through.
+// hMp3: an open handle to the MP3 decoder
+static void Mp3SoftReset(HANDLE hMp3)
+{
+    Mp3SciWriteFrame(hMp3, BspMp3SoftReset);
+    Mp3SciInvalidate();
+}
+
 void Mp3StreamInit(HANDLE hMp3)
 {
-    INT32U length;
-    
-    // Place MP3 driver in command mode (subsequent writes will be sent to the decoder's command interface)
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+    // Writes go through the SCI register layer so its shadow knows the
+    // decoder's settings; the reset invalidates anything it knew before.
     
-    // Reset the device
-    length = BspMp3SoftResetLen;
-    Write(hMp3, (void*)BspMp3SoftReset, &length);
+    if (isDecoderReady)
+    {
+        // A cancelled stream leaves the decoder idle without a reset, the
+        // writes below restore known settings
+        isDecoderReady = OS_FALSE;
+    }
+    else
+    {
+        // Reset the device
+        Mp3SoftReset(hMp3);
+    }
     
-    length = BspMp3SetClockFLen;
-    Write(hMp3, (void*)BspMp3SetClockF, &length);
+    Mp3SciWriteFrame(hMp3, BspMp3SetClockF);
  
     // Set volume
-    length = BspMp3SetVolLen;
-    Write(hMp3, (void*)BspMp3SetVolRange[volProgressCounter], &length);
+    Mp3SciWriteFrame(hMp3, BspMp3SetVolRange[volProgressCounter]);
 
     // To allow streaming data, set the decoder mode to Play Mode
-    length = BspMp3PlayModeLen;
-    Write(hMp3, (void*)BspMp3PlayMode, &length);
+    Mp3SciWriteFrame(hMp3, BspMp3PlayMode);
    
-    // Set MP3 driver to data mode (subsequent writes will be sent to decoder's data interface)
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
+    // The register layer leaves the MP3 driver in data mode (subsequent writes
+    // will be sent to decoder's data interface)
 }
 
 // Volume Controller for the application
-void Mp3VolumeControl(HANDLE hMp3, VolumeCounter state)
+// Steps the volume and queues the new SCI_VOL value. Nothing is sent to the
+// decoder here: the MP3 task sends it with Mp3SciFlush(), once for any number
+// of presses that arrived in the meantime. SCI_MODE is left alone.
+void Mp3VolumeControl(VolumeCounter state)
 {
-    INT32U length;
+    OS_CPU_SR cpu_sr;
     
+    OS_ENTER_CRITICAL();
     if(state == VOLUP)
     {
         // Volume Range Index Sanity Check
-        if(volProgressCounter == MP3_VOLUME_RANGE-1) return;
-        
-        ++volProgressCounter;
+        if(volProgressCounter < MP3_VOLUME_RANGE-1) ++volProgressCounter;
     }
     else
     {
         // Volume Range Index Sanity Check
-        if(volProgressCounter == 0) return;
-        
-        --volProgressCounter;
+        if(volProgressCounter > 0) --volProgressCounter;
     }
     
-    // Place MP3 driver in command mode
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
-    
-    // Set volume
-    length = BspMp3SetVolLen;
-    Write(hMp3, (void*)BspMp3SetVolRange[volProgressCounter], &length);
-
-    // To allow streaming data, set the decoder mode to Play Mode
-    length = BspMp3PlayModeLen;
-    Write(hMp3, (void*)BspMp3PlayMode, &length);
-   
-    // Set MP3 driver to data mode
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
-        
+    Mp3SciQueueFrame(BspMp3SetVolRange[volProgressCounter]);
+    OS_EXIT_CRITICAL();
 }
 
 // Mp3GetRegister
@@ -157,145 +195,852 @@ void Mp3FetchFileNames()
     dir.seek(0); // reset directory file to read again;
 }
 
-// Mp3StreamSDFile
-// Streams the given file from the SD card to the given MP3 decoder.
-// hMP3: an open handle to the MP3 decoder
-// pFilename: The file on the SD card to stream. 
+// Mp3TrackLocate
+// Locates the audio frames of an open source and moves to the first one. A
+// Xing/Info or VBRI tag frame is skipped so it does not play as a frame of
+// silence.
+// src: an open source
+// info: filled with the stream information, audioEnd is valid in any case
+// isValid: set to OS_TRUE if the frames and seek table were found
+// begPos: set to the position streaming starts at
+// Returns: OS_TRUE
+static BOOLEAN Mp3TrackLocate(Mp3AudioSource *src, Mp3StreamInfo *info, BOOLEAN *isValid, INT32U *begPos)
+{
+    // Streaming starts at the first frame so a large ID3v2 tag (e.g. cover art)
+    // is never sent to the decoder, and ends before any ID3v1 tag.
+    *isValid = Mp3InfoParse(info, Mp3AudioReadAt, src, Mp3AudioSize(src)) ? OS_TRUE : OS_FALSE;
+    if (*isValid)
+    {
+        *begPos = info->audioStart;
+        if (info->hasTagFrame) *begPos += info->first.frameLength;
+    }
+    else
+    {
+        *begPos = 0;
+        info->audioEnd = Mp3AudioSize(src);
+    }
+
+    Mp3AudioSeek(src, *begPos);
+    return OS_TRUE;
+}
+
+// Mp3TrackOpen
+// Opens a song of the list from the SD card and locates its audio frames.
+// Sources are only touched by the stage that owns the SD card at the time:
+// the feeder while the reader task is halted, or the reader while it
+// prefetches the next song.
+// src: source to open the song into
+// song: index into listOfSongs
+// Returns: OS_TRUE if the song was opened
+static BOOLEAN Mp3TrackOpen(Mp3AudioSource *src, INT32U song, Mp3StreamInfo *info, BOOLEAN *isValid, INT32U *begPos)
+{
+    if (!Mp3AudioSdOpen(src, listOfSongs[song])) return OS_FALSE;
+    return Mp3TrackLocate(src, info, isValid, begPos);
+}
 
-void Mp3StreamCycle(HANDLE hMp3)
+// Mp3ClosePrev
+// Closes the song the feeder has finished. The SD library is not task safe,
+// so this is left to the stage that currently owns the SD card.
+static void Mp3ClosePrev()
 {
+    if (prevSrc != 0)
+    {
+        Mp3AudioClose(prevSrc);
+        prevSrc = 0;
+    }
+}
+
+// Mp3PrefetchNext
+// Reader stage: the current song is completely in the ring, so open the next
+// song of the list and queue it behind the current one. For a song in a
+// different format the feeder sends endFillBytes first, so the decoder
+// finishes the old stream.
+// Returns: OS_TRUE if the ring continues with the next song
+static BOOLEAN Mp3PrefetchNext()
+{
+#if MP3_PLAYLIST_GAPLESS
+    INT8U err;
+    Mp3AudioSource *src;
+
+    // A song shorter than the ring: wait until the feeder reaches it
+    while (isNextQueued)
+    {
+        if (isReaderStop) return OS_FALSE;
+        OSFlagPend(mp3StreamFlags, MP3_STREAM_FLAG_SPACE, OS_FLAG_WAIT_SET_ANY + OS_FLAG_CONSUME,
+                   MP3_STREAM_PEND_TICKS, &err);
+    }
+    Mp3ClosePrev();
+
+    if (isReaderStop || readSongPntr + 1 >= sizeOfList) return OS_FALSE;
+
+    src = (readSrc == &trackSrc[0]) ? &trackSrc[1] : &trackSrc[0];
+    if (!Mp3TrackOpen(src, readSongPntr + 1, &nextInfo, &isNextValid, &nextBegPos)) return OS_FALSE;
+
+    // mp3Info belongs to readSrc here, the feeder updates it only while a song is queued
+    isNextNewFormat = (!isNextValid || !isInfoValid ||
+                       nextInfo.first.version != mp3Info.first.version ||
+                       nextInfo.first.sampleRate != mp3Info.first.sampleRate ||
+                       nextInfo.first.channels != mp3Info.first.channels) ? OS_TRUE : OS_FALSE;
+
+    // The song follows the old one without padding, at any offset within a
+    // ring block; its reads still end on its own SD block boundaries
+    readSrc = src;
+    readEnd = nextInfo.audioEnd;
+    readSongPntr++;
+    Mp3StreamSetPhase(&mp3Stream, mp3Stream.head, nextBegPos);
+    Mp3StreamSetMark(&mp3Stream, mp3Stream.head);
+    isNextQueued = OS_TRUE;
+    return OS_TRUE;
+#else
+    return OS_FALSE;
+#endif
+}
+
+// Mp3DropNext
+// Feeder stage, reader halted: forgets a queued next song, e.g. before a seek
+// in the current one.
+static void Mp3DropNext()
+{
+    Mp3ClosePrev();
+    if (readSrc != playSrc) Mp3AudioClose(readSrc);
+
+    readSrc = playSrc;
+    readEnd = mp3Info.audioEnd;
+    readSongPntr = currPlayingSongFilePntr;
+    Mp3StreamClearMark(&mp3Stream);
+    isNextQueued = OS_FALSE;
+}
+
+// Mp3FileSourceRead
+// Reader stage source: block reads from the song being read, up to the end of
+// its audio. At the end the next song of the list is queued behind it.
+static int32_t Mp3FileSourceRead(void *ctx, uint8_t *dst, uint32_t len)
+{
+    INT32U left;
+    INT32U start;
+    int32_t n;
+
+    Mp3ClosePrev();
+
+    if (Mp3AudioPosition(readSrc) >= readEnd)
+    {
+        if (!Mp3PrefetchNext()) return 0;
+    }
+
+    left = readEnd - Mp3AudioPosition(readSrc);
+    if (len > left) len = left;
+    if (len > MP3_STREAM_READ_BLOCK * 16) len = MP3_STREAM_READ_BLOCK * 16;
+
+    start = Mp3TlmStamp();
+    n = Mp3AudioRead(readSrc, dst, len);
+    Mp3TlmSdRead(Mp3TlmStamp() - start);
+    return n;
+}
+
+// Mp3DecoderSinkWrite
+// Feeder stage sink: hands the data to the VS1053 driver, which sends it in
+// 32 byte bursts while DREQ is high and sleeps on the DREQ interrupt otherwise.
+static int32_t Mp3DecoderSinkWrite(void *ctx, uint8_t *src, uint32_t len)
+{
+    HANDLE hMp3 = *(HANDLE*)ctx;
+    INT32U length = len;
+    
+    if (Write(hMp3, src, &length) != PJDF_ERR_NONE) return -1;
+    return (int32_t)length;
+}
+
+// Mp3GetEndFillByte
+// Reads the byte the decoder expects to be padded after the end of a stream
+// (parametric endFillByte) and puts the driver back in data mode.
+// hMp3: an open handle to the MP3 decoder
+static INT8U Mp3GetEndFillByte(HANDLE hMp3)
+{
+    INT16U value = 0;
     
+    Mp3SciWriteFrame(hMp3, BspMp3SetEndFillAddr);
+    Mp3SciRead(hMp3, MP3_SCI_WRAM, &value);
+    return (INT8U)value;
+}
+
+// Mp3SendEndFill
+// Pads the data stream with endFillByte.
+// hMp3: an open handle to the MP3 decoder
+// fillByte: the decoder's endFillByte
+// bytes: number of bytes to send
+// Returns: OS_TRUE if all were sent
+static BOOLEAN Mp3SendEndFill(HANDLE hMp3, INT8U fillByte, INT32U bytes)
+{
+    INT8U fill[MP3_DECODER_BUF_SIZE];
     INT32U length;
+    
+    memset(fill, fillByte, sizeof(fill));
+    for (; bytes > 0; bytes -= length)
+    {
+        length = (bytes < sizeof(fill)) ? bytes : sizeof(fill);
+        if (Write(hMp3, fill, &length) != PJDF_ERR_NONE) return OS_FALSE;
+    }
+    return OS_TRUE;
+}
+
+// Mp3ProgressTo
+// Lights the given number of status bars.
+// target: number of bars to light
+static void Mp3ProgressTo(INT32U target)
+{
+    INT8U err;
+    
+    if (target > MP3_PROGRESS_STEPS) target = MP3_PROGRESS_STEPS;
+    
+    // progressCounter - 1 status bars are lit
+    while (progressCounter <= target)
+    {
+        mp3Event = EVENT_STATUSBAR_INC;
+        err = OSQPost(displayQMsg, (void*)&mp3Event);
+        progressCounter++;
+    }
+    while (progressCounter > target + 1)
+    {
+        mp3Event = EVENT_STATUSBAR_DEC;
+        err = OSQPost(displayQMsg, (void*)&mp3Event);
+        progressCounter--;
+    }
+}
+
+// Mp3ProgressSync
+// Brings the status bar in line with the current file position after a seek.
+static void Mp3ProgressSync()
+{
+    Mp3ProgressTo((iDataFileMovPos == 0) ? 0 : (iDataFileCurPos - iDataFileBegPos) / iDataFileMovPos);
+}
+
+// Mp3SetDecodeTime
+// Sets the decoder's play time counter, e.g. after a seek or at the start of
+// a new song. The datasheet asks for the write to be done twice.
+// hMp3: an open handle to the MP3 decoder
+// sec: new play time
+static void Mp3SetDecodeTime(HANDLE hMp3, INT32U sec)
+{
+    Mp3SciWrite(hMp3, MP3_SCI_DECODE_TIME, (INT16U)sec);
+    Mp3SciWrite(hMp3, MP3_SCI_DECODE_TIME, (INT16U)sec);
+}
+
+// Mp3SetPlaySpeed
+// Sets the decoder's playSpeed parameter. The decoder skips through the
+// stream and asks for data that much faster, the feeder needs no change.
+// speed: 1 for normal play, n for n times faster
+static void Mp3SetPlaySpeed(HANDLE hMp3, INT8U speed)
+{
+    Mp3SciWrite(hMp3, MP3_SCI_WRAMADDR, MP3_PARAM_PLAY_SPEED);
+    Mp3SciWrite(hMp3, MP3_SCI_WRAM, speed);
+    scanSpeed = speed;
+}
+
+// Mp3ScanUpdate
+// Scan while fast forward is held: starts at MP3_SCAN_SPEED_MIN after
+// MP3_SCAN_HOLD_TICKS and steps up to MP3_SCAN_SPEED_MAX. The release is
+// handled with the fast forward flag.
+static void Mp3ScanUpdate(HANDLE hMp3)
+{
+    INT32U now = OSTimeGet();
+
+    if (!isScan)
+    {
+        isScanTiming = OS_FALSE;
+    }
+    else if (!isScanTiming)
+    {
+        isScanTiming = OS_TRUE;
+        scanTick = now;
+    }
+    else if (isPlaying && scanSpeed < MP3_SCAN_SPEED_MAX &&
+             (now - scanTick) >= ((scanSpeed == 1) ? MP3_SCAN_HOLD_TICKS : MP3_SCAN_STEP_TICKS))
+    {
+        Mp3SetPlaySpeed(hMp3, (scanSpeed == 1) ? MP3_SCAN_SPEED_MIN : scanSpeed + 1);
+        scanTick = now;
+    }
+}
+
+// Mp3StreamCancel
+// Stops the decoder in the middle of a stream without a reset: sets SM_CANCEL
+// and pads with endFillByte until the decoder clears the bit, then sends
+// MP3_END_FILL_BYTES more so it flushes what is left of the stream. The
+// cancel holds if HDAT0 and HDAT1 read 0 afterwards, otherwise, or if the
+// bit stays set for MP3_CANCEL_MAX_BYTES, the decoder is soft reset.
+// hMp3: an open handle to the MP3 decoder
+// Returns: OS_TRUE if the decoder acknowledged the cancel, OS_FALSE if it was reset
+static BOOLEAN Mp3StreamCancel(HANDLE hMp3)
+{
+    INT16U mode;
+    INT16U hdat0, hdat1;
+    INT32U sent;
+    BOOLEAN isCleared = OS_FALSE;
+    
+    if (!isEndFillRead)
+    {
+        endFillByte = Mp3GetEndFillByte(hMp3);
+        isEndFillRead = OS_TRUE;
+    }
+    
+    if (Mp3SciRead(hMp3, MP3_SCI_MODE, &mode) == PJDF_ERR_NONE &&
+        Mp3SciWrite(hMp3, MP3_SCI_MODE, mode | MP3_SM_CANCEL) == PJDF_ERR_NONE)
+    {
+        // The decoder drops the stream on its own and rewrites SCI_AUDATA
+        // while it does, so the shadow no longer holds
+        Mp3SciInvalidate();
+        for (sent = 0; sent < MP3_CANCEL_MAX_BYTES; sent += MP3_DECODER_BUF_SIZE)
+        {
+            if (!Mp3SendEndFill(hMp3, endFillByte, MP3_DECODER_BUF_SIZE)) break;
+            if (Mp3SciRead(hMp3, MP3_SCI_MODE, &mode) != PJDF_ERR_NONE) break;
+            
+            isCleared = (mode & MP3_SM_CANCEL) ? OS_FALSE : OS_TRUE;
+            if (isCleared) break;
+        }
+        
+        // The decoder may still hold part of the stream, flush it and check
+        // that no frame header is left
+        if (isCleared &&
+            Mp3SendEndFill(hMp3, endFillByte, MP3_END_FILL_BYTES) &&
+            Mp3SciRead(hMp3, MP3_SCI_HDAT0, &hdat0) == PJDF_ERR_NONE &&
+            Mp3SciRead(hMp3, MP3_SCI_HDAT1, &hdat1) == PJDF_ERR_NONE &&
+            hdat0 == 0 && hdat1 == 0)
+        {
+            // The next stream starts from zero at normal speed
+            Mp3SetDecodeTime(hMp3, 0);
+            if (scanSpeed != 1) Mp3SetPlaySpeed(hMp3, 1);
+            return OS_TRUE;
+        }
+    }
+    
+    Mp3SoftReset(hMp3);
+    return OS_FALSE;
+}
+
+// Mp3GetDecodeStatus
+// Copies the decoder status last published with EVENT_DECODE_STATUS.
+// status: receives the copy
+void Mp3GetDecodeStatus(Mp3DecodeStatus *status)
+{
+    OS_CPU_SR cpu_sr;
+    
+    OS_ENTER_CRITICAL();
+    *status = mp3Status;
+    OS_EXIT_CRITICAL();
+}
+
+// Mp3StatusPoll
+// Feeder stage, every MP3_STATUS_POLL_TICKS: reads SCI_DECODE_TIME, SCI_HDAT0
+// and SCI_HDAT1 through the SCI layer, publishes the elapsed time and
+// stream format to the display and moves the status bar by play time.
+// hMp3: an open handle to the MP3 decoder
+static void Mp3StatusPoll(HANDLE hMp3)
+{
+    INT16U decodeTime = 0;
+    INT16U hdat0 = 0;
+    INT16U hdat1 = 0;
+    INT8U hdr[4];
+    Mp3FrameHeader frame;
+    Mp3DecodeStatus status;
+    OS_CPU_SR cpu_sr;
+    INT8U err;
+    
+    statusPollTick = OSTimeGet();
+    
+    Mp3SciRead(hMp3, MP3_SCI_DECODE_TIME, &decodeTime);
+    Mp3SciRead(hMp3, MP3_SCI_HDAT0, &hdat0);
+    Mp3SciRead(hMp3, MP3_SCI_HDAT1, &hdat1);
+    
+    // HDAT1:HDAT0 hold the header of the last decoded MP3 frame
+    hdr[0] = (INT8U)(hdat1 >> 8);
+    hdr[1] = (INT8U)hdat1;
+    hdr[2] = (INT8U)(hdat0 >> 8);
+    hdr[3] = (INT8U)hdat0;
+    
+    status = mp3Status;
+    status.elapsedSec = decodeTime;
+    status.durationSec = isInfoValid ? mp3Info.durationMs / 1000 : 0;
+    if (Mp3ParseFrameHeader(hdr, &frame))
+    {
+        status.bitrate = frame.bitrate;
+        status.sampleRate = frame.sampleRate;
+        
+        // The decoder is into the stream, its end fill value is valid now
+        if (!isEndFillRead)
+        {
+            endFillByte = Mp3GetEndFillByte(hMp3);
+            isEndFillRead = OS_TRUE;
+        }
+    }
+    
+    if (status.elapsedSec != mp3Status.elapsedSec || status.bitrate != mp3Status.bitrate ||
+        status.sampleRate != mp3Status.sampleRate || status.durationSec != mp3Status.durationSec)
+    {
+        OS_ENTER_CRITICAL();
+        mp3Status = status;
+        OS_EXIT_CRITICAL();
+        err = OSQPost(displayQMsg, (void*)&mp3StatusEvent);
+    }
+    
+    if (status.durationSec != 0)
+        Mp3ProgressTo(status.elapsedSec * MP3_PROGRESS_STEPS / status.durationSec);
+    else
+        Mp3ProgressSync();
+}
+
+// Mp3SeekBy
+// Moves the data file by the given play time and lands on a frame sync.
+// Must be called with the reader task halted.
+// deltaMs: time to skip, negative to rewind
+static void Mp3SeekBy(INT32S deltaMs)
+{
+    INT32U nowMs, targetMs, pos;
+    
+    if (!isInfoValid)
+    {
+        // No frame information, fall back to jumping a tenth of the file
+        if (deltaMs >= 0)
+            iDataFileCurPos += iDataFileMovPos;
+        else
+            iDataFileCurPos = (iDataFileMovPos >= (iDataFileCurPos - iDataFileBegPos)) ? iDataFileBegPos : 
+                                            (iDataFileCurPos - iDataFileMovPos);
+        Mp3AudioSeek(playSrc, iDataFileCurPos);
+        return;
+    }
+    
+    nowMs = Mp3InfoByteToTime(&mp3Info, iDataFileCurPos);
+    if (deltaMs < 0)
+        targetMs = ((INT32U)(-deltaMs) >= nowMs) ? 0 : nowMs + deltaMs;
+    else
+        targetMs = nowMs + deltaMs;
+    
+    pos = iDataFileCurPos;
+    if (targetMs == 0)
+        pos = iDataFileBegPos;
+    else if (!Mp3InfoSeek(&mp3Info, Mp3AudioReadAt, playSrc, targetMs, &pos))
+        pos = iDataFileCurPos; // no frame found, stay where we are
+    
+    iDataFileCurPos = pos;
+    Mp3AudioSeek(playSrc, iDataFileCurPos);
+}
+
+// Mp3GapReport
+// Called on the first data of a song fed after a transition. Reports the time
+// between the last byte of the old song and the first byte of the new one
+// reaching the decoder.
+static void Mp3GapReport()
+{
+    char buf[48];
+    INT32U gapMs;
+
+    isGapTiming = OS_FALSE;
+    gapMs = (OSTimeGet() - gapStartTick) * 1000 / OS_TICKS_PER_SEC;
+    Mp3TlmGap(gapMs);
+    PrintWithBuf(buf, sizeof(buf), "Mp3: next song audio after %u ms (%s)\n",
+                 (unsigned int)gapMs, MP3_PLAYLIST_GAPLESS ? "gapless" : "reset");
+}
+
+// Mp3ListFollow
+// Moves the song list selection along with an automatic advance, unless the
+// user has selected another song in the meantime.
+static void Mp3ListFollow()
+{
+    INT8U err;
+
+    if (currSongFilePntr == currPlayingSongFilePntr)
+    {
+        err = OSQPost(displayQMsg, (void*)&mp3NextEvent);
+    }
+}
+
+// Mp3TrackCrossed
+// Feeder stage: everything up to the queued next song has been fed. Switches
+// the playing song over without touching the decoder.
+static void Mp3TrackCrossed(HANDLE hMp3)
+{
+    INT8U err;
+
+    prevSrc = playSrc;
+    playSrc = readSrc;
+    mp3Info = nextInfo;
+    isInfoValid = isNextValid;
+
+    iDataFileBegPos = nextBegPos;
+    iDataFileMovPos = (mp3Info.audioEnd - iDataFileBegPos)/MP3_PROGRESS_STEPS;
+    iDataFileCurPos = iDataFileBegPos;
+    Mp3ProgressSync();
+
+    Mp3ListFollow();
+    currPlayingSongFilePntr = readSongPntr;
+    isEndFillRead = OS_FALSE;
+    Mp3TlmReset(currPlayingSongFilePntr);
+    
+    // The old song's last frames are still in the decoder, a few tenths of a
+    // second at most, so the time counter restarts slightly early
+    Mp3SetDecodeTime(hMp3, 0);
+
+    gapStartTick = lastFedTick;
+    isGapTiming = OS_TRUE;
+
+    // Let the reader close the old song and queue the one after
+    Mp3StreamClearMark(&mp3Stream);
+    isNextQueued = OS_FALSE;
+    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_SPACE, OS_FLAG_SET, &err);
+}
+
+// Mp3ReaderStart
+// Empties the ring buffer and lets the reader task fill it from the current
+// data file position. The ring is aligned to the file's SD blocks so the
+// reader gets whole blocks transferred directly into it and the feeder hands
+// the same memory to the decoder, with no intermediate copy.
+static void Mp3ReaderStart()
+{
+    INT8U err;
+    
+    Mp3StreamAlign(&mp3Stream, Mp3AudioPosition(readSrc));
+    isReaderStop = OS_FALSE;
+    
+    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_DATA, OS_FLAG_CLR, &err);
+    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_START, OS_FLAG_SET, &err);
+}
+
+// Mp3ReaderHalt
+// Stops the reader task and waits until it no longer touches the data file.
+// Every Mp3ReaderStart() must be paired with exactly one Mp3ReaderHalt().
+static void Mp3ReaderHalt()
+{
+    INT8U err;
+    
+    isReaderStop = OS_TRUE;
+    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_SPACE, OS_FLAG_SET, &err);
+    OSFlagPend(mp3StreamFlags, MP3_STREAM_FLAG_IDLE, OS_FLAG_WAIT_SET_ANY + OS_FLAG_CONSUME, 0, &err);
+}
+
+// Mp3ReaderCycle
+// Reader stage: called by the reader task once per Mp3ReaderStart(). Fills the
+// ring buffer in block sized reads between the low and high watermarks and
+// returns at end of file or when halted by the feeder.
+void Mp3ReaderCycle()
+{
+    INT8U err;
+    
+    while (!isReaderStop && !mp3Stream.eof)
+    {
+        if (Mp3StreamFill(&mp3Stream) > 0)
+        {
+            OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_DATA, OS_FLAG_SET, &err);
+            continue;
+        }
+        
+        if (mp3Stream.eof) break;
+        
+        // Above the high watermark: sleep until the feeder drains to the low watermark
+        OSFlagPend(mp3StreamFlags, MP3_STREAM_FLAG_SPACE, OS_FLAG_WAIT_SET_ANY + OS_FLAG_CONSUME, 
+                   MP3_STREAM_PEND_TICKS, &err);
+    }
+    
+    // Wake the feeder so it sees the end of stream
+    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_DATA | MP3_STREAM_FLAG_IDLE, OS_FLAG_SET, &err);
+}
+
+// Mp3StreamCycle
+// Feeder stage: streams the selected song from the SD card to the given MP3 decoder.
+// The SD reads are done by the reader task through the ring buffer. With
+// MP3_PLAYLIST_GAPLESS the following songs of the list play on from the same
+// ring without stopping the decoder.
+// hMp3: an open handle to the MP3 decoder
+// Returns: OS_TRUE if the list advanced to a song that should be started by
+//     calling Mp3StreamCycle() again (decoder reset between songs)
+BOOLEAN Mp3StreamCycle(HANDLE hMp3)
+{
+    
+    INT32U song;
     INT8U err = 0;
+    INT32S fed;
+    BOOLEAN isPrimed = OS_FALSE;
+    BOOLEAN isDry = OS_FALSE;
+    BOOLEAN isListEnd = OS_FALSE;
+    BOOLEAN isStopped = OS_FALSE;
+    BOOLEAN isAutoNext = (mp3AutoNextSong != INT_MAX) ? OS_TRUE : OS_FALSE;
+    static HANDLE hSink;
+
+    song = isAutoNext ? mp3AutoNextSong : currSongFilePntr;
+    mp3AutoNextSong = INT_MAX;
     
     Mp3StreamInit(hMp3);
     
 	//char printBuf[PRINTBUFMAX];
     
-    dataFile = SD.open(listOfSongs[currSongFilePntr], O_READ);
-    if (!dataFile) 
+    // Waits out an sdbench run, the card is ours until the song is closed
+    OSSemPend(sdCardSem, 0, &err);
+    
+    playSrc = &trackSrc[0];
+    readSrc = playSrc;
+    prevSrc = 0;
+    if (!Mp3TrackOpen(playSrc, song, &mp3Info, &isInfoValid, &iDataFileBegPos))
     {
-        //PrintWithBuf(printBuf, PRINTBUFMAX, "Error: could not open SD card file '%s'\n", listOfSongs[currSongFilePntr]);
-        return;
+        OSSemPost(sdCardSem);
+        //PrintWithBuf(printBuf, PRINTBUFMAX, "Error: could not open SD card file '%s'\n", listOfSongs[song]);
+        if (isAutoNext)
+        {
+            // The list stops here, like at the end of a song
+            currPlayingSongFilePntr = INT_MAX;
+            isPlaying = OS_FALSE;
+            mp3Event = EVENT_STOP_RELEASE;
+            err = OSQPost(displayQMsg, (void*)&mp3Event);
+        }
+        return OS_FALSE;
     }
 
+    if (Mp3StreamSetup(&mp3Stream, mp3RingBuf, MP3_STREAM_BUF_SIZE,
+                       MP3_STREAM_HIGH_WATER, MP3_STREAM_LOW_WATER,
+                       MP3_STREAM_READ_BLOCK, MP3_STREAM_FEED_MAX) != MP3_STREAM_ERR_NONE) while(1);
+    
+    hSink = hMp3;
+    Mp3StreamSetSource(&mp3Stream, Mp3FileSourceRead, 0);
+    Mp3StreamSetSink(&mp3Stream, Mp3DecoderSinkWrite, &hSink);
+
     // Initialize flags
     
     isStopSong = OS_FALSE;
     isFastForward = OS_FALSE;
     isRewind = OS_FALSE;
-    isVolUp  = OS_FALSE; 
-    isVolDown  = OS_FALSE; 
+    isScan = OS_FALSE;
+    isScanTiming = OS_FALSE;
+    scanSpeed = 1;                              // the soft reset restored normal speed
     
     progressCounter = 1;
-    currPlayingSongFilePntr = currSongFilePntr;
+    currPlayingSongFilePntr = song;
+    Mp3TlmReset(song);
     
+    readSongPntr = song;
+    readEnd = mp3Info.audioEnd;
+    isNextQueued = OS_FALSE;
+    isEndFillRead = OS_FALSE;
+    memset(&mp3Status, 0, sizeof(mp3Status));
+    statusPollTick = OSTimeGet();
     
-    // this value will be used for increment/decrement song position .
-    // A song data will be seen as ten parts and it will move accordingly
-    iDataFileMovPos = dataFile.size()/10;
-    iDataFileBegPos = dataFile.position();
+    // The status bar shows the song as ten parts
+    iDataFileMovPos = (mp3Info.audioEnd - iDataFileBegPos)/MP3_PROGRESS_STEPS;
     iDataFileCurPos = iDataFileBegPos;
+    
+    Mp3ReaderStart();
         
-    while (dataFile.available())
+    while (1)
     {
-        
-        iBufPos = 0;
-        //iDataFileCurPos =  dataFile.position();
-        
         // if Paused stays in the loop and then picks when played again
         if(isPlaying)
         {
-            while (dataFile.available() && iBufPos < MP3_DECODER_BUF_SIZE)
+            // Let the reader build up a cushion before feeding after a start or a seek
+            if (!isPrimed && Mp3StreamReady(&mp3Stream)) isPrimed = OS_TRUE;
+            
+            // The drain stops at the mark, the first byte of a queued next song
+            if (isNextQueued && (INT32S)(mp3Stream.mark - mp3Stream.tail) <= 0)
             {
-                mp3Buf[iBufPos] = dataFile.read();
-                
-                if((dataFile.position() - iDataFileBegPos) == (progressCounter * iDataFileMovPos))
+                // A song in another format: the decoder finishes the old
+                // stream on endFillBytes, read from it while it still plays
+                if (isNextNewFormat)
                 {
-                    mp3Event = EVENT_STATUSBAR_INC;
-                    err = OSQPost(displayQMsg, (void*)&mp3Event);
-                    
-                    progressCounter++;
+                    if (!isEndFillRead)
+                    {
+                        endFillByte = Mp3GetEndFillByte(hMp3);
+                        isEndFillRead = OS_TRUE;
+                    }
+                    Mp3SendEndFill(hMp3, endFillByte, MP3_END_FILL_BYTES);
                 }
-                
-                //delay(30);
-                iBufPos++;
+                Mp3TrackCrossed(hMp3);
             }
-           
-            Write(hMp3, mp3Buf, &iBufPos);
-            //OSTimeDly(5);
+
+            fed = isPrimed ? Mp3StreamDrain(&mp3Stream, MP3_STREAM_FEED_MAX) : 0;
+            if (fed < 0) break;
             
-        }
+            if (fed > 0)
+            {
+                lastFedTick = OSTimeGet();
+                if (isGapTiming) Mp3GapReport();
+                isDry = OS_FALSE;
+                
+                // The ring only drains legitimately once the end of the list is read
+                Mp3TlmFed(fed, mp3Stream.eof ? MP3_STREAM_BUF_SIZE : Mp3StreamLevel(&mp3Stream));
 
-        // new data file position
-        iDataFileCurPos =  dataFile.position();
+                // iDataFileCurPos tracks the file position of the data fed to the decoder
+                iDataFileCurPos += fed;
+                
+                if (Mp3StreamLevel(&mp3Stream) <= MP3_STREAM_LOW_WATER)
+                {
+                    OSFlagPost(mp3StreamFlags, MP3_STREAM_FLAG_SPACE, OS_FLAG_SET, &err);
+                }
+            }
+            else if (Mp3StreamFinished(&mp3Stream))
+            {
+                isListEnd = (mp3Stream.error == 0) ? OS_TRUE : OS_FALSE;
+                break;
+            }
+            else
+            {
+                // Ring buffer is empty: wait for the reader stage
+                if (isPrimed && !isDry)
+                {
+                    Mp3TlmUnderrun();
+                    isDry = OS_TRUE;
+                }
+                OSFlagPend(mp3StreamFlags, MP3_STREAM_FLAG_DATA, OS_FLAG_WAIT_SET_ANY + OS_FLAG_CONSUME, 
+                           MP3_STREAM_PEND_TICKS, &err);
+            }
+        }
+        else
+        {
+            OSTimeDly(MP3_STREAM_PAUSE_TICKS);
+        }
+        
+        // Elapsed time, format and progress come from the decoder at a low rate
+        if (isPlaying && (OSTimeGet() - statusPollTick) >= MP3_STATUS_POLL_TICKS)
+        {
+            Mp3StatusPoll(hMp3);
+        }
         
         // Fast Forward, Rewind, Vol+, Vol- and Stop functions should work if it
         // is Playing or Paused
         
+        Mp3ScanUpdate(hMp3);
+        
+        if(isFastForward && scanSpeed != 1)
+        {
+            // End of a held press: back to normal speed where the scan got to
+            Mp3SetPlaySpeed(hMp3, 1);
+            isScanTiming = OS_FALSE;
+            isFastForward = OS_FALSE;
+        }
+        
         if(isFastForward)
         {
-            //set new position
-            iDataFileCurPos += iDataFileMovPos;
-            //set the value in file datastructure
-            dataFile.seek(iDataFileCurPos);
-            //Send a Status Bar Update Event to display task
-            mp3Event = EVENT_STATUSBAR_INC;
-            err = OSQPost(displayQMsg, (void*)&mp3Event);
+            Mp3ReaderHalt();
+            Mp3DropNext();
+            Mp3SeekBy(MP3_SEEK_STEP_SEC * 1000);
+            Mp3ReaderStart();
+            isPrimed = OS_FALSE;
+            if (isInfoValid) Mp3SetDecodeTime(hMp3, Mp3InfoByteToTime(&mp3Info, iDataFileCurPos) / 1000);
             
-             progressCounter++;
+            //Send Status Bar Update Events to display task
+            Mp3ProgressSync();
                 
             isFastForward = OS_FALSE;
-            //OSFlagPost(mp3Flags, setFastForwardFlag, OS_FLAG_SET, &err);
         }
             
         if(isRewind)
         {
-            iDataFileCurPos = (iDataFileMovPos >= iDataFileCurPos) ? iDataFileBegPos : 
-                                            (iDataFileCurPos - iDataFileMovPos);
-            //set the value in file datastructure
-            dataFile.seek(iDataFileCurPos);
-            
-            //Send a Status Bar Update Event to display task
-            mp3Event = EVENT_STATUSBAR_DEC;
-            err = OSQPost(displayQMsg, (void*)&mp3Event);
+            Mp3ReaderHalt();
+            Mp3DropNext();
+            Mp3SeekBy(-MP3_SEEK_STEP_SEC * 1000);
+            Mp3ReaderStart();
+            isPrimed = OS_FALSE;
+            if (isInfoValid) Mp3SetDecodeTime(hMp3, Mp3InfoByteToTime(&mp3Info, iDataFileCurPos) / 1000);
             
-             progressCounter--;
-                
+            //Send Status Bar Update Events to display task
+            Mp3ProgressSync();
             
             isRewind = OS_FALSE;
         }
         
-        if(isVolUp)
-        {
-            Mp3VolumeControl(hMp3, VOLUP);
-            isVolUp = OS_FALSE;
-        }
-        
-        if(isVolDown)
-        {
-            Mp3VolumeControl(hMp3, VOLDOWN);
-            isVolDown = OS_FALSE;
-        }
+        // Volume presses queued since the last cycle, in one SCI write
+        Mp3SciFlush(hMp3);
         
         if(isStopSong)
         {
             isStopSong = OS_FALSE;
+            isStopped = OS_TRUE;
             break;
         }
         
     }
-    currPlayingSongFilePntr = INT_MAX;
-    isPlaying = OS_FALSE;
     
-    dataFile.close();
+    // Silence the decoder first, the rest of the cleanup is not audible
+    isDecoderReady = OS_FALSE;
+    if (isStopped)
+    {
+#if MP3_STOP_CANCEL
+        isDecoderReady = Mp3StreamCancel(hMp3);
+#else
+        Mp3SoftReset(hMp3);
+#endif
+        Mp3TlmStopSilent(isDecoderReady);
+    }
+    else
+    {
+        Mp3SoftReset(hMp3);
+    }
+    
+    Mp3ReaderHalt();
     
-    mp3Event = EVENT_STOP_RELEASE;
-    err = OSQPost(displayQMsg, (void*)&mp3Event);
+    Mp3DropNext();
+    Mp3AudioClose(playSrc);
+    OSSemPost(sdCardSem);
+    
+    // Song ended on its own and the list goes on: start the next song after
+    // the decoder reset, i.e. the transition MP3_PLAYLIST_GAPLESS avoids
+    if (isListEnd && currPlayingSongFilePntr + 1 < sizeOfList)
+    {
+        mp3AutoNextSong = currPlayingSongFilePntr + 1;
+        Mp3ListFollow();
+    
+        gapStartTick = lastFedTick;
+        isGapTiming = OS_TRUE;
+    }
+    else
+    {
+        currPlayingSongFilePntr = INT_MAX;
+        isPlaying = OS_FALSE;
+
+        mp3Event = EVENT_STOP_RELEASE;
+        err = OSQPost(displayQMsg, (void*)&mp3Event);
+    }
     
     //OSFlagPost(mp3Flags, setPlayFlag | setPauseFlag, OS_FLAG_WAIT_SET_ALL, &err);
+
+    return (mp3AutoNextSong != INT_MAX) ? OS_TRUE : OS_FALSE;
+}
+
+// Mp3PlayClip
+// Plays a memory resident stream, e.g. a chime compiled into flash, from
+// start to end. The decoder is fed straight out of the array: no ring
+// buffer copy, reader task or SD card access is involved. Only called by
+// the MP3 task while no song is streaming.
+// hMp3: an open handle to the MP3 decoder
+// data: the MP3 stream
+// size: bytes in data
+// Returns: OS_TRUE if the clip was played
+BOOLEAN Mp3PlayClip(HANDLE hMp3, const INT8U *data, INT32U size)
+{
+    static Mp3Stream clipStream;
+    static HANDLE hClipSink;
+    Mp3AudioSource clip;
+    Mp3StreamInfo info;
+    BOOLEAN isValid;
+    INT32U begPos;
     
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
-    length = BspMp3SoftResetLen;
-    Write(hMp3, (void*)BspMp3SoftReset, &length);
+    // Leave out any tags, then make the source end where the audio ends
+    if (!Mp3AudioMemOpen(&clip, data, size)) return OS_FALSE;
+    Mp3TrackLocate(&clip, &info, &isValid, &begPos);
+    Mp3AudioMemOpen(&clip, data, info.audioEnd);
+    Mp3AudioSeek(&clip, begPos);
+    
+    Mp3StreamInit(hMp3);
+    
+    // The ring buffer only satisfies the engine's geometry check, a span
+    // source never copies into it
+    if (Mp3StreamSetup(&clipStream, mp3RingBuf, MP3_STREAM_BUF_SIZE,
+                       MP3_STREAM_HIGH_WATER, MP3_STREAM_LOW_WATER,
+                       MP3_STREAM_READ_BLOCK, MP3_STREAM_FEED_MAX) != MP3_STREAM_ERR_NONE) while(1);
+    hClipSink = hMp3;
+    Mp3StreamSetSpanSource(&clipStream, Mp3AudioStreamSpan, &clip);
+    Mp3StreamSetSink(&clipStream, Mp3DecoderSinkWrite, &hClipSink);
+    
+    while (!Mp3StreamFinished(&clipStream))
+    {
+        if (Mp3StreamDrain(&clipStream, MP3_STREAM_FEED_MAX) < 0) break;
+    }
+    Mp3AudioClose(&clip);
+    
+    // Let the decoder finish the last frame
+    Mp3SendEndFill(hMp3, Mp3GetEndFillByte(hMp3), MP3_END_FILL_BYTES);
+    
+    return (clipStream.error == 0) ? OS_TRUE : OS_FALSE;
 }
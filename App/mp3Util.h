@@ -15,6 +15,69 @@
 #include "events.h"
 #include "bsp.h"
 #include "print.h"
+#include "mp3Stream.h"
+#include "mp3StreamInfo.h"
+
+// Play time skipped by one fast forward or rewind press
+#define MP3_SEEK_STEP_SEC           10
+
+// Holding fast forward scans: the decoder plays at playSpeed times the normal
+// rate, starting at MP3_SCAN_SPEED_MIN once the button is held for
+// MP3_SCAN_HOLD_TICKS and going up one step every MP3_SCAN_STEP_TICKS.
+// A shorter press still skips MP3_SEEK_STEP_SEC.
+#define MP3_SCAN_HOLD_TICKS         500
+#define MP3_SCAN_STEP_TICKS         2000
+#define MP3_SCAN_SPEED_MIN          2
+#define MP3_SCAN_SPEED_MAX          4
+
+// 1: when a song ends the next one of the list plays without stopping the
+//    decoder, its first blocks are prefetched into the ring behind the old song
+// 0: each song ends with a decoder soft reset and the next one is started
+//    from scratch, Mp3StreamInit() included
+#define MP3_PLAYLIST_GAPLESS        1
+// endFillBytes sent between songs of different formats and after a cancel so
+// the decoder finishes the last frame of the old stream (VS1053 datasheet: 2052 bytes)
+#define MP3_END_FILL_BYTES          2052u
+
+// 1: stopping or switching songs cancels the stream with SM_CANCEL and the
+//    next song starts without re-initialising the decoder
+// 0: the decoder is soft reset after every stop
+#define MP3_STOP_CANCEL             1
+// endFillBytes sent after SM_CANCEL before giving up and soft resetting
+// (VS1053 datasheet: the decoder acknowledges within 2048 bytes)
+#define MP3_CANCEL_MAX_BYTES        2048u
+
+// 1: the MP3 task plays the Train_Crossing clip from flash when it starts,
+//    before the SD card is touched
+#define MP3_STARTUP_CHIME           0
+
+// The status bar shows the song as this many parts
+#define MP3_PROGRESS_STEPS          10
+
+// Period of the decoder status poll (elapsed time, bitrate, sample rate)
+#define MP3_STATUS_POLL_TICKS       250
+
+// Feeder stage: bytes handed to the decoder between checks of the control flags
+#define MP3_STREAM_FEED_MAX         MP3_STREAM_READ_BLOCK
+// Longest a stage sleeps before re-checking the ring buffer state
+#define MP3_STREAM_PEND_TICKS       20
+// Feeder stage poll period while paused
+#define MP3_STREAM_PAUSE_TICKS      10
+
+// mp3StreamFlags bits used between the reader and feeder stages
+#define MP3_STREAM_FLAG_START       0x0001  // reader: a stream was (re)started
+#define MP3_STREAM_FLAG_SPACE       0x0002  // reader: level dropped to the low watermark
+#define MP3_STREAM_FLAG_DATA        0x0004  // feeder: new data or end of stream
+#define MP3_STREAM_FLAG_IDLE        0x0008  // feeder: reader stopped touching the file
+
+// Decoder status published to the display with EVENT_DECODE_STATUS
+typedef struct _Mp3DecodeStatus
+{
+    INT32U elapsedSec;              // SCI_DECODE_TIME
+    INT32U durationSec;             // 0 if unknown
+    INT16U bitrate;                 // kbit/s of the last frame, from SCI_HDAT0/1
+    INT32U sampleRate;              // Hz
+} Mp3DecodeStatus;
 
 typedef enum {
     VOLUP = 0,
@@ -23,13 +86,16 @@ typedef enum {
 
 PjdfErrCode Mp3GetRegister(HANDLE hMp3, INT8U *cmdInDataOut, INT32U bufLen);
 void Mp3StreamInit(HANDLE hMp3);
+void Mp3GetDecodeStatus(Mp3DecodeStatus *status);
 //void Mp3Test(HANDLE hMp3);
 //void Mp3Stream(HANDLE hMp3, INT8U *pBuf, INT32U bufLen);
 //void Mp3StreamSDFile(HANDLE hMp3, char *pFilename);
-void Mp3VolumeControl(HANDLE hMp3, VolumeCounter state);
+void Mp3VolumeControl(VolumeCounter state);
 
 void Mp3FetchFileNames();
 //void Mp3FetchFileNames(char **list, int maxRow, int col, int *size);
-void Mp3StreamCycle(HANDLE hMp3);
+BOOLEAN Mp3StreamCycle(HANDLE hMp3);
+void Mp3ReaderCycle();
+BOOLEAN Mp3PlayClip(HANDLE hMp3, const INT8U *data, INT32U size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*
+    sdBench.c
+    SD card read throughput benchmark. Reads the same run of consecutive
+    blocks two ways at the SD clock picked by Sd2Card::init():
+      - CMD17: one READ_BLOCK command, response and start token per block,
+        the way every read worked before multiple block reads
+      - CMD18: one READ_MULTIPLE_BLOCK command for the run, then only a
+        start token per block, ended with CMD12. SdFile uses it while a
+        file is contiguous on the card
+    The SPI bus is taken and released around every block, like in playback.
+    The SD library is not task safe, so the benchmark only runs while no
+    song is open, paused songs included: it takes sdCardSem, which the MP3
+    task holds from opening a song to closing it, and a song started in the
+    meantime waits for the run. Timed with the DWT cycle counter.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "sdBench.h"
+#include "events.h"
+#include "print.h"
+#include "SD.h"
+
+static uint8_t sdBenchBuf[512];
+
+// SdBenchRate
+// Converts a cycle count for the benchmark run into a rate.
+// cycles: DWT cycles taken to read SD_BENCH_BLOCKS blocks
+// Returns: bytes per second
+static INT32U SdBenchRate(INT32U cycles)
+{
+    if (cycles == 0) return 0;
+    return (INT32U)(((uint64_t)SD_BENCH_BLOCKS * 512 * SystemCoreClock) / cycles);
+}
+
+// SdBenchBlockUs
+// Converts a cycle count for the benchmark run into the time per block.
+// cycles: DWT cycles taken to read SD_BENCH_BLOCKS blocks
+// Returns: microseconds per block
+static INT32U SdBenchBlockUs(INT32U cycles)
+{
+    return (INT32U)(((uint64_t)cycles * 1000000) / ((uint64_t)SystemCoreClock * SD_BENCH_BLOCKS));
+}
+
+// SdBenchMeasure
+// Measures both read commands and prints the throughput in bytes/s and the
+// time per block on the UART. The caller holds sdCardSem.
+static void SdBenchMeasure(Sd2Card *card)
+{
+    char buf[96];
+    INT32U i;
+    INT32U start;
+    INT32U single, multi;
+
+    // a multiple block read left open by the last song would serve CMD17
+    if (card->readStreaming(SD_BENCH_FIRST_BLOCK) && !card->readStop()) return;
+
+    start = DWT->CYCCNT;
+    for (i = 0; i < SD_BENCH_BLOCKS; i++)
+    {
+        if (!card->readBlock(SD_BENCH_FIRST_BLOCK + i, sdBenchBuf)) break;
+    }
+    single = DWT->CYCCNT - start;
+    if (i != SD_BENCH_BLOCKS)
+    {
+        PrintWithBuf(buf, sizeof(buf), "  sdbench: CMD17 error %x\n", (unsigned int)card->errorCode());
+        return;
+    }
+
+    start = DWT->CYCCNT;
+    if (card->readStart(SD_BENCH_FIRST_BLOCK))
+    {
+        for (i = 0; i < SD_BENCH_BLOCKS; i++)
+        {
+            if (!card->readData(sdBenchBuf)) break;
+        }
+        if (i == SD_BENCH_BLOCKS && !card->readStop()) i = 0;
+    }
+    else
+    {
+        i = 0;
+    }
+    multi = DWT->CYCCNT - start;
+    if (i != SD_BENCH_BLOCKS)
+    {
+        PrintWithBuf(buf, sizeof(buf), "  sdbench: CMD18 error %x\n", (unsigned int)card->errorCode());
+        return;
+    }
+
+    PrintWithBuf(buf, sizeof(buf), "sd read, %u blocks: CMD17 %u B/s, CMD18 %u B/s\n",
+        (unsigned int)SD_BENCH_BLOCKS, (unsigned int)SdBenchRate(single), (unsigned int)SdBenchRate(multi));
+    PrintWithBuf(buf, sizeof(buf), "  us per block: CMD17 %u, CMD18 %u\n",
+        (unsigned int)SdBenchBlockUs(single), (unsigned int)SdBenchBlockUs(multi));
+}
+
+// SdBenchRun
+// Runs the benchmark unless a song holds the SD card.
+void SdBenchRun(void)
+{
+    Sd2Card *card = SD.sdCard();
+
+    if (card == 0) return;
+    if (OSSemAccept(sdCardSem) == 0)
+    {
+        PrintString("  sdbench: stop the song first\n");
+        return;
+    }
+    SdBenchMeasure(card);
+    OSSemPost(sdCardSem);
+}
@@ -0,0 +1,20 @@
+/*
+    sdBench.h
+    SD card read throughput benchmark run from the shell ("sdbench").
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __SDBENCH_H
+#define __SDBENCH_H
+
+#include "bsp.h"
+
+#define SD_BENCH_FIRST_BLOCK        0       // first card block read
+#define SD_BENCH_BLOCKS             256     // consecutive blocks read per measured command
+
+void SdBenchRun(void);
+
+#endif
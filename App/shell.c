@@ -5,18 +5,34 @@
     Developed for University of Washington embedded systems programming certificate
     
     2016/3 Nick Strathy wrote/arranged it
+
+    2021/3 Abhilash Sahoo added the stats command for the streaming telemetry
+    and the spibench, spitrace and sdbench commands
 */
 
 
 
 #include "bsp.h"
 #include "print.h"
+#include "pjdf.h"
+#include "mp3Telemetry.h"
+#include "spiBench.h"
+#include "sdBench.h"
+#include "SD.h"
 
 #define BUFSIZE 256
+#define SHELL_POLL_TICKS 20  // UART receive poll period
+#define SHELL_PRINT_BUF_SIZE 96  // longest stats line, like MP3_TLM_PRINT_BUF_SIZE
 #define ARRAYCOUNT(array) (sizeof(array)/sizeof(*array))
 
 static void PJShellcd(char *dir);
 static void PJShellls(void);
+static void PJShellstats(char *args);
+static void PJShellSpiStats(BOOLEAN isReset);
+static void PJShellSdStats(BOOLEAN isReset);
+static void PJShellspibench(void);
+static void PJShellspitrace(char *args);
+static void PJShellsdbench(void);
 
 
 // Define command strings here
@@ -24,6 +40,10 @@ static const char *CmdList[] =
 {
 	"cd",
 	"ls",
+	"stats",
+	"spibench",
+	"spitrace",
+	"sdbench",
 };
 
 static int cmdLen[ARRAYCOUNT(CmdList)];
@@ -32,6 +52,10 @@ typedef enum
 {
 	CommandEnumcd,
 	CommandEnumls,
+	CommandEnumstats,
+	CommandEnumspibench,
+	CommandEnumspitrace,
+	CommandEnumsdbench,
 	CommandEnumInvalid
 }CommandEnum_t;
 
@@ -60,6 +84,31 @@ static void PJShellInit(void)
 }
 
 
+/*
+ NAME:
+   PJShellReadByte
+ PURPOSE:
+   Wait for a character from the UART, sleeping between polls so the
+   shell does not take CPU time from the other tasks.
+ PARAMETERS:
+   none
+ RETURN:
+   the character read
+ EXAMPLE:
+   ch = PJShellReadByte()
+ OTHER:
+ */
+static char PJShellReadByte(void)
+{
+	char ch;
+	while (!TryReadByte(&ch))
+	{
+		OSTimeDly(SHELL_POLL_TICKS);
+	}
+	return ch;
+}
+
+
 /*
  NAME:
    PJShellEntry
@@ -87,7 +136,7 @@ void PJShellEntry(void *pArg)
 
     	while (iCmdLine < ARRAYCOUNT(cmdLine) - 1)
     	{
-			ch = ReadByte();
+			ch = PJShellReadByte();
 			PrintByte(ch);
 
 			// Break when 'Enter' is pressed
@@ -120,6 +169,18 @@ void PJShellEntry(void *pArg)
 		case CommandEnumls:
 			PJShellls();
 			break;
+		case CommandEnumstats:
+			PJShellstats(&cmdLine[cmdLen[CommandEnumstats]]);
+			break;
+		case CommandEnumspibench:
+			PJShellspibench();
+			break;
+		case CommandEnumspitrace:
+			PJShellspitrace(&cmdLine[cmdLen[CommandEnumspitrace]]);
+			break;
+		case CommandEnumsdbench:
+			PJShellsdbench();
+			break;
 		default:
 			PrintString("  invalid command\r\n");
 			break;
@@ -141,3 +202,247 @@ static void PJShellls()
 }
 
 
+/*
+ NAME:
+   PJShellstats
+ PURPOSE:
+   Print the streaming telemetry of the playing song, the SPI bus
+   arbitration counters and the SD busy wait counters, or start a new
+   telemetry block with "stats reset".
+ PARAMETERS:
+   args: the command line after the command name
+ RETURN:
+   none
+ EXAMPLE:
+   PJShellstats(" reset")
+ OTHER:
+ */
+static void PJShellstats(char *args)
+{
+    Mp3Telemetry tlm;
+
+    while (*args == ' ') args++;
+    if (!strncmp(args, "reset", 5))
+    {
+        Mp3TlmSnapshot(&tlm);
+        Mp3TlmReset(tlm.song);
+        PJShellSpiStats(OS_TRUE);
+        PJShellSdStats(OS_TRUE);
+        PrintString("  telemetry reset\n");
+        return;
+    }
+    Mp3TlmPrint();
+    PJShellSpiStats(OS_FALSE);
+    PJShellSdStats(OS_FALSE);
+}
+
+
+/*
+ NAME:
+   PJShellSpiStats
+ PURPOSE:
+   Print how often the shared SPI bus changed hands, how many data rate
+   changes the arbiter avoided and the longest wait for and hold of the bus
+   per priority class, or clear the wait and hold times. The other counters run from power up.
+ PARAMETERS:
+   isReset: clear the wait times instead of printing
+ RETURN:
+   none
+ */
+static void PJShellSpiStats(BOOLEAN isReset)
+{
+    char buf[SHELL_PRINT_BUF_SIZE];
+    HANDLE hSPI;
+    PjdfSpiStats stats;
+    INT32U length = sizeof(stats);
+
+    hSPI = Open(PJDF_DEVICE_ID_SPI1, 0);
+    if (!PJDF_IS_VALID_HANDLE(hSPI)) return;
+    if (isReset)
+    {
+        Ioctl(hSPI, PJDF_CTRL_SPI_RESET_STATS, 0, 0);
+    }
+    else if (Ioctl(hSPI, PJDF_CTRL_SPI_GET_STATS, &stats, &length) == PJDF_ERR_NONE)
+    {
+        PrintWithBuf(buf, sizeof(buf), "spi: %u transactions, %u owner changes\n",
+            (unsigned int)stats.transactions, (unsigned int)stats.ownerChanges);
+        PrintWithBuf(buf, sizeof(buf), "  rate writes %u, %u avoided\n",
+            (unsigned int)stats.reconfigs, (unsigned int)stats.reconfigsAvoided);
+        PrintWithBuf(buf, sizeof(buf), "  max wait us: audio %u, sd %u, ui %u, other %u\n",
+            (unsigned int)stats.maxWaitUs[PJDF_SPI_CLASS_AUDIO], (unsigned int)stats.maxWaitUs[PJDF_SPI_CLASS_AUDIO_SD],
+            (unsigned int)stats.maxWaitUs[PJDF_SPI_CLASS_UI], (unsigned int)stats.maxWaitUs[PJDF_SPI_CLASS_BACKGROUND]);
+        PrintWithBuf(buf, sizeof(buf), "  max hold us: audio %u, sd %u, ui %u, other %u\n",
+            (unsigned int)stats.maxHoldUs[PJDF_SPI_CLASS_AUDIO], (unsigned int)stats.maxHoldUs[PJDF_SPI_CLASS_AUDIO_SD],
+            (unsigned int)stats.maxHoldUs[PJDF_SPI_CLASS_UI], (unsigned int)stats.maxHoldUs[PJDF_SPI_CLASS_BACKGROUND]);
+        PrintWithBuf(buf, sizeof(buf), "  %u yields to a higher class, %s lock\n", (unsigned int)stats.yields,
+            PJDF_SPI_LOCK_MUTEX ? "ceiling mutex" : "class queue");
+    }
+    Close(hSPI);
+}
+
+
+/*
+ NAME:
+   PJShellSdStats
+ PURPOSE:
+   Print the SD clock, how often read errors made it slower, the CRC errors
+   and retries, how often and how long the SD card waits slept while the
+   card was busy and the block cache hits and misses, or clear the wait,
+   error and cache counters.
+ PARAMETERS:
+   isReset: clear the counters instead of printing
+ RETURN:
+   none
+ */
+static void PJShellSdStats(BOOLEAN isReset)
+{
+    char buf[SHELL_PRINT_BUF_SIZE];
+    Sd2Card *card = SD.sdCard();
+
+    if (card == 0) return;
+    if (isReset)
+    {
+        card->clearWaitStats();
+        card->clearCrcStats();
+        SdVolume::cacheClearStats();
+        return;
+    }
+    PrintWithBuf(buf, sizeof(buf), "sd: clock %u kHz, %u step downs\n",
+        (unsigned int)(card->sckHz() / 1000), (unsigned int)card->sckStepDowns());
+    PrintWithBuf(buf, sizeof(buf), "  crc%s: %u read errors, %u retries, %u write errors\n",
+        card->cardCrc() ? " (card checks)" : "", (unsigned int)card->readCrcErrors(),
+        (unsigned int)card->readRetries(), (unsigned int)card->writeCrcErrors());
+    PrintWithBuf(buf, sizeof(buf), "  %u busy waits slept, %u ms\n",
+        (unsigned int)card->waitSleeps(), (unsigned int)(card->waitSleepTicks() * 1000 / OS_TICKS_PER_SEC));
+    PrintWithBuf(buf, sizeof(buf), "  cache: %u hits, %u misses\n",
+        (unsigned int)SdVolume::cacheHits(), (unsigned int)SdVolume::cacheMisses());
+}
+
+
+/*
+ NAME:
+   PJShellspibench
+ PURPOSE:
+   Measure SPI1 write throughput for the MP3 feed and the LCD over each
+   transfer path, see spiBench.c. Takes about a second.
+ PARAMETERS:
+   none
+ RETURN:
+   none
+ */
+static void PJShellspibench(void)
+{
+    SpiBenchRun();
+}
+
+
+#if PJDF_SPI_TRACE
+// Names of the SPI clients, indexed by PJDF_SPI_CLIENT_xxx
+static const char *SpiClientNames[PJDF_SPI_CLIENTS] = { "other", "mp3 cmd", "sd", "lcd", "mp3 data" };
+
+// Copy of the trace, too big for the shell stack
+static PjdfSpiTrace spiTrace;
+
+// PJShellPrintSpiHist
+// Prints the non empty bins of an SPI trace histogram on one line.
+static void PJShellPrintSpiHist(char *buf, int size, const char *name, const INT32U *hist)
+{
+    int bin;
+
+    PrintWithBuf(buf, size, "    %s us:", name);
+    for (bin = 0; bin < PJDF_SPI_TRACE_BINS; bin++)
+    {
+        if (hist[bin] == 0) continue;
+        PrintWithBuf(buf, size, " %u+ %u", (unsigned int)((bin == 0) ? 0 : (1u << bin)), (unsigned int)hist[bin]);
+    }
+    PrintString("\n");
+}
+#endif
+
+
+/*
+ NAME:
+   PJShellspitrace
+ PURPOSE:
+   Print the SPI bus trace: transactions, bytes and wait and hold time
+   histograms per client, then the log of the last transactions, oldest
+   first, one PjdfSpiTraceEvent per line as hex bytes in memory order
+   (little endian fields). "spitrace reset" clears the trace.
+ PARAMETERS:
+   args: the command line after the command name
+ RETURN:
+   none
+ EXAMPLE:
+   PJShellspitrace(" reset")
+ OTHER:
+   Needs PJDF_SPI_TRACE in pjdfCtrlSpi.h.
+ */
+static void PJShellspitrace(char *args)
+{
+#if PJDF_SPI_TRACE
+    static const char hexDigits[] = "0123456789abcdef";
+    char buf[SHELL_PRINT_BUF_SIZE];
+    HANDLE hSPI;
+    INT32U length = sizeof(spiTrace);
+    INT32U count, i;
+    const INT8U *pEvent;
+    int client, k;
+
+    hSPI = Open(PJDF_DEVICE_ID_SPI1, 0);
+    if (!PJDF_IS_VALID_HANDLE(hSPI)) return;
+    while (*args == ' ') args++;
+    if (!strncmp(args, "reset", 5))
+    {
+        Ioctl(hSPI, PJDF_CTRL_SPI_RESET_TRACE, 0, 0);
+        Close(hSPI);
+        PrintString("  spi trace reset\n");
+        return;
+    }
+    Ioctl(hSPI, PJDF_CTRL_SPI_GET_TRACE, &spiTrace, &length);
+    Close(hSPI);
+
+    for (client = 0; client < PJDF_SPI_CLIENTS; client++)
+    {
+        if (spiTrace.transactions[client] == 0) continue;
+        PrintWithBuf(buf, sizeof(buf), "%s: %u transactions, %u bytes\n", SpiClientNames[client],
+            (unsigned int)spiTrace.transactions[client], (unsigned int)spiTrace.bytes[client]);
+        PJShellPrintSpiHist(buf, sizeof(buf), "wait", spiTrace.waitHist[client]);
+        PJShellPrintSpiHist(buf, sizeof(buf), "hold", spiTrace.holdHist[client]);
+    }
+
+    count = (spiTrace.events < PJDF_SPI_TRACE_EVENTS) ? spiTrace.events : PJDF_SPI_TRACE_EVENTS;
+    PrintWithBuf(buf, sizeof(buf), "log %u of %u, %u byte records\n",
+        (unsigned int)count, (unsigned int)spiTrace.events, (unsigned int)sizeof(PjdfSpiTraceEvent));
+    for (i = spiTrace.events - count; i < spiTrace.events; i++)
+    {
+        pEvent = (const INT8U*)&spiTrace.log[i % PJDF_SPI_TRACE_EVENTS];
+        for (k = 0; k < (int)sizeof(PjdfSpiTraceEvent); k++)
+        {
+            buf[2 * k] = hexDigits[pEvent[k] >> 4];
+            buf[2 * k + 1] = hexDigits[pEvent[k] & 0x0F];
+        }
+        buf[2 * k] = '\n';
+        buf[2 * k + 1] = 0;
+        PrintString(buf);
+    }
+#else
+    PrintString("  spi tracing is not built in, see PJDF_SPI_TRACE\n");
+#endif
+}
+
+
+/*
+ NAME:
+   PJShellsdbench
+ PURPOSE:
+   Measure SD card read throughput with single block (CMD17) and multiple
+   block (CMD18) reads, see sdBench.c. Only runs while no song is open.
+ PARAMETERS:
+   none
+ RETURN:
+   none
+ */
+static void PJShellsdbench(void)
+{
+    SdBenchRun();
+}
@@ -0,0 +1,113 @@
+/*
+    spiBench.c
+    SPI1 throughput benchmark. Compares the transfer paths a write can take
+    for the two write-heavy clients:
+      - lockstep: full duplex, one byte out and one byte back at a time, the
+        way SPI_SendBuffer() worked before it became write only
+      - tx only: SPI_SendBuffer(), TX FIFO kept full, nothing read back
+      - dma: the SPI driver's DMA path used for writes of SPI_DMA_MIN_LENGTH
+        bytes and more
+      - 16 bit fill: SPI_SendRepeat16(), used for LCD fills
+    MP3 feed bursts are MP3_DECODER_BUF_SIZE bytes at the VS1053 data rate,
+    LCD writes SPI_BENCH_LCD_CHUNK bytes at the LCD data rate.
+
+    No chip select is asserted, so the devices ignore the traffic. The bus is
+    taken and released around every chunk so playback keeps running; only the
+    transfer itself is timed, with the DWT cycle counter.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include "spiBench.h"
+#include "pjdf.h"
+#include "print.h"
+
+typedef enum
+{
+    SpiBenchLockstep,
+    SpiBenchTxOnly,
+    SpiBenchDma,
+    SpiBenchFill16
+} SpiBenchPath;
+
+static INT8U spiBenchBuf[SPI_BENCH_LCD_CHUNK];
+
+// SpiBenchMeasure
+// Sends SPI_BENCH_BYTES in chunks over the given path.
+// hSPI: open SPI1 handle
+// dataRate: prescaler of the client the path serves
+// path: transfer path to measure
+// chunk: bytes per transfer
+// Returns: bytes per second
+static INT32U SpiBenchMeasure(HANDLE hSPI, INT16U dataRate, SpiBenchPath path, INT32U chunk)
+{
+    PjdfSpiTransaction transaction;
+    INT32U sizeofTransaction = sizeof(transaction);
+    INT32U length;
+    INT32U sent;
+    INT32U start;
+    INT32U cycles = 0;
+
+    transaction.client = PJDF_SPI_CLIENT_NONE;
+    transaction.priorityClass = PJDF_SPI_CLASS_BACKGROUND;
+    transaction.dataRate = dataRate;
+
+    for (sent = 0; sent < SPI_BENCH_BYTES; sent += chunk)
+    {
+        if (Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, &transaction, &sizeofTransaction) != PJDF_ERR_NONE) while(1);
+
+        start = DWT->CYCCNT;
+        switch (path)
+        {
+        case SpiBenchLockstep:
+            SPI_GetBuffer(PJDF_SPI1, spiBenchBuf, chunk);
+            break;
+        case SpiBenchTxOnly:
+            SPI_SendBuffer(PJDF_SPI1, spiBenchBuf, chunk);
+            break;
+        case SpiBenchDma:
+            length = chunk;
+            Write(hSPI, spiBenchBuf, &length);
+            break;
+        case SpiBenchFill16:
+            SPI_SendRepeat16(PJDF_SPI1, 0xF800, chunk / 2);
+            break;
+        }
+        cycles += DWT->CYCCNT - start;
+
+        if (Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0) != PJDF_ERR_NONE) while(1);
+    }
+
+    if (cycles == 0) return 0;
+    return (INT32U)(((uint64_t)SPI_BENCH_BYTES * SystemCoreClock) / cycles);
+}
+
+// SpiBenchRun
+// Measures every path and prints the throughput in bytes/s on the UART.
+void SpiBenchRun(void)
+{
+    char buf[96];
+    HANDLE hSPI;
+    INT32U lockstep, txOnly, dma, fill16;
+
+    hSPI = Open(PJDF_DEVICE_ID_SPI1, 0);
+    if (!PJDF_IS_VALID_HANDLE(hSPI)) return;
+
+    lockstep = SpiBenchMeasure(hSPI, MP3_SPI_DATARATE, SpiBenchLockstep, MP3_DECODER_BUF_SIZE);
+    txOnly = SpiBenchMeasure(hSPI, MP3_SPI_DATARATE, SpiBenchTxOnly, MP3_DECODER_BUF_SIZE);
+    dma = SpiBenchMeasure(hSPI, MP3_SPI_DATARATE, SpiBenchDma, MP3_DECODER_BUF_SIZE);
+    PrintWithBuf(buf, sizeof(buf), "mp3 feed, %u B bursts: lockstep %u B/s, tx only %u B/s, dma %u B/s\n",
+        (unsigned int)MP3_DECODER_BUF_SIZE, (unsigned int)lockstep, (unsigned int)txOnly, (unsigned int)dma);
+
+    lockstep = SpiBenchMeasure(hSPI, LCD_SPI_DATARATE, SpiBenchLockstep, SPI_BENCH_LCD_CHUNK);
+    txOnly = SpiBenchMeasure(hSPI, LCD_SPI_DATARATE, SpiBenchTxOnly, SPI_BENCH_LCD_CHUNK);
+    dma = SpiBenchMeasure(hSPI, LCD_SPI_DATARATE, SpiBenchDma, SPI_BENCH_LCD_CHUNK);
+    fill16 = SpiBenchMeasure(hSPI, LCD_SPI_DATARATE, SpiBenchFill16, SPI_BENCH_LCD_CHUNK);
+    PrintWithBuf(buf, sizeof(buf), "lcd, %u B writes: lockstep %u B/s, tx only %u B/s, dma %u B/s\n",
+        (unsigned int)SPI_BENCH_LCD_CHUNK, (unsigned int)lockstep, (unsigned int)txOnly, (unsigned int)dma);
+    PrintWithBuf(buf, sizeof(buf), "lcd, 16 bit fill: %u B/s\n", (unsigned int)fill16);
+
+    Close(hSPI);
+}
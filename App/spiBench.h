@@ -0,0 +1,20 @@
+/*
+    spiBench.h
+    SPI1 throughput benchmark run from the shell ("spibench").
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __SPIBENCH_H
+#define __SPIBENCH_H
+
+#include "bsp.h"
+
+#define SPI_BENCH_BYTES             16384   // bytes sent per measured path
+#define SPI_BENCH_LCD_CHUNK         128     // Adafruit_ILI9341 buffer size (ILI9341_SPIBUFLEN)
+
+void SpiBenchRun(void);
+
+#endif
@@ -21,6 +21,8 @@ Module Description:
 #include "print.h"
 
 #include "mp3Util.h"
+#include "mp3Telemetry.h"
+#include "mp3Sci.h"
 #include "mp3UserInterface.h"
 #include "mp3TouchInterface.h"
 
@@ -28,7 +30,9 @@ Module Description:
 
 #define PENRADIUS 3
 
-//#include "train_crossing.h"
+#if MP3_STARTUP_CHIME
+#include "train_crossing.h"
+#endif
 
 #define BUFSIZE         256
 
@@ -40,9 +44,8 @@ unsigned int currSongFilePntr = 0;
 BOOLEAN isPlaying    = OS_FALSE;
 BOOLEAN isStopSong   = OS_FALSE;
 BOOLEAN isFastForward= OS_FALSE;
+BOOLEAN isScan       = OS_FALSE;
 BOOLEAN isRewind     = OS_FALSE;
-BOOLEAN isVolUp      = OS_FALSE;
-BOOLEAN isVolDown    = OS_FALSE;
 
 INT32U currPlayingSongFilePntr = INT_MAX;
 
@@ -55,15 +58,19 @@ INT32U currPlayingSongFilePntr = INT_MAX;
 
 static OS_STK   LcdDisplayTaskStk[APP_DISPLAY_TASK_EQ_STK_SIZE];
 static OS_STK   Mp3StreamTaskStk[APP_MP3STREAM_TASK_EQ_STK_SIZE];
+static OS_STK   Mp3ReaderTaskStk[APP_MP3READER_TASK_EQ_STK_SIZE];
 static OS_STK   CmdControllerTaskStk[APP_CMD_TASK_EQ_STK_SIZE];
 static OS_STK   LcdTouchTaskStk[APP_TOUCH_TASK_EQ_STK_SIZE];
+static OS_STK   ShellTaskStk[APP_SHELL_TASK_EQ_STK_SIZE];
 
      
 // Task prototypes
 void LcdDisplayTask(void* pdata);
 void Mp3StreamTask(void* pdata);
+void Mp3ReaderTask(void* pdata);
 void CmdControllerTask(void* pdata);
 void LcdTouchTask(void* pdata);
+void PJShellEntry(void *pArg);
 
 // Globals
 PlayerWindow pWindow;                   // Player Window Instance
@@ -72,6 +79,9 @@ PlayerWindow pWindow;                   // Player Window Instance
 OS_EVENT *touchEventsMbox;
 OS_EVENT *mp3EventsMbox;
 
+OS_FLAG_GRP *mp3StreamFlags;
+OS_EVENT *sdCardSem;
+
 OS_EVENT *displayQMsg;
 void * displayQMsgPtrs[EVENT_QUEUE_SIZE];
 /************************************************************************************
@@ -117,6 +127,14 @@ void StartupTask(void* pdata)
     {
         //PrintWithBuf(buf, PRINTBUFMAX, "Attempt to initialize SD card failed.\n");
     }
+    else
+    {
+        // the clock Sd2Card::init() settled on and the rate it read at
+        Sd2Card *card = SD.sdCard();
+        PrintWithBuf(buf, BUFSIZE, "StartupTask: SD clock %u kHz%s%s, read %u B/s\n",
+            (unsigned int)(card->sckHz() / 1000), card->highSpeed() ? " high speed" : "",
+            card->cardCrc() ? " crc" : "", (unsigned int)card->rampRate());
+    }
 
     // Create the test tasks
     PrintWithBuf(buf, BUFSIZE, "StartupTask: Creating the application tasks\n");
@@ -130,12 +148,25 @@ void StartupTask(void* pdata)
     
     //Create Event Flag -- not using
     //mp3Flags = OSFlagCreate( 0x1, &err);
+    
+    // Event flags between the MP3 reader and feeder stages
+    mp3StreamFlags = OSFlagCreate(0x0, &err);
+    if (err != OS_ERR_NONE) while(1);
+    
+    // The SD library is not task safe: songs and sdbench take turns
+    sdCardSem = OSSemCreate(1);
+    if (sdCardSem == NULL) while(1);
+    
+    // Streaming health telemetry, queried with the shell's stats command
+    Mp3TlmInit();
 
     // The maximum number of tasks the application can have is defined by OS_MAX_TASKS in os_cfg.h
-    OSTaskCreate(Mp3StreamTask, (void*)0, &Mp3StreamTaskStk[APP_MP3STREAM_TASK_EQ_STK_SIZE-1], APP_TASK_TEST4_PRIO);
-    OSTaskCreate(LcdDisplayTask, (void*)0, &LcdDisplayTaskStk[APP_DISPLAY_TASK_EQ_STK_SIZE-1], APP_TASK_TEST2_PRIO);
-    OSTaskCreate(LcdTouchTask,   (void*)0, &LcdTouchTaskStk[APP_TOUCH_TASK_EQ_STK_SIZE-1],   APP_TASK_TEST1_PRIO);
-    OSTaskCreate(CmdControllerTask,   (void*)0, &CmdControllerTaskStk[APP_CMD_TASK_EQ_STK_SIZE-1],   APP_TASK_TEST3_PRIO);
+    OSTaskCreate(Mp3StreamTask, (void*)0, &Mp3StreamTaskStk[APP_MP3STREAM_TASK_EQ_STK_SIZE-1], APP_TASK_MP3STREAM_PRIO);
+    OSTaskCreate(Mp3ReaderTask, (void*)0, &Mp3ReaderTaskStk[APP_MP3READER_TASK_EQ_STK_SIZE-1], APP_TASK_MP3READER_PRIO);
+    OSTaskCreate(LcdDisplayTask, (void*)0, &LcdDisplayTaskStk[APP_DISPLAY_TASK_EQ_STK_SIZE-1], APP_TASK_DISPLAY_PRIO);
+    OSTaskCreate(LcdTouchTask,   (void*)0, &LcdTouchTaskStk[APP_TOUCH_TASK_EQ_STK_SIZE-1],   APP_TASK_TOUCH_PRIO);
+    OSTaskCreate(CmdControllerTask,   (void*)0, &CmdControllerTaskStk[APP_CMD_TASK_EQ_STK_SIZE-1],   APP_TASK_CMD_PRIO);
+    OSTaskCreate(PJShellEntry,   (void*)0, &ShellTaskStk[APP_SHELL_TASK_EQ_STK_SIZE-1],   APP_TASK_SHELL_PRIO);
 
     // Delete ourselves, letting the work be done in the new tasks.
     PrintWithBuf(buf, BUFSIZE, "StartupTask: deleting self\n");
@@ -215,6 +246,7 @@ void CmdControllerTask(void* pdata)
             if(currPlayingSongFilePntr != currSongFilePntr)
             {
                 // exit from song loop
+                if (currPlayingSongFilePntr != INT_MAX) Mp3TlmStopRequest(OS_TRUE);
                 isStopSong = OS_TRUE;
                 OSMboxPost(mp3EventsMbox, (void*)&receivedEvent);
                 
@@ -239,6 +271,7 @@ void CmdControllerTask(void* pdata)
         case EVENT_STOP_RELEASE:
             if(isPlaying || (currPlayingSongFilePntr == currSongFilePntr))
             {
+                Mp3TlmStopRequest(OS_FALSE);
                 isStopSong = OS_TRUE;
             }
             else
@@ -254,9 +287,12 @@ void CmdControllerTask(void* pdata)
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
         case EVENT_FF_PRESS:
+            // The MP3 task switches to scan speed if the button stays down
+            isScan = OS_TRUE;
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
         case EVENT_FF_RELEASE:
+            isScan = OS_FALSE;
             isFastForward = OS_TRUE;
             
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
@@ -277,9 +313,10 @@ void CmdControllerTask(void* pdata)
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
         case EVENT_VOLPLUS_RELEASE:
-            if(isPlaying)
-                isVolUp  = OS_TRUE;
-            else
+            // Queued for the MP3 task, which sends it within one feed cycle
+            // while streaming or right away when idle
+            Mp3VolumeControl(VOLUP);
+            if(currPlayingSongFilePntr == INT_MAX)
                 OSMboxPost(mp3EventsMbox, (void*)&receivedEvent);
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
@@ -287,9 +324,8 @@ void CmdControllerTask(void* pdata)
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
         case EVENT_VOLMINUS_RELEASE:
-            if(isPlaying)
-                isVolDown  = OS_TRUE;
-            else
+            Mp3VolumeControl(VOLDOWN);
+            if(currPlayingSongFilePntr == INT_MAX)
                 OSMboxPost(mp3EventsMbox, (void*)&receivedEvent);
             err = OSQPost(displayQMsg, (void*)&receivedEvent);
             break;
@@ -332,6 +368,17 @@ void Mp3StreamTask(void* pdata)
     length = sizeof(HANDLE);
     pjdfErr = Ioctl(hMp3, PJDF_CTRL_MP3_SET_SPI_HANDLE, &hSPI, &length);
     if(PJDF_IS_ERROR(pjdfErr)) while(1);
+    
+    // Report the time the driver waits for DREQ to the telemetry
+    PjdfMp3DreqHook dreqHook = Mp3TlmDreqWait;
+    length = sizeof(dreqHook);
+    pjdfErr = Ioctl(hMp3, PJDF_CTRL_MP3_SET_DREQ_HOOK, &dreqHook, &length);
+    if(PJDF_IS_ERROR(pjdfErr)) while(1);
+
+#if MP3_STARTUP_CHIME
+    // Played from flash, the SD card is not needed
+    Mp3PlayClip(hMp3, Train_Crossing, sizeof(Train_Crossing));
+#endif
 
     // Send initialization data to the MP3 decoder and run a test
 	PrintWithBuf(buf, BUFSIZE, "Starting MP3 device test\n");
@@ -350,15 +397,13 @@ void Mp3StreamTask(void* pdata)
         switch (mp3Event)
         {
         case EVENT_PLAY_RELEASE:
-             Mp3StreamCycle(hMp3);
+            // Keeps playing while the song list advances without a gapless transition
+            while (Mp3StreamCycle(hMp3));
             break;
         
         case EVENT_VOLPLUS_RELEASE:
-            Mp3VolumeControl(hMp3, VOLUP);
-            break;
-        
         case EVENT_VOLMINUS_RELEASE:
-            Mp3VolumeControl(hMp3, VOLDOWN);
+            Mp3SciFlush(hMp3);
             break;
             
         default:
@@ -367,3 +412,22 @@ void Mp3StreamTask(void* pdata)
          
     }
 }
+
+/************************************************************************************
+
+   Runs the SD reader stage of MP3 streaming. It sits below the feeder
+   (Mp3StreamTask) in priority; the ring buffer absorbs its latency.
+
+************************************************************************************/
+void Mp3ReaderTask(void* pdata)
+{
+    INT8U err;
+    
+    while (1)
+    {
+        OSFlagPend(mp3StreamFlags, MP3_STREAM_FLAG_START, OS_FLAG_WAIT_SET_ANY + OS_FLAG_CONSUME, 0, &err);
+        if(err != OS_ERR_NONE) while(1);
+        
+        Mp3ReaderCycle();
+    }
+}
@@ -55,11 +55,18 @@
 */
 
 //task priorities
+// SPI clients are ordered like the SPI bus classes (pjdfCtrlSpi.h): the MP3
+// feeder first, then the SD reader, then the display. The bus mutex raises
+// its owner to APP_SPI_MUTEX_PRIO, which must stay above every SPI client
+// and must not be used by a task.
+#define APP_SPI_MUTEX_PRIO                  3
 #define APP_TASK_START_PRIO                 4
-#define APP_TASK_TEST1_PRIO                 5
-#define APP_TASK_TEST2_PRIO                 6
-#define APP_TASK_TEST3_PRIO                 7
-#define APP_TASK_TEST4_PRIO                 8
+#define APP_TASK_MP3STREAM_PRIO             5
+#define APP_TASK_MP3READER_PRIO             6
+#define APP_TASK_TOUCH_PRIO                 7
+#define APP_TASK_CMD_PRIO                   8
+#define APP_TASK_DISPLAY_PRIO               9
+#define APP_TASK_SHELL_PRIO                 10
 #define  OS_TASK_TMR_PRIO                (OS_LOWEST_PRIO - 2u)
 
 
@@ -70,12 +77,14 @@
 *********************************************************************************************************
 */
 
-#define  APP_CFG_TASK_START_STK_SIZE            256u
+#define  APP_CFG_TASK_START_STK_SIZE            512u    // SD init verifies blocks with CRC on this stack
 #define  APP_CFG_TASK_EQ_STK_SIZE               512u
 #define  APP_MP3STREAM_TASK_EQ_STK_SIZE         4096u
+#define  APP_MP3READER_TASK_EQ_STK_SIZE         2048u
 #define  APP_DISPLAY_TASK_EQ_STK_SIZE           2048u
 #define  APP_TOUCH_TASK_EQ_STK_SIZE             2048u
 #define  APP_CMD_TASK_EQ_STK_SIZE               2048u
+#define  APP_SHELL_TASK_EQ_STK_SIZE             1024u
 #define  APP_CFG_TASK_OBJ_STK_SIZE              256u
 
 
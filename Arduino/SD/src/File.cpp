@@ -115,6 +115,13 @@ int File::read(void *buf, uint16_t nbyte) {
   return 0;
 }
 
+// zero-copy read, points span at the data inside the SD block cache
+int File::readSpan(uint8_t **span, uint16_t nbyte) {
+  if (_file) 
+    return _file->readSpan(span, nbyte);
+  return 0;
+}
+
 int File::available() {
   if (! _file) return 0;
 
@@ -341,7 +341,7 @@ boolean SDClass::begin(uint8_t csPin) {
     Return true if initialization succeeds, false otherwise.
 
    */
-  return card.init(SPI_HALF_SPEED, csPin) &&
+  return card.init(SPI_FULL_SPEED, csPin) &&
          volume.init(card) &&
          root.openRoot(volume);
 }
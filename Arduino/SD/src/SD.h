@@ -18,6 +18,7 @@
 #define boolean bool
 
 #include <pjdf.h>
+#include <utility/Sd2Card.h>
 #include <utility/SdFat.h>
 
 #define FILE_READ O_READ
@@ -38,6 +39,7 @@ public:
   virtual int available();
   virtual void flush();
   int read(void *buf, uint16_t nbyte);
+  int readSpan(uint8_t **span, uint16_t nbyte);
   boolean seek(uint32_t pos);
   uint32_t position();
   uint32_t size();
@@ -67,6 +69,9 @@ public:
   // before other methods are used.
   boolean begin(uint8_t csPin = SD_CHIP_SELECT_PIN);
   boolean begin(HANDLE hSD) { card.SetSDHandle(hSD); return begin(); }
+
+  // The card under the volume, null until begin() mounted the volume on it.
+  Sd2Card *sdCard(void) { return SdVolume::device() == &card ? &card : 0; }
   
   // Open the specified file/directory with the supplied mode (e.g. read or
   // write, etc). Returns a File object for interacting with the file.
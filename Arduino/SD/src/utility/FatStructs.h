@@ -27,6 +27,11 @@
  * mostly from Microsoft document fatgen103.doc
  * http://www.microsoft.com/whdc/system/platform/firmware/fatgen.mspx
  */
+#ifndef __ICCARM__
+// host builds, see Tools/sdimage: pack the on-disk layouts like IAR's __packed
+#define __packed
+#pragma pack(push, 1)
+#endif  // __ICCARM__
 //------------------------------------------------------------------------------
 /** Value for byte 510 of boot block or MBR */
 uint8_t const BOOTSIG0 = 0X55;
@@ -415,4 +420,7 @@ static inline uint8_t DIR_IS_SUBDIR(const dir_t* dir) {
 static inline uint8_t DIR_IS_FILE_OR_SUBDIR(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_VOLUME_ID) == 0;
 }
+#ifndef __ICCARM__
+#pragma pack(pop)
+#endif  // __ICCARM__
 #endif  // FatStructs_h
@@ -20,26 +20,123 @@
 #define USE_SPI_LIB
 #include "Sd2Card.h"
 #include "ucos_ii.h"
+#if SD_HW_CRC
+#include "bspSD.h"
+#endif  // SD_HW_CRC
 //------------------------------------------------------------------------------
 
 // functions for hardware SPI
+//
+// Every Read/Write goes through two PJDF drivers, so the card is talked to
+// in frames: a command is one write and responses, tokens and busy are
+// clocked in SD_POLL_BYTES at a time. Bytes polled past the one wanted
+// are kept in rxBuf_ and handed out by the next receive; a send or a new
+// command drops them.
+
 /** Send a byte to the card */
 void Sd2Card::spiSend(uint8_t b) {
     static uint32_t len = 1;
+    rxIndex_ = rxCount_ = 0;
     Write(hSD_, &b, &len);
 }
 /** Receive a byte from the card */
 uint8_t Sd2Card::spiRec(void) {
-    static uint32_t len = 1;
-    uint8_t buf= 0xFF;
-    Read(hSD_, &buf, &len);;
-    return buf;
+    if (rxIndex_ == rxCount_) {
+        uint32_t len = SD_POLL_BYTES;
+        memset(rxBuf_, 0xFF, SD_POLL_BYTES);
+        Read(hSD_, rxBuf_, &len);
+        rxIndex_ = 0;
+        rxCount_ = SD_POLL_BYTES;
+    }
+    return rxBuf_[rxIndex_++];
 }
 
 /** Receive a buffer of data from the card */
 void Sd2Card::spiRecBuf(uint8_t *buf, uint32_t *len) {
-    memset(buf, 0xFF, *len);
-    Read(hSD_, buf, len);;
+    uint32_t n = rxCount_ - rxIndex_;
+    if (n > *len) n = *len;
+    memcpy(buf, &rxBuf_[rxIndex_], n);
+    rxIndex_ += n;
+    uint32_t rest = *len - n;
+    if (rest == 0) return;
+    memset(buf + n, 0xFF, rest);
+    Read(hSD_, buf + n, &rest);
+}
+
+/** Send a buffer of data to the card */
+void Sd2Card::spiSendBuf(const uint8_t *buf, uint32_t len) {
+    rxIndex_ = rxCount_ = 0;
+    Write(hSD_, (void*)buf, &len);
+}
+
+/** Receive and drop count bytes from the card */
+void Sd2Card::spiSkip(uint16_t count) {
+    uint8_t junk[SD_SKIP_BYTES];
+    while (count > 0) {
+        uint32_t n = count < SD_SKIP_BYTES ? count : SD_SKIP_BYTES;
+        spiRecBuf(junk, &n);
+        count -= n;
+    }
+}
+//------------------------------------------------------------------------------
+// CRC16-CCITT, polynomial 0X1021, sent by the card after each data block
+#if SD_HW_CRC
+static uint16_t crc16(const uint8_t* data, uint16_t n, uint16_t crc) {
+  return BspSDCrc16(data, n, crc);
+}
+#else  // SD_HW_CRC
+static const uint16_t crc16Table[256] = {
+  0X0000, 0X1021, 0X2042, 0X3063, 0X4084, 0X50A5, 0X60C6, 0X70E7,
+  0X8108, 0X9129, 0XA14A, 0XB16B, 0XC18C, 0XD1AD, 0XE1CE, 0XF1EF,
+  0X1231, 0X0210, 0X3273, 0X2252, 0X52B5, 0X4294, 0X72F7, 0X62D6,
+  0X9339, 0X8318, 0XB37B, 0XA35A, 0XD3BD, 0XC39C, 0XF3FF, 0XE3DE,
+  0X2462, 0X3443, 0X0420, 0X1401, 0X64E6, 0X74C7, 0X44A4, 0X5485,
+  0XA56A, 0XB54B, 0X8528, 0X9509, 0XE5EE, 0XF5CF, 0XC5AC, 0XD58D,
+  0X3653, 0X2672, 0X1611, 0X0630, 0X76D7, 0X66F6, 0X5695, 0X46B4,
+  0XB75B, 0XA77A, 0X9719, 0X8738, 0XF7DF, 0XE7FE, 0XD79D, 0XC7BC,
+  0X48C4, 0X58E5, 0X6886, 0X78A7, 0X0840, 0X1861, 0X2802, 0X3823,
+  0XC9CC, 0XD9ED, 0XE98E, 0XF9AF, 0X8948, 0X9969, 0XA90A, 0XB92B,
+  0X5AF5, 0X4AD4, 0X7AB7, 0X6A96, 0X1A71, 0X0A50, 0X3A33, 0X2A12,
+  0XDBFD, 0XCBDC, 0XFBBF, 0XEB9E, 0X9B79, 0X8B58, 0XBB3B, 0XAB1A,
+  0X6CA6, 0X7C87, 0X4CE4, 0X5CC5, 0X2C22, 0X3C03, 0X0C60, 0X1C41,
+  0XEDAE, 0XFD8F, 0XCDEC, 0XDDCD, 0XAD2A, 0XBD0B, 0X8D68, 0X9D49,
+  0X7E97, 0X6EB6, 0X5ED5, 0X4EF4, 0X3E13, 0X2E32, 0X1E51, 0X0E70,
+  0XFF9F, 0XEFBE, 0XDFDD, 0XCFFC, 0XBF1B, 0XAF3A, 0X9F59, 0X8F78,
+  0X9188, 0X81A9, 0XB1CA, 0XA1EB, 0XD10C, 0XC12D, 0XF14E, 0XE16F,
+  0X1080, 0X00A1, 0X30C2, 0X20E3, 0X5004, 0X4025, 0X7046, 0X6067,
+  0X83B9, 0X9398, 0XA3FB, 0XB3DA, 0XC33D, 0XD31C, 0XE37F, 0XF35E,
+  0X02B1, 0X1290, 0X22F3, 0X32D2, 0X4235, 0X5214, 0X6277, 0X7256,
+  0XB5EA, 0XA5CB, 0X95A8, 0X8589, 0XF56E, 0XE54F, 0XD52C, 0XC50D,
+  0X34E2, 0X24C3, 0X14A0, 0X0481, 0X7466, 0X6447, 0X5424, 0X4405,
+  0XA7DB, 0XB7FA, 0X8799, 0X97B8, 0XE75F, 0XF77E, 0XC71D, 0XD73C,
+  0X26D3, 0X36F2, 0X0691, 0X16B0, 0X6657, 0X7676, 0X4615, 0X5634,
+  0XD94C, 0XC96D, 0XF90E, 0XE92F, 0X99C8, 0X89E9, 0XB98A, 0XA9AB,
+  0X5844, 0X4865, 0X7806, 0X6827, 0X18C0, 0X08E1, 0X3882, 0X28A3,
+  0XCB7D, 0XDB5C, 0XEB3F, 0XFB1E, 0X8BF9, 0X9BD8, 0XABBB, 0XBB9A,
+  0X4A75, 0X5A54, 0X6A37, 0X7A16, 0X0AF1, 0X1AD0, 0X2AB3, 0X3A92,
+  0XFD2E, 0XED0F, 0XDD6C, 0XCD4D, 0XBDAA, 0XAD8B, 0X9DE8, 0X8DC9,
+  0X7C26, 0X6C07, 0X5C64, 0X4C45, 0X3CA2, 0X2C83, 0X1CE0, 0X0CC1,
+  0XEF1F, 0XFF3E, 0XCF5D, 0XDF7C, 0XAF9B, 0XBFBA, 0X8FD9, 0X9FF8,
+  0X6E17, 0X7E36, 0X4E55, 0X5E74, 0X2E93, 0X3EB2, 0X0ED1, 0X1EF0,
+};
+// continue crc over n bytes of data, start a block with crc = 0
+static uint16_t crc16(const uint8_t* data, uint16_t n, uint16_t crc) {
+  while (n--) crc = (crc << 8) ^ crc16Table[(crc >> 8) ^ *data++];
+  return crc;
+}
+#endif  // SD_HW_CRC
+//------------------------------------------------------------------------------
+// CRC7, polynomial 0X09, of a command frame
+static uint8_t crc7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  while (n--) {
+    uint8_t d = *data++;
+    for (uint8_t i = 0; i < 8; i++, d <<= 1) {
+      crc <<= 1;
+      if ((d ^ crc) & 0X80) crc ^= 0X09;
+    }
+  }
+  return crc & 0X7F;
 }
 //------------------------------------------------------------------------------
 /** nop to tune soft SPI timing */
@@ -51,24 +148,30 @@ uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   // end read if in partialBlockRead mode
   readEnd();
 
+  // end multiple block read, any other command would be ignored
+  if (inMultiRead_) readStop();
+
+  // bytes polled for the last command are stale
+  rxIndex_ = rxCount_ = 0;
+
   // select card
   chipSelectLow();
 
 
-  // wait up to 300 ms if busy
-  waitNotBusy(300);
+  // wait up to 300 ms if busy, a card in a multiple block read sends
+  // data instead of busy so a stop is sent right away
+  if (cmd != CMD12) waitNotBusy(SD_COMMAND_TIMEOUT);
 
-  // send command
-  spiSend(cmd | 0x40);
+  // command, argument and CRC go out as one frame
+  uint8_t frame[6];
+  frame[0] = cmd | 0x40;
+  for (uint8_t i = 0; i < 4; i++) frame[1 + i] = arg >> (24 - 8 * i);
+  // correct crc for every command, the card checks it after CMD59
+  frame[5] = (crc7(frame, 5) << 1) | 1;
+  spiSendBuf(frame, sizeof(frame));
 
-  // send argument
-  for (int8_t s = 24; s >= 0; s -= 8) spiSend(arg >> s);
-
-  // send CRC
-  uint8_t crc = 0XFF;
-  if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
-  if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
-  spiSend(crc);
+  // skip stuff byte for stop read
+  if (cmd == CMD12) spiRec();
 
   // wait for response
   for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++)
@@ -169,25 +272,36 @@ uint8_t Sd2Card::eraseSingleBlockEnable(void) {
 /**
  * Initialize an SD flash memory card.
  *
- * \param[in] sckRateID SPI clock rate selector. See setSckRate().
+ * \param[in] sckRateID Fastest SPI clock rate to try. See setSckRate().
  * \param[in] chipSelectPin SD chip select pin number.
  *
+ * The card is identified at SPI_INIT_SPEED and switched to high speed mode
+ * where it has it. The clock is then ramped to the fastest rate, starting
+ * at \a sckRateID, at which SD_RAMP_BLOCKS blocks read with a good CRC.
+ *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.  The reason for failure
  * can be determined by calling errorCode() and errorData().
  */
 uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
-  errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+  errorCode_ = inBlock_ = inMultiRead_ = partialBlockRead_ = type_ = 0;
+  cardCrc_ = 0;
   chipSelectPin_ = chipSelectPin;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)OSTimeGet(); // use uCOS ticks?
   uint32_t arg;
+  highSpeed_ = 0;
+
+  // identify the card at the slow clock
+  if (!setSckRate(SPI_INIT_SPEED)) return false;
 
 
 
   // must supply min of 74 clock cycles with CS high.
+  uint8_t ones[10];
+  memset(ones, 0XFF, sizeof(ones));
   Ioctl(hSD_, PJDF_CTRL_SD_LOCK_SPI, 0, 0);
-  for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
+  spiSendBuf(ones, sizeof(ones));
   Ioctl(hSD_, PJDF_CTRL_SD_RELEASE_SPI, 0, 0);
 
   //chipSelectLow(); // done by cardCommand() below
@@ -232,9 +346,14 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
     // discard rest of ocr - contains allowed voltage range
     for (uint8_t i = 0; i < 3; i++) spiRec();
   }
+#if SD_CARD_CRC
+  // a card that checks CRCs rejects a garbled command or write block
+  cardCrc_ = cardCommand(CMD59, 1) == R1_READY_STATE;
+#endif  // SD_CARD_CRC
   chipSelectHigh();
 
-  return true;
+  highSpeed_ = switchHighSpeed();
+  return rampSckRate(sckRateID);
 
  fail:
   chipSelectHigh();
@@ -272,6 +391,24 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
   return readData(block, 0, 512, dst);
 }
 //------------------------------------------------------------------------------
+/**
+ * Read consecutive 512 byte blocks, with one multiple block read.
+ *
+ * \param[in] block Logical block of the first block.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \param[in] count Number of blocks to read.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readBlocks(uint32_t block, uint8_t* dst, uint32_t count) {
+  if (count > 1 && !readStreaming(block) && !readStart(block)) return false;
+  for (; count > 0; count--, block++, dst += 512) {
+    if (!readBlock(block, dst)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Read part of a 512 byte block from an SD card.
  *
@@ -284,11 +421,13 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
  */
 uint8_t Sd2Card::readData(uint32_t block,
         uint16_t offset, uint16_t count, uint8_t* dst) {
-  //uint16_t n;
+  uint32_t n;
   if (count == 0) return true;
   if ((count + offset) > 512) {
     goto fail;
   }
+  // whole blocks are CRC checked and retried
+  if (count == 512) return readBlockChecked(block, dst);
   if (!inBlock_ || block != block_ || offset < offset_) {
     block_ = block;
     // use address if not SDHC card
@@ -297,9 +436,8 @@ uint8_t Sd2Card::readData(uint32_t block,
       error(SD_CARD_ERROR_CMD17);
       goto fail;
     }
-    if (!waitStartBlock()) {
-      goto fail;
-    }
+    // chip select is high already if this fails
+    if (!waitStartBlock()) return false;
     offset_ = 0;
     inBlock_ = 1;
   }
@@ -329,22 +467,14 @@ uint8_t Sd2Card::readData(uint32_t block,
 
 #else  // OPTIMIZE_HARDWARE_SPI
 
-  if (offset == 0 && count == 512)
-  {
-      uint32_t tmpcount = count;
-      spiRecBuf(dst, &tmpcount);
-  }
-  else
-  {
-      // skip data before offset
-      for (;offset_ < offset; offset_++) {
-        spiRec();
-      }
-      // transfer data
-      for (uint16_t i = 0; i < count; i++) {
-        dst[i] = spiRec();
-      }
+  // skip data before offset
+  if (offset_ < offset) {
+    spiSkip(offset - offset_);
+    offset_ = offset;
   }
+  // transfer data
+  n = count;
+  spiRecBuf(dst, &n);
 #endif  // OPTIMIZE_HARDWARE_SPI
 
   offset_ += count;
@@ -359,6 +489,160 @@ uint8_t Sd2Card::readData(uint32_t block,
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read the next 512 byte block of a multiple block read.
+ *
+ * The chip select and the SPI bus are only held for the block itself,
+ * the card waits with the next block until it is clocked out, so other
+ * SPI devices keep their turn between blocks.
+ *
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readData(uint8_t* dst) {
+  if (!inMultiRead_) {
+    error(SD_CARD_ERROR_READ);
+    return false;
+  }
+  chipSelectLow();
+  if (!waitStartBlock()) {
+    // waitStartBlock has set chip select high
+    readStop();
+    return false;
+  }
+  multiBlock_++;
+  if (!readBlockData(dst)) {
+    // go on with single block reads after a bad block
+    readStop();
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// Read a whole block, from the open multiple block read if it returns the
+// block next. A bad CRC or a timeout is retried SD_READ_RETRIES times and
+// SD_STEP_DOWN_ERRORS such errors in a row make the clock one rate slower.
+uint8_t Sd2Card::readBlockChecked(uint32_t block, uint8_t* dst) {
+  for (uint8_t tries = 0; ; tries++) {
+    if (readStreaming(block) ? readData(dst) : readSingleBlock(block, dst)) {
+      readErrors_ = 0;
+      return true;
+    }
+    if (errorCode_ != SD_CARD_ERROR_READ_CRC
+      && errorCode_ != SD_CARD_ERROR_READ_TIMEOUT) return false;
+    if (++readErrors_ >= SD_STEP_DOWN_ERRORS
+      && sckRateID_ < (SPI_INIT_SPEED - 1)) {
+      if (setSckRate(sckRateID_ + 1)) sckStepDowns_++;
+      readErrors_ = 0;
+    }
+    if (tries == SD_READ_RETRIES) return false;
+    readRetries_++;
+  }
+}
+//------------------------------------------------------------------------------
+// Receive a data block after its start token and its CRC and set chip
+// select high. The CRC is checked with SD_CHECK_READ_CRC or if dst is
+// null, which only checks the block.
+uint8_t Sd2Card::readBlockData(uint8_t* dst) {
+  uint8_t chunk[SD_SKIP_BYTES];
+  uint16_t crc = 0;
+  uint32_t n;
+  if (dst) {
+    n = 512;
+    spiRecBuf(dst, &n);
+#if SD_CHECK_READ_CRC
+    crc = crc16(dst, 512, 0);
+#endif  // SD_CHECK_READ_CRC
+  } else {
+    for (uint16_t i = 0; i < 512; i += SD_SKIP_BYTES) {
+      n = SD_SKIP_BYTES;
+      spiRecBuf(chunk, &n);
+      crc = crc16(chunk, SD_SKIP_BYTES, crc);
+    }
+  }
+  n = 2;
+  spiRecBuf(chunk, &n);
+  chipSelectHigh();
+  if ((SD_CHECK_READ_CRC || !dst)
+    && crc != (uint16_t)((chunk[0] << 8) | chunk[1])) {
+    readCrcErrors_++;
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// read a whole block with CMD17, a null dst only checks its CRC
+uint8_t Sd2Card::readSingleBlock(uint32_t block, uint8_t* dst) {
+  // use address if not SDHC card
+  if (type()!= SD_CARD_TYPE_SDHC) block <<= 9;
+  if (cardCommand(CMD17, block)) {
+    error(SD_CARD_ERROR_CMD17);
+    chipSelectHigh();
+    return false;
+  }
+  // chip select is high already if this fails
+  if (!waitStartBlock()) return false;
+  return readBlockData(dst);
+}
+//------------------------------------------------------------------------------
+/**
+ * Start a multiple block read sequence.
+ *
+ * The card sends \a blockNumber and the blocks after it, one per call to
+ * readData(uint8_t* dst), without a command for each block. readBlock()
+ * and readData() of the next block in the sequence continue it, any
+ * other command ends it with readStop().
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStart(uint32_t blockNumber) {
+  uint32_t address = blockNumber;
+  // use address if not SDHC card
+  if (type()!= SD_CARD_TYPE_SDHC) address <<= 9;
+  if (cardCommand(CMD18, address)) {
+    error(SD_CARD_ERROR_CMD18);
+    goto fail;
+  }
+  chipSelectHigh();
+  multiBlock_ = blockNumber;
+  inMultiRead_ = 1;
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/** End a multiple block read sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStop(void) {
+  inMultiRead_ = 0;
+  if (cardCommand(CMD12, 0)) {
+    error(SD_CARD_ERROR_CMD12);
+    goto fail;
+  }
+  // R1b response, wait for the card to finish the stop
+  if (!waitNotBusy(SD_READ_TIMEOUT)) {
+    error(SD_CARD_ERROR_STOP_TRAN);
+    goto fail;
+  }
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Skip remaining data in a block when in partial block read mode. */
 void Sd2Card::readEnd(void) {
   if (inBlock_) {
@@ -375,7 +659,7 @@ void Sd2Card::readEnd(void) {
     while (!(SPSR & (1 << SPIF)))
       ;
 #else  // OPTIMIZE_HARDWARE_SPI
-    while (offset_++ < 514) spiRec();
+    if (offset_ < 514) spiSkip(514 - offset_);
 #endif  // OPTIMIZE_HARDWARE_SPI
     chipSelectHigh();
     inBlock_ = 0;
@@ -385,15 +669,15 @@ void Sd2Card::readEnd(void) {
 /** read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = (uint8_t*)(buf);
+  uint32_t n = 16;
   if (cardCommand(cmd, 0)) {
     error(SD_CARD_ERROR_READ_REG);
     goto fail;
   }
   if (!waitStartBlock()) goto fail;
   // transfer data
-  for (uint16_t i = 0; i < 16; i++) dst[i] = spiRec();
-  spiRec();  // get first crc byte
-  spiRec();  // get second crc byte
+  spiRecBuf(dst, &n);
+  spiSkip(2);  // skip crc
   chipSelectHigh();
   return true;
 
@@ -405,17 +689,18 @@ uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
 /**
  * Set the SPI clock rate.
  *
- * \param[in] sckRateID A value in the range [0, 6].
+ * \param[in] sckRateID A value in the range [0, 7].
  *
  * The SPI clock will be set to F_CPU/pow(2, 1 + sckRateID). The maximum
- * SPI rate is F_CPU/2 for \a sckRateID = 0 and the minimum rate is F_CPU/128
- * for \a scsRateID = 6.
+ * SPI rate is F_CPU/2 for \a sckRateID = 0 and the minimum rate is F_CPU/256
+ * for \a scsRateID = 7, SPI_INIT_SPEED. F_CPU is the SPI kernel clock, the
+ * rate is used from the next transaction on.
  *
  * \return The value one, true, is returned for success and the value zero,
  * false, is returned for an invalid value of \a sckRateID.
  */
 uint8_t Sd2Card::setSckRate(uint8_t sckRateID) {
-  if (sckRateID > 6) {
+  if (sckRateID > SPI_INIT_SPEED) {
     error(SD_CARD_ERROR_SCK_RATE);
     return false;
   }
@@ -430,34 +715,116 @@ uint8_t Sd2Card::setSckRate(uint8_t sckRateID) {
   SPCR |= (sckRateID & 4 ? (1 << SPR1) : 0)
     | (sckRateID & 2 ? (1 << SPR0) : 0);
 #else // USE_SPI_LIB
-//  switch (sckRateID) {
-//    case 0:  settings = SPISettings(25000000, MSBFIRST, SPI_MODE0); break;
-//    case 1:  settings = SPISettings(4000000, MSBFIRST, SPI_MODE0); break;
-//    case 2:  settings = SPISettings(2000000, MSBFIRST, SPI_MODE0); break;
-//    case 3:  settings = SPISettings(1000000, MSBFIRST, SPI_MODE0); break;
-//    case 4:  settings = SPISettings(500000, MSBFIRST, SPI_MODE0); break;
-//    case 5:  settings = SPISettings(250000, MSBFIRST, SPI_MODE0); break;
-//    default: settings = SPISettings(125000, MSBFIRST, SPI_MODE0);
-//  }
+  INT32U length = sizeof(sckRateID);
+  if (PJDF_IS_ERROR(Ioctl(hSD_, PJDF_CTRL_SD_SET_SCK_RATE, &sckRateID, &length))) {
+    error(SD_CARD_ERROR_SCK_RATE);
+    return false;
+  }
 #endif // USE_SPI_LIB
+  sckRateID_ = sckRateID;
+  return true;
+}
+//------------------------------------------------------------------------------
+/** \return The SPI clock in Hz, zero if the driver does not tell. */
+uint32_t Sd2Card::sckHz(void) {
+  INT32U hz = 0;
+  INT32U length = sizeof(hz);
+  if (PJDF_IS_ERROR(Ioctl(hSD_, PJDF_CTRL_SD_GET_SCK_HZ, &hz, &length))) return 0;
+  return hz;
+}
+//------------------------------------------------------------------------------
+// Try clock rates from sckRateID down until SD_RAMP_BLOCKS blocks read with
+// a good CRC, skipping rates above what the card's speed mode allows. The
+// read rate of the accepted clock is kept for rampRate().
+uint8_t Sd2Card::rampSckRate(uint8_t sckRateID) {
+  uint32_t maxHz = highSpeed_ ? SD_HIGH_SPEED_HZ : SD_DEFAULT_SPEED_HZ;
+  for (; sckRateID < SPI_INIT_SPEED; sckRateID++) {
+    if (!setSckRate(sckRateID)) return false;
+    if (sckHz() > maxHz) continue;
+    uint16_t t0 = OSTimeGet();
+    uint8_t i;
+    for (i = 0; i < SD_RAMP_BLOCKS; i++) {
+      if (!readSingleBlock(i, 0)) break;
+    }
+    if (i < SD_RAMP_BLOCKS) continue;
+    uint16_t ticks = (uint16_t)OSTimeGet() - t0;
+    if (ticks == 0) ticks = 1;
+    rampRate_ = (uint32_t)SD_RAMP_BLOCKS * 512 * OS_TICKS_PER_SEC / ticks;
+    readErrors_ = 0;
+    return true;
+  }
+  error(SD_CARD_ERROR_SCK_RAMP);
+  return false;
+}
+//------------------------------------------------------------------------------
+// send CMD6 with arg and read the 64 byte switch status
+uint8_t Sd2Card::readSwitch(uint32_t arg, uint8_t* status) {
+  if (cardCommand(CMD6, arg)) {
+    chipSelectHigh();
+    return false;
+  }
+  // chip select is high already if this fails
+  if (!waitStartBlock()) return false;
+  uint32_t n = 64;
+  spiRecBuf(status, &n);
+  spiSkip(2);  // skip crc
+  chipSelectHigh();
   return true;
 }
 //------------------------------------------------------------------------------
+// Switch the card to high speed mode (function 1 of group 1), which allows
+// a clock up to SD_HIGH_SPEED_HZ. Cards before spec 1.10 do not know CMD6.
+// Returns true if the card now runs in high speed mode.
+uint8_t Sd2Card::switchHighSpeed(void) {
+  uint8_t status[64];
+  if (type() == SD_CARD_TYPE_SD1) return false;
+  // check mode, bit 401 is set if group 1 supports high speed
+  if (!readSwitch(0X00FFFFF1, status) || !(status[13] & 0X02)) return false;
+  // switch mode, bits 379:376 hold the function now selected in group 1
+  if (!readSwitch(0X80FFFFF1, status)) return false;
+  return (status[16] & 0X0F) == 1;
+}
+//------------------------------------------------------------------------------
 // wait for card to go not busy
 uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
   uint16_t t0 = OSTimeGet(); // use uCOS ticks?
+  uint16_t burst = 0;
   do {
-    if (spiRec() == 0XFF) 
+    for (uint8_t i = 0; i < SD_POLL_BURST; i++) {
+      if (spiRec() == 0XFF)
         return true;
+    }
+    waitYield(burst++);
   }
   while (((uint16_t)OSTimeGet() - t0) < timeoutMillis); // use uCOS ticks?
   return false;
 }
 //------------------------------------------------------------------------------
+// Let others run between two bursts of a wait for the card. The chip select
+// and the SPI bus are given up, so the decoder and the display get their
+// turn while the card is busy. A short wait takes the bus straight back,
+// a long one sleeps SD_YIELD_TICKS first so lower priority tasks run too.
+// The card keeps its state while deselected.
+void Sd2Card::waitYield(uint16_t burst) {
+  chipSelectHigh();
+  if (burst >= SD_SPIN_BURSTS) {
+    OSTimeDly(SD_YIELD_TICKS);
+    waitSleeps_++;
+    waitSleepTicks_ += SD_YIELD_TICKS;
+  }
+  chipSelectLow();
+}
+//------------------------------------------------------------------------------
 /** Wait for start block token */
 uint8_t Sd2Card::waitStartBlock(void) {
   uint16_t t0 = OSTimeGet(); // use uCOS ticks?
+  uint16_t burst = 0;
+  uint8_t polls = 0;
   while ((status_ = spiRec()) == 0XFF) { // use uCOS ticks?
+    if (++polls == SD_POLL_BURST) {
+      polls = 0;
+      waitYield(burst++);
+    }
     if (((uint16_t)OSTimeGet() - t0) > SD_READ_TIMEOUT) {
       error(SD_CARD_ERROR_READ_TIMEOUT);
       goto fail;
@@ -551,15 +918,16 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
 
 #else  // OPTIMIZE_HARDWARE_SPI
   spiSend(token);
-  for (uint16_t i = 0; i < 512; i++) {
-    spiSend(src[i]);
-  }
+  spiSendBuf(src, 512);
 #endif  // OPTIMIZE_HARDWARE_SPI
-  spiSend(0xff);  // dummy crc
-  spiSend(0xff);  // dummy crc
+  // the card only checks the CRC after CMD59, it is sent either way
+  uint16_t crc = crc16(src, 512, 0);
+  uint8_t crcBytes[2] = {(uint8_t)(crc >> 8), (uint8_t)crc};
+  spiSendBuf(crcBytes, sizeof(crcBytes));
 
   status_ = spiRec();
   if ((status_ & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
+    if ((status_ & DATA_RES_MASK) == DATA_RES_CRC_ERROR) writeCrcErrors_++;
     error(SD_CARD_ERROR_WRITE);
     chipSelectHigh();
     return false;
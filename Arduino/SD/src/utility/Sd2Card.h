@@ -25,12 +25,15 @@
  */
 #include <pjdf.h>
 #include "SdInfo.h"
+#include "SdBlockDevice.h"
 /** Set SCK to max rate of F_CPU/2. See Sd2Card::setSckRate(). */
 uint8_t const SPI_FULL_SPEED = 0;
 /** Set SCK rate to F_CPU/4. See Sd2Card::setSckRate(). */
 uint8_t const SPI_HALF_SPEED = 1;
 /** Set SCK rate to F_CPU/8. Sd2Card::setSckRate(). */
 uint8_t const SPI_QUARTER_SPEED = 2;
+/** Set SCK rate to F_CPU/256, below the 400 kHz allowed until init is done. */
+uint8_t const SPI_INIT_SPEED = 7;
 
 // Keep these values for now to pass build
 uint8_t const SD_CHIP_SELECT_PIN = 10;
@@ -45,6 +48,12 @@ uint8_t const SPI_SCK_PIN = 13;
 //------------------------------------------------------------------------------
 /** Protect block zero from write if nonzero */
 #define SD_PROTECT_BLOCK_ZERO 1
+/** Check the CRC of every whole block read if nonzero */
+#define SD_CHECK_READ_CRC 1
+/** Compute block CRCs with the STM32 CRC unit instead of a table if nonzero */
+#define SD_HW_CRC 1
+/** Have the card check command and write CRCs (CMD59) if nonzero */
+#define SD_CARD_CRC 1
 /** init timeout ms */
 uint16_t const SD_INIT_TIMEOUT = 2000;
 /** erase timeout ms */
@@ -53,6 +62,28 @@ uint16_t const SD_ERASE_TIMEOUT = 10000;
 uint16_t const SD_READ_TIMEOUT = 300;
 /** write time out ms */
 uint16_t const SD_WRITE_TIMEOUT = 600;
+/** timeout ms for the card to go not busy before a command */
+uint16_t const SD_COMMAND_TIMEOUT = 300;
+/** bytes polled with the SPI bus held before a wait gives it up once */
+uint8_t const SD_POLL_BURST = 64;
+/** bursts polled back to back before a wait sleeps between bursts */
+uint8_t const SD_SPIN_BURSTS = 8;
+/** ticks slept between bursts when the card stays busy, bounds the extra latency */
+uint8_t const SD_YIELD_TICKS = 1;
+/** retries of a block read that failed its CRC or timed out */
+uint8_t const SD_READ_RETRIES = 2;
+/** failed block reads in a row that make the clock one rate slower */
+uint8_t const SD_STEP_DOWN_ERRORS = 3;
+/** blocks that must read with a good CRC for init to accept a clock */
+uint8_t const SD_RAMP_BLOCKS = 64;
+/** fastest clock of a card in default speed mode */
+uint32_t const SD_DEFAULT_SPEED_HZ = 25000000;
+/** fastest clock of a card in high speed mode */
+uint32_t const SD_HIGH_SPEED_HZ = 50000000;
+/** bytes clocked in at once when polling for a response, token or busy */
+uint8_t const SD_POLL_BYTES = 8;
+/** bytes clocked in at once when skipping block data */
+uint8_t const SD_SKIP_BYTES = 64;
 //------------------------------------------------------------------------------
 // SD card errors
 /** timeout error for command CMD0 */
@@ -99,6 +130,14 @@ uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14;
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 /** incorrect rate selected */
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
+/** card did not accept a READ_MULTIPLE_BLOCKS command */
+uint8_t const SD_CARD_ERROR_CMD18 = 0X17;
+/** card did not accept a STOP_TRANSMISSION command */
+uint8_t const SD_CARD_ERROR_CMD12 = 0X18;
+/** block read with a bad CRC */
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X19;
+/** no clock rate read clean at init */
+uint8_t const SD_CARD_ERROR_SCK_RAMP = 0X1A;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -112,10 +151,14 @@ uint8_t const SD_CARD_TYPE_SDHC = 3;
  * \class Sd2Card
  * \brief Raw access to SD and SDHC flash memory cards.
  */
-class Sd2Card {
+class Sd2Card : public SdBlockDevice {
  public:
   /** Construct an instance of Sd2Card. */
- Sd2Card(void) : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0) {}
+ Sd2Card(void) : errorCode_(0), inBlock_(0), inMultiRead_(0),
+   partialBlockRead_(0), type_(0), rxIndex_(0), rxCount_(0),
+   waitSleeps_(0), waitSleepTicks_(0), sckRateID_(SPI_INIT_SPEED),
+   highSpeed_(0), readErrors_(0), sckStepDowns_(0), rampRate_(0),
+   cardCrc_(0), readCrcErrors_(0), readRetries_(0), writeCrcErrors_(0) {}
   uint32_t cardSize(void);
   uint8_t erase(uint32_t firstBlock, uint32_t lastBlock);
   uint8_t eraseSingleBlockEnable(void);
@@ -145,8 +188,18 @@ class Sd2Card {
   /** Returns the current value, true or false, for partial block read. */
   uint8_t partialBlockRead(void) const {return partialBlockRead_;}
   uint8_t readBlock(uint32_t block, uint8_t* dst);
+  uint8_t readBlocks(uint32_t block, uint8_t* dst, uint32_t count);
   uint8_t readData(uint32_t block,
           uint16_t offset, uint16_t count, uint8_t* dst);
+  uint8_t readData(uint8_t* dst);
+  uint8_t readStart(uint32_t blockNumber);
+  uint8_t readStop(void);
+  /**
+   * \return true if a multiple block read is open and the next block it
+   * returns is \a blockNumber. */
+  uint8_t readStreaming(uint32_t blockNumber) const {
+    return inMultiRead_ && blockNumber == multiBlock_;
+  }
   /**
    * Read a cards CID register. The CID contains card identification
    * information such as Manufacturer ID, Product name, Product serial
@@ -162,8 +215,35 @@ class Sd2Card {
   }
   void readEnd(void);
   uint8_t setSckRate(uint8_t sckRateID);
+  /** \return the SCK rate ID in use, see setSckRate() */
+  uint8_t sckRate(void) const {return sckRateID_;}
+  uint32_t sckHz(void);
+  /** \return true if the card was switched to high speed mode */
+  uint8_t highSpeed(void) const {return highSpeed_;}
+  /** \return bytes/s read when init picked the clock */
+  uint32_t rampRate(void) const {return rampRate_;}
+  /** \return times repeated read errors made the clock slower */
+  uint32_t sckStepDowns(void) const {return sckStepDowns_;}
+  /** \return true if the card checks command and write CRCs */
+  uint8_t cardCrc(void) const {return cardCrc_;}
+  /** \return blocks read with a bad CRC */
+  uint32_t readCrcErrors(void) const {return readCrcErrors_;}
+  /** \return block reads retried after a bad CRC or a timeout */
+  uint32_t readRetries(void) const {return readRetries_;}
+  /** \return blocks the card rejected for a bad CRC when written */
+  uint32_t writeCrcErrors(void) const {return writeCrcErrors_;}
+  /** Clear the CRC error and retry counters */
+  void clearCrcStats(void) {
+    readCrcErrors_ = readRetries_ = writeCrcErrors_ = 0;
+  }
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
+  /** \return number of times a wait for the card slept */
+  uint32_t waitSleeps(void) const {return waitSleeps_;}
+  /** \return ticks the waits for the card slept in total */
+  uint32_t waitSleepTicks(void) const {return waitSleepTicks_;}
+  /** Clear the wait counters */
+  void clearWaitStats(void) {waitSleeps_ = waitSleepTicks_ = 0;}
   uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
   uint8_t writeData(const uint8_t* src);
   uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
@@ -174,6 +254,7 @@ class Sd2Card {
   void spiSend(uint8_t b);
   uint8_t spiRec(void);
   void spiRecBuf(uint8_t *buf, uint32_t *len);
+  void spiSendBuf(const uint8_t *buf, uint32_t len);
  private:
   HANDLE hSD_;
 
@@ -181,10 +262,27 @@ class Sd2Card {
   uint8_t chipSelectPin_;
   uint8_t errorCode_;
   uint8_t inBlock_;
+  uint8_t inMultiRead_;
+  uint32_t multiBlock_;
   uint16_t offset_;
   uint8_t partialBlockRead_;
   uint8_t status_;
   uint8_t type_;
+  // bytes clocked in by the last poll and not consumed yet
+  uint8_t rxBuf_[SD_POLL_BYTES];
+  uint8_t rxIndex_;
+  uint8_t rxCount_;
+  uint32_t waitSleeps_;
+  uint32_t waitSleepTicks_;
+  uint8_t sckRateID_;
+  uint8_t highSpeed_;
+  uint8_t readErrors_;
+  uint32_t sckStepDowns_;
+  uint32_t rampRate_;
+  uint8_t cardCrc_;
+  uint32_t readCrcErrors_;
+  uint32_t readRetries_;
+  uint32_t writeCrcErrors_;
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
     cardCommand(CMD55, 0);
@@ -192,12 +290,20 @@ class Sd2Card {
   }
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
   void error(uint8_t code) {errorCode_ = code;}
+  void spiSkip(uint16_t count);
+  uint8_t rampSckRate(uint8_t sckRateID);
+  uint8_t readBlockChecked(uint32_t block, uint8_t* dst);
+  uint8_t readBlockData(uint8_t* dst);
   uint8_t readRegister(uint8_t cmd, void* buf);
+  uint8_t readSingleBlock(uint32_t block, uint8_t* dst);
+  uint8_t readSwitch(uint32_t arg, uint8_t* status);
+  uint8_t switchHighSpeed(void);
   uint8_t sendWriteCommand(uint32_t blockNumber, uint32_t eraseCount);
   void chipSelectHigh(void);
   void chipSelectLow(void);
   void type(uint8_t value) {type_ = value;}
   uint8_t waitNotBusy(uint16_t timeoutMillis);
+  void waitYield(uint16_t burst);
   uint8_t writeData(uint8_t token, const uint8_t* src);
   uint8_t waitStartBlock(void);
 };
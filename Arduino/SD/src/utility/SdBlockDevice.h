@@ -0,0 +1,58 @@
+/*
+    SdBlockDevice.h
+    Block device interface under SdVolume. Sd2Card is the implementation on
+    the board, Tools/sdimage has one over a FAT disk image on the host.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+#ifndef SdBlockDevice_h
+#define SdBlockDevice_h
+#include <stdint.h>
+//------------------------------------------------------------------------------
+/**
+ * \class SdBlockDevice
+ * \brief 512 byte blocks of a card or an image, as SdVolume and SdFile use them.
+ *
+ * All functions return the value one, true, for success and the value zero,
+ * false, for failure.
+ */
+class SdBlockDevice {
+ public:
+  virtual ~SdBlockDevice() {}
+  /** Read the 512 byte block \a block to \a dst. */
+  virtual uint8_t readBlock(uint32_t block, uint8_t* dst) = 0;
+  /**
+   * Read \a count bytes at \a offset of block \a block to \a dst, a whole
+   * block if \a count is 512.
+   */
+  virtual uint8_t readData(uint32_t block,
+          uint16_t offset, uint16_t count, uint8_t* dst) = 0;
+  /** Read \a count blocks starting at \a block to \a dst. */
+  virtual uint8_t readBlocks(uint32_t block, uint8_t* dst, uint32_t count) {
+    for (; count > 0; count--, block++, dst += 512) {
+      if (!readBlock(block, dst)) return false;
+    }
+    return true;
+  }
+  /**
+   * Start streaming blocks from \a block on, so the next readBlock() calls
+   * in sequence cost no command each. A device that cannot stream does
+   * nothing and returns true, readStreaming() then stays false.
+   */
+  virtual uint8_t readStart(uint32_t) {return true;}
+  /** \return true if a stream is open and returns \a block next. */
+  virtual uint8_t readStreaming(uint32_t) const {return false;}
+  /** Write the 512 byte block \a src to block \a block. */
+  virtual uint8_t writeBlock(uint32_t block, const uint8_t* src) = 0;
+  /** Write \a count blocks from \a src starting at block \a block. */
+  virtual uint8_t writeBlocks(uint32_t block, const uint8_t* src,
+          uint32_t count) {
+    for (; count > 0; count--, block++, src += 512) {
+      if (!writeBlock(block, src)) return false;
+    }
+    return true;
+  }
+};
+#endif  // SdBlockDevice_h
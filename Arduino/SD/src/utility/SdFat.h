@@ -26,9 +26,9 @@
 #ifdef __AVR__
 #include <avr/pgmspace.h>
 #endif
-#include "Sd2Card.h"
+#include <stddef.h>
+#include "SdBlockDevice.h"
 #include "FatStructs.h"
-#include "Print.h"
 //------------------------------------------------------------------------------
 /**
  * Allow use of deprecated functions if non-zero
@@ -129,6 +129,15 @@ static inline uint8_t FAT_SECOND(uint16_t fatTime) {
 uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
+/** Most FAT entries followed at once to find a contiguous cluster run */
+uint8_t const FAT_CONTIGUOUS_SCAN = 128;
+/** Blocks held by the volume's block cache, 512 bytes of RAM each */
+#define SD_CACHE_BLOCKS 4
+/** Cache blocks the FAT may keep pinned against data and directory blocks */
+#define SD_CACHE_FAT_PINS 1
+#if SD_CACHE_FAT_PINS >= SD_CACHE_BLOCKS
+#error SD_CACHE_FAT_PINS must leave unpinned cache blocks
+#endif  // SD_CACHE_FAT_PINS
 //------------------------------------------------------------------------------
 /**
  * \class SdFile
@@ -137,7 +146,8 @@ uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 class SdFile {
  public:
   /** Create an instance of SdFile. */
-  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED) {}
+  SdFile(void) : type_(FAT_FILE_TYPE_CLOSED), contigFirst_(0), contigLast_(0),
+    lastBlock_(0), runBlocks_(0) {}
   /**
    * writeError is set to true if an error occurs during a write().
    * Set writeError to false before calling print() and/or write() and check
@@ -241,6 +251,7 @@ class SdFile {
     return read(&b, 1) == 1 ? b : -1;
   }
   int16_t read(void* buf, uint16_t nbyte);
+  int16_t readSpan(uint8_t** span, uint16_t nbyte);
   int8_t readDir(dir_t* dir);
   static uint8_t remove(SdFile* dirFile, const char* fileName);
   uint8_t remove(void);
@@ -394,14 +405,20 @@ class SdFile {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+  uint32_t  contigFirst_;   // first cluster of a run found contiguous in FAT
+  uint32_t  contigLast_;    // last cluster of that run, zero if none
+  uint32_t  lastBlock_;     // file block of the last readAhead(), to spot sequential reads
+  uint8_t   runBlocks_;     // file blocks read in sequence before lastBlock_
 
   // private functions
   uint8_t addCluster(void);
   uint8_t addDirCluster(void);
   dir_t* cacheDirEntry(uint8_t action);
+  uint8_t curBlock(uint32_t* block);
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
   static uint8_t make83Name(const char* str, uint8_t* name);
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
+  uint8_t readAhead(uint32_t block);
   dir_t* readDirCache(void);
 };
 //==============================================================================
@@ -437,22 +454,31 @@ class SdVolume {
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    cacheInvalidate(cacheBlockNumber_);
+    return cacheBuffer_->data;
   }
+  /** \return block cache lookups that found the block cached */
+  static uint32_t cacheHits(void) {return cacheHits_;}
+  /** \return block cache lookups that read the block from the device */
+  static uint32_t cacheMisses(void) {return cacheMisses_;}
+  /** Clear the block cache counters */
+  static void cacheClearStats(void) {cacheHits_ = cacheMisses_ = 0;}
   /**
    * Initialize a FAT volume.  Try partition one first then try super
    * floppy format.
    *
-   * \param[in] dev The Sd2Card where the volume is located.
+   * \param[in] dev The block device, an Sd2Card on the board, where the
+   * volume is located.
    *
    * \return The value one, true, is returned for success and
    * the value zero, false, is returned for failure.  Reasons for
    * failure include not finding a valid partition, not finding a valid
    * FAT file system or an I/O error.
    */
-  uint8_t init(Sd2Card* dev) { return init(dev, 1) ? true : init(dev, 0);}
-  uint8_t init(Sd2Card* dev, uint8_t part);
+  uint8_t init(SdBlockDevice* dev) {
+    return init(dev, 1) ? true : init(dev, 0);
+  }
+  uint8_t init(SdBlockDevice* dev, uint8_t part);
 
   // inline functions that return volume info
   /** \return The volume's cluster size in blocks. */
@@ -476,16 +502,16 @@ class SdVolume {
   /** \return The logical block number for the start of the root directory
        on FAT16 volumes or the first cluster number on FAT32 volumes. */
   uint32_t rootDirStart(void) const {return rootDirStart_;}
-  /** return a pointer to the Sd2Card object for this volume */
-  static Sd2Card* sdCard(void) {return sdCard_;}
+  /** return a pointer to the block device of this volume */
+  static SdBlockDevice* device(void) {return device_;}
 //------------------------------------------------------------------------------
 #if ALLOW_DEPRECATED_FUNCTIONS
   // Deprecated functions  - suppress cpplint warnings with NOLINT comment
-  /** \deprecated Use: uint8_t SdVolume::init(Sd2Card* dev); */
-  uint8_t init(Sd2Card& dev) {return init(&dev);}  // NOLINT
+  /** \deprecated Use: uint8_t SdVolume::init(SdBlockDevice* dev); */
+  uint8_t init(SdBlockDevice& dev) {return init(&dev);}  // NOLINT
 
-  /** \deprecated Use: uint8_t SdVolume::init(Sd2Card* dev, uint8_t vol); */
-  uint8_t init(Sd2Card& dev, uint8_t part) {  // NOLINT
+  /** \deprecated Use: uint8_t SdVolume::init(SdBlockDevice* dev, uint8_t vol); */
+  uint8_t init(SdBlockDevice& dev, uint8_t part) {  // NOLINT
     return init(&dev, part);
   }
 #endif  // ALLOW_DEPRECATED_FUNCTIONS
@@ -499,11 +525,24 @@ class SdVolume {
   // value for action argument in cacheRawBlock to indicate cache dirty
   static uint8_t const CACHE_FOR_WRITE = 1;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
-  static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+  // one block of the cache
+  struct cacheEntry_t {
+    cache_t buf;         // block data
+    uint32_t block;      // logical number of the block in buf
+    uint32_t mirror;     // block number for mirror FAT, zero if none
+    uint32_t lastUse;    // cacheTick_ when last used, for LRU replacement
+    uint8_t valid;       // buf holds block
+    uint8_t dirty;       // cacheFlush() will write block if true
+    uint8_t pinned;      // FAT block kept against data and directory blocks
+  };
+  static cacheEntry_t cache_[SD_CACHE_BLOCKS];  // N-way LRU block cache
+  static cacheEntry_t* cacheCur_;     // entry of the last cached block
+  static cache_t* cacheBuffer_;       // data of the last cached block
+  static uint32_t cacheBlockNumber_;  // Logical number of the last cached block
+  static uint32_t cacheTick_;         // use counter for LRU
+  static uint32_t cacheHits_;
+  static uint32_t cacheMisses_;
+  static SdBlockDevice* device_;      // block device for cache
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
   uint8_t blocksPerCluster_;    // cluster size in blocks
@@ -524,9 +563,16 @@ class SdVolume {
            return dataStartBlock_ + ((cluster - 2) << clusterSizeShift_);}
   uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
+  static uint8_t cacheFatBlock(uint32_t blockNumber, uint8_t action);
+  static cacheEntry_t* cacheFind(uint32_t blockNumber);
   static uint8_t cacheFlush(void);
+  static void cacheInvalidate(uint32_t blockNumber);
+  static uint8_t cacheNewBlock(uint32_t blockNumber);
   static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+  static void cacheSetDirty(void) {cacheCur_->dirty |= CACHE_FOR_WRITE;}
+  static void cacheUse(cacheEntry_t* entry);
+  static cacheEntry_t* cacheVictim(void);
+  static uint8_t cacheWriteBack(cacheEntry_t* entry);
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
@@ -539,13 +585,19 @@ class SdVolume {
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
   uint8_t readBlock(uint32_t block, uint8_t* dst) {
-    return sdCard_->readBlock(block, dst);}
+    return device_->readBlock(block, dst);}
   uint8_t readData(uint32_t block, uint16_t offset,
     uint16_t count, uint8_t* dst) {
-      return sdCard_->readData(block, offset, count, dst);
+      return device_->readData(block, offset, count, dst);
+  }
+  uint8_t readStart(uint32_t block) {
+    return device_->readStart(block);
+  }
+  uint8_t readStreaming(uint32_t block) const {
+    return device_->readStreaming(block);
   }
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
-    return sdCard_->writeBlock(block, dst);
+    return device_->writeBlock(block, dst);
   }
 };
 #endif  // SdFat_h
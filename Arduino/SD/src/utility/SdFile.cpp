@@ -33,6 +33,9 @@ void (*SdFile::oldDateTime_)(uint16_t& date, uint16_t& time) = NULL;  // NOLINT
 // add a cluster to a file
 uint8_t SdFile::addCluster() {
   if (!vol_->allocContiguous(1, &curCluster_)) return false;
+  contigFirst_ = contigLast_ = 0;
+  lastBlock_ = 0;
+  runBlocks_ = 0;
 
   // if first cluster of file link to directory entry
   if (firstCluster_ == 0) {
@@ -61,7 +64,7 @@ uint8_t SdFile::addDirCluster(void) {
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
   if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  return SdVolume::cacheBuffer_->dir + dirIndex_;
 }
 //------------------------------------------------------------------------------
 /**
@@ -321,7 +324,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
   if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
 
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -333,7 +336,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
@@ -440,7 +443,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    p = SdVolume::cacheBuffer_->dir;
   }
   // initialize as empty file
   memset(p, 0, sizeof(dir_t));
@@ -508,7 +511,7 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = SdVolume::cacheBuffer_->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -538,6 +541,9 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  contigFirst_ = contigLast_ = 0;
+  lastBlock_ = 0;
+  runBlocks_ = 0;
 
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) return truncate(0);
@@ -577,6 +583,9 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  contigFirst_ = contigLast_ = 0;
+  lastBlock_ = 0;
+  runBlocks_ = 0;
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -678,36 +687,22 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   while (toRead > 0) {
     uint32_t block;  // raw device block number
     uint16_t offset = curPosition_ & 0X1FF;  // offset in block
-    if (type_ == FAT_FILE_TYPE_ROOT16) {
-      block = vol_->rootDirStart() + (curPosition_ >> 9);
-    } else {
-      uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
-      if (offset == 0 && blockOfCluster == 0) {
-        // start of new cluster
-        if (curPosition_ == 0) {
-          // use first cluster in file
-          curCluster_ = firstCluster_;
-        } else {
-          // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
-        }
-      }
-      block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
-    }
+    if (!curBlock(&block)) return -1;
     uint16_t n = toRead;
 
     // amount to be read from current block
     if (n > (512 - offset)) n = 512 - offset;
 
     // no buffering needed if n == 512 or user requests no buffering
-    if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
+    if ((unbufferedRead() || n == 512) && !SdVolume::cacheFind(block)) {
+      if (n == 512 && !readAhead(block)) return -1;
       if (!vol_->readData(block, offset, n, dst)) return -1;
       dst += n;
     } else {
       // read block to cache and copy data to caller
+      if (!SdVolume::cacheFind(block) && !readAhead(block)) return -1;
       if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
+      uint8_t* src = SdVolume::cacheBuffer_->data + offset;
       uint8_t* end = src + n;
       while (src != end) *dst++ = *src++;
     }
@@ -717,6 +712,113 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
   return nbyte;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read data from a file without copying it.
+ *
+ * The block holding the current position is brought into the volume cache
+ * and \a span is set to point at the data inside the cache, so a streaming
+ * caller can hand it straight to a device driver.
+ *
+ * \param[out] span Set to the location of the data in the block cache.
+ * The span is only valid until the next read or write on the volume.
+ *
+ * \param[in] nbyte Maximum number of bytes wanted.
+ *
+ * \return The number of bytes at \a span. The span never crosses a 512
+ * byte block boundary so it may be shorter than \a nbyte. Zero is
+ * returned at end of file and -1 if an error occurs.
+ */
+int16_t SdFile::readSpan(uint8_t** span, uint16_t nbyte) {
+  // error if not open or write only
+  if (!isOpen() || !(flags_ & O_READ)) return -1;
+
+  // max bytes left in file
+  if (nbyte > (fileSize_ - curPosition_)) nbyte = fileSize_ - curPosition_;
+  if (nbyte == 0) return 0;
+
+  uint32_t block;  // raw device block number
+  uint16_t offset = curPosition_ & 0X1FF;  // offset in block
+  if (!curBlock(&block)) return -1;
+
+  // amount available in current block
+  if (nbyte > (512 - offset)) nbyte = 512 - offset;
+
+  if (!SdVolume::cacheFind(block) && !readAhead(block)) return -1;
+  if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
+  *span = SdVolume::cacheBuffer_->data + offset;
+
+  curPosition_ += nbyte;
+  return nbyte;
+}
+//------------------------------------------------------------------------------
+// raw device block holding curPosition_, follows the FAT chain on a
+// cluster boundary
+uint8_t SdFile::curBlock(uint32_t* block) {
+  if (type_ == FAT_FILE_TYPE_ROOT16) {
+    *block = vol_->rootDirStart() + (curPosition_ >> 9);
+    return true;
+  }
+  uint8_t blockOfCluster = vol_->blockOfCluster(curPosition_);
+  if ((curPosition_ & 0X1FF) == 0 && blockOfCluster == 0) {
+    // start of new cluster
+    if (curPosition_ == 0) {
+      // use first cluster in file
+      curCluster_ = firstCluster_;
+    } else if (contigFirst_ <= curCluster_ && curCluster_ < contigLast_) {
+      // inside a run readAhead() found contiguous, no FAT read
+      curCluster_++;
+    } else {
+      // get next cluster from FAT
+      if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+    }
+  }
+  *block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+  return true;
+}
+//------------------------------------------------------------------------------
+// Start a multiple block read at block, the raw device block holding
+// curPosition_, if the file goes on in the next block on the card.
+// Sequential reads then cost one CMD18 per contiguous run instead of a
+// CMD17 per block. Returns false only for an I/O error.
+uint8_t SdFile::readAhead(uint32_t block) {
+  uint32_t last = lastBlock_;
+  lastBlock_ = curPosition_ >> 9;
+
+  // already the next block of the open multiple block read
+  if (vol_->readStreaming(block)) return true;
+
+  // a read after a seek mostly ends within a block or two, stream only
+  // once a second read in a row follows on the next block
+  if (lastBlock_ != last + 1) {
+    runBlocks_ = 0;
+    return true;
+  }
+  if (runBlocks_ < 1) {
+    runBlocks_++;
+    return true;
+  }
+
+  // nothing to stream past the last block of the file
+  if (!isFile() || (fileSize_ - (curPosition_ & ~0X1FFUL)) <= 512) return true;
+
+  if (vol_->blockOfCluster(curPosition_) == (vol_->blocksPerCluster() - 1)
+    && (curCluster_ < contigFirst_ || curCluster_ >= contigLast_)) {
+    // last block of the cluster, follow the chain for a contiguous run
+    uint32_t next;
+    contigFirst_ = contigLast_ = curCluster_;
+    for (uint8_t i = 0; i < FAT_CONTIGUOUS_SCAN; i++) {
+      if (!vol_->fatGet(contigLast_, &next)) return false;
+      if (next != (contigLast_ + 1)) break;
+      contigLast_ = next;
+    }
+    // next cluster is elsewhere on the card
+    if (contigLast_ == curCluster_) return true;
+  }
+  // write a dirty cache block now so it does not stop the read right away
+  if (!SdVolume::cacheFlush()) return false;
+  return vol_->readStart(block);
+}
+//------------------------------------------------------------------------------
 /**
  * Read the next directory entry from a directory file.
  *
@@ -761,7 +863,7 @@ dir_t* SdFile::readDirCache(void) {
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (SdVolume::cacheBuffer_->dir + i);
 }
 //------------------------------------------------------------------------------
 /**
@@ -1084,6 +1186,9 @@ uint8_t SdFile::truncate(uint32_t length) {
 
   // position to last cluster in truncated file
   if (!seekSet(length)) return false;
+  contigFirst_ = contigLast_ = 0;
+  lastBlock_ = 0;
+  runBlocks_ = 0;
 
   if (length == 0) {
     // free all clusters
@@ -1177,24 +1282,20 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
     if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
+      SdVolume::cacheInvalidate(block);
       if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
       src += 512;
     } else {
       if (blockOffset == 0 && curPosition_ >= fileSize_) {
         // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
+        if (!SdVolume::cacheNewBlock(block)) goto writeErrorReturn;
       } else {
         // rewrite part of block
         if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
           goto writeErrorReturn;
         }
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = SdVolume::cacheBuffer_->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) *dst++ = *src++;
     }
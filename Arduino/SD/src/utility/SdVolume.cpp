@@ -19,13 +19,17 @@
  */
 #include "SdFat.h"
 //------------------------------------------------------------------------------
-// raw block cache
+// raw block cache, SD_CACHE_BLOCKS entries replaced least recently used
+// first. Entries start invalid, the last cached entry starts as the first.
+SdVolume::cacheEntry_t SdVolume::cache_[SD_CACHE_BLOCKS];
+SdVolume::cacheEntry_t* SdVolume::cacheCur_ = &SdVolume::cache_[0];
+cache_t* SdVolume::cacheBuffer_ = &SdVolume::cache_[0].buf;
 // init cacheBlockNumber_to invalid SD block number
 uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
-Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
+uint32_t SdVolume::cacheTick_ = 0;
+uint32_t SdVolume::cacheHits_ = 0;
+uint32_t SdVolume::cacheMisses_ = 0;
+SdBlockDevice* SdVolume::device_;    // pointer to block device object
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
 uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
@@ -96,43 +100,131 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   return true;
 }
 //------------------------------------------------------------------------------
+// cache a FAT block, pinned so that data and directory blocks do not push
+// it out. The SD_CACHE_FAT_PINS most recent FAT blocks stay pinned.
+uint8_t SdVolume::cacheFatBlock(uint32_t blockNumber, uint8_t action) {
+  if (!cacheRawBlock(blockNumber, action)) return false;
+  if (SD_CACHE_FAT_PINS == 0 || cacheCur_->pinned) return true;
+  cacheEntry_t* oldest = 0;
+  uint8_t pins = 0;
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    cacheEntry_t* e = &cache_[i];
+    if (!e->pinned) continue;
+    pins++;
+    if (!oldest || e->lastUse < oldest->lastUse) oldest = e;
+  }
+  if (pins >= SD_CACHE_FAT_PINS) oldest->pinned = 0;
+  cacheCur_->pinned = 1;
+  return true;
+}
+//------------------------------------------------------------------------------
+// return the entry holding blockNumber or null if it is not cached
+SdVolume::cacheEntry_t* SdVolume::cacheFind(uint32_t blockNumber) {
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (cache_[i].valid && cache_[i].block == blockNumber) return &cache_[i];
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// write all dirty blocks
 uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (!cacheWriteBack(&cache_[i])) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// drop blockNumber from the cache without writing it, for a block written
+// around the cache
+void SdVolume::cacheInvalidate(uint32_t blockNumber) {
+  cacheEntry_t* e = cacheFind(blockNumber);
+  if (!e) return;
+  e->valid = e->dirty = e->pinned = 0;
+  e->mirror = 0;
+  if (e == cacheCur_) cacheBlockNumber_ = 0XFFFFFFFF;
+}
+//------------------------------------------------------------------------------
+// cache blockNumber for write without reading it, its data is undefined
+uint8_t SdVolume::cacheNewBlock(uint32_t blockNumber) {
+  cacheEntry_t* e = cacheFind(blockNumber);
+  if (!e) {
+    e = cacheVictim();
+    if (!cacheWriteBack(e)) return false;
+    e->block = blockNumber;
+    e->valid = 1;
+    e->pinned = 0;
+  }
+  e->dirty = CACHE_FOR_WRITE;
+  cacheUse(e);
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
+  cacheEntry_t* e = cacheFind(blockNumber);
+  if (e) {
+    cacheHits_++;
+  } else {
+    cacheMisses_++;
+    e = cacheVictim();
+    if (!cacheWriteBack(e)) return false;
+    e->valid = e->pinned = 0;
+    cacheUse(e);
+    if (!device_->readBlock(blockNumber, e->buf.data)) return false;
+    e->block = blockNumber;
+    e->valid = 1;
+  }
+  e->dirty |= action;
+  cacheUse(e);
+  return true;
+}
+//------------------------------------------------------------------------------
+// make entry the last cached block
+void SdVolume::cacheUse(cacheEntry_t* entry) {
+  entry->lastUse = ++cacheTick_;
+  cacheCur_ = entry;
+  cacheBuffer_ = &entry->buf;
+  cacheBlockNumber_ = entry->valid ? entry->block : 0XFFFFFFFF;
+}
+//------------------------------------------------------------------------------
+// return the entry to replace: an invalid one, else the least recently
+// used unpinned one
+SdVolume::cacheEntry_t* SdVolume::cacheVictim(void) {
+  cacheEntry_t* victim = 0;
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    cacheEntry_t* e = &cache_[i];
+    if (!e->valid) return e;
+    if (e->pinned) continue;
+    if (!victim || e->lastUse < victim->lastUse) victim = e;
+  }
+  return victim;
+}
+//------------------------------------------------------------------------------
+// write entry if it is dirty, with its mirror FAT block
+uint8_t SdVolume::cacheWriteBack(cacheEntry_t* entry) {
+  if (entry->valid && entry->dirty) {
+    if (!device_->writeBlock(entry->block, entry->buf.data)) {
       return false;
     }
     // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
+    if (entry->mirror) {
+      if (!device_->writeBlock(entry->mirror, entry->buf.data)) {
         return false;
       }
-      cacheMirrorBlock_ = 0;
+      entry->mirror = 0;
     }
-    cacheDirty_ = 0;
+    entry->dirty = 0;
   }
   return true;
 }
 //------------------------------------------------------------------------------
-uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
-  }
-  cacheDirty_ |= action;
-  return true;
-}
-//------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
+  if (!cacheNewBlock(blockNumber)) return false;
 
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  // loop take less flash than memset(cacheBuffer_->data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+    cacheBuffer_->data[i] = 0;
   }
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
@@ -152,13 +244,11 @@ uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheFatBlock(lba, CACHE_FOR_READ)) return false;
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = cacheBuffer_->fat16[cluster & 0XFF];
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    *value = cacheBuffer_->fat32[cluster & 0X7F] & FAT32MASK;
   }
   return true;
 }
@@ -175,19 +265,17 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheFatBlock(lba, CACHE_FOR_READ)) return false;
   // store entry
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    cacheBuffer_->fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    cacheBuffer_->fat32[cluster & 0X7F] = value;
   }
   cacheSetDirty();
 
   // mirror second FAT
-  if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
+  if (fatCount_ > 1) cacheCur_->mirror = lba + blocksPerFat_;
   return true;
 }
 //------------------------------------------------------------------------------
@@ -212,7 +300,7 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
 /**
  * Initialize a FAT volume.
  *
- * \param[in] dev The SD card where the volume is located.
+ * \param[in] dev The block device where the volume is located.
  *
  * \param[in] part The partition to be used.  Legal values for \a part are
  * 1-4 to use the corresponding partition on a device formatted with
@@ -224,15 +312,15 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
  * failure include not finding a valid partition, not finding a valid
  * FAT file system in the specified partition or an I/O error.
  */
-uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
+uint8_t SdVolume::init(SdBlockDevice* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
-  sdCard_ = dev;
+  device_ = dev;
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheBuffer_->mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -242,7 +330,7 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     volumeStartBlock = p->firstSector;
   }
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  bpb_t* bpb = &cacheBuffer_->fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
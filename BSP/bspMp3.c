@@ -20,6 +20,8 @@ const INT8U BspMp3SetClockF[] = { 0x02, 0x03, 0x98, 0x00 };
 //const INT8U BspMp3SetVol1010[] = { 0x02, 0x0B, 0x10, 0x10 };
 //const INT8U BspMp3SetVol6060[] = { 0x02, 0x0B, 0x60, 0x60 };
 const INT8U BspMp3ReadVol[] = { 0x3, 0x0B, 0x00, 0x00 };
+const INT8U BspMp3SetEndFillAddr[] = { 0x02, 0x07, 0x1E, 0x06 };   // WRAMADDR = endFillByte
+const INT8U BspMp3ReadWram[] = { 0x03, 0x06, 0x00, 0x00 };
 
 //Definition of a Volume Range (Min to Max) going down by 1/10th
 const INT8U BspMp3SetVolRange[MP3_VOLUME_RANGE][DATA_FRAME] = {
@@ -49,6 +51,8 @@ const INT8U BspMp3SetClockFLen = sizeof(BspMp3SetClockF);
 //const INT8U BspMp3SetVol1010Len = sizeof(BspMp3SetVol1010);
 const INT8U BspMp3SetVolLen = sizeof(BspMp3SetVolRange[0]);
 const INT8U BspMp3ReadVolLen = sizeof(BspMp3ReadVol);
+const INT8U BspMp3SetEndFillAddrLen = sizeof(BspMp3SetEndFillAddr);
+const INT8U BspMp3ReadWramLen = sizeof(BspMp3ReadWram);
 
 
 
@@ -91,4 +95,48 @@ void BspMp3InitVS1053()
     GPIO_InitStruct.Pull = LL_GPIO_PULL_DOWN;
      
     LL_GPIO_Init(MP3_VS1053_DREQ_GPIO, &GPIO_InitStruct);
+}
+
+// Semaphore posted on every rising edge of DREQ
+static OS_EVENT *mp3DreqSem = 0;
+
+// Routes DREQ (PB0) to EXTI line 0 and interrupts on its rising edge, i.e.
+// whenever the VS1053 becomes ready to accept another 32 bytes.
+// dreqSem: semaphore posted from the interrupt
+void BspMp3DreqIntInit(OS_EVENT *dreqSem)
+{
+    LL_EXTI_InitTypeDef EXTI_InitStruct;
+    
+    mp3DreqSem = dreqSem;
+    
+    LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_SYSCFG);
+    LL_SYSCFG_SetEXTISource(MP3_VS1053_DREQ_EXTI_PORT, MP3_VS1053_DREQ_EXTI_SYSCFG_LINE);
+    
+    EXTI_InitStruct.Line_0_31 = MP3_VS1053_DREQ_EXTI_LINE;
+    EXTI_InitStruct.Line_32_63 = LL_EXTI_LINE_NONE;
+    EXTI_InitStruct.LineCommand = ENABLE;
+    EXTI_InitStruct.Mode = LL_EXTI_MODE_IT;
+    EXTI_InitStruct.Trigger = LL_EXTI_TRIGGER_RISING;
+    LL_EXTI_Init(&EXTI_InitStruct);
+    
+    NVIC_SetPriority(MP3_VS1053_DREQ_IRQn, MP3_VS1053_DREQ_IRQ_PRIO);
+    NVIC_EnableIRQ(MP3_VS1053_DREQ_IRQn);
+}
+
+// DREQ rising edge interrupt
+void EXTI0_IRQHandler(void)
+{
+    OS_CPU_SR  cpu_sr;
+    
+    OS_ENTER_CRITICAL();    // Tell uC/OS-II that we are starting an ISR
+    OSIntNesting++;
+    OS_EXIT_CRITICAL();
+    
+    if (LL_EXTI_IsActiveFlag_0_31(MP3_VS1053_DREQ_EXTI_LINE))
+    {
+        LL_EXTI_ClearFlag_0_31(MP3_VS1053_DREQ_EXTI_LINE);
+        if (mp3DreqSem != 0) OSSemPost(mp3DreqSem);
+    }
+    
+    OSIntExit();            // Tell uC/OS-II that we are leaving the ISR
 }
\ No newline at end of file
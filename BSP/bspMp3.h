@@ -22,6 +22,18 @@
 #define MP3_VS1053_DREQ_GPIO               GPIOB
 #define MP3_VS1053_DREQ_GPIO_Pin           LL_GPIO_PIN_0
 
+// DREQ rising edge interrupt on EXTI line 0
+#define MP3_VS1053_DREQ_EXTI_PORT          LL_SYSCFG_EXTI_PORTB
+#define MP3_VS1053_DREQ_EXTI_SYSCFG_LINE   LL_SYSCFG_EXTI_LINE0
+#define MP3_VS1053_DREQ_EXTI_LINE          LL_EXTI_LINE_0
+#define MP3_VS1053_DREQ_IRQn               EXTI0_IRQn
+#define MP3_VS1053_DREQ_IRQ_PRIO           5
+
+#define MP3_VS1053_DREQ_IS_SET()      LL_GPIO_IsInputPinSet(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin)
+
+// Longest wait for a DREQ edge before the pin is polled again, in case an edge was missed
+#define MP3_DREQ_TIMEOUT_TICKS     5
+
 #define MP3_VS1053_MCS_ASSERT()       LL_GPIO_ResetOutputPin(MP3_VS1053_MCS_GPIO, MP3_VS1053_MCS_GPIO_Pin);
 #define MP3_VS1053_MCS_DEASSERT()      LL_GPIO_SetOutputPin(MP3_VS1053_MCS_GPIO, MP3_VS1053_MCS_GPIO_Pin);
 
@@ -39,6 +51,26 @@
 #define MP3_VOLUME_RANGE           14
 #define DATA_FRAME                 4
 
+// SCI command frame: { opcode, register, value high byte, value low byte }
+#define MP3_SCI_WRITE              0x02
+#define MP3_SCI_READ               0x03
+
+// SCI registers
+#define MP3_SCI_MODE               0x00
+#define MP3_SCI_STATUS             0x01
+#define MP3_SCI_BASS               0x02
+#define MP3_SCI_CLOCKF             0x03
+#define MP3_SCI_DECODE_TIME        0x04  // decoded seconds of the current stream
+#define MP3_SCI_AUDATA             0x05
+#define MP3_SCI_WRAM               0x06
+#define MP3_SCI_WRAMADDR           0x07
+#define MP3_SCI_HDAT0              0x08  // MP3: last frame header, bytes 2 and 3
+#define MP3_SCI_HDAT1              0x09  // MP3: last frame header, bytes 0 and 1
+#define MP3_SCI_VOL                0x0B
+
+// Extra parameters in X memory, accessed through SCI_WRAMADDR/SCI_WRAM
+#define MP3_PARAM_PLAY_SPEED       0x1E04  // 0, 1: normal speed, n: n times faster
+
 // some command strings to send to the VS1053 MP3 decoder:
 extern const INT8U BspMp3SineWave[];
 extern const INT8U BspMp3Deact[];
@@ -50,6 +82,8 @@ extern const INT8U BspMp3SetClockF[];
 //extern const INT8U BspMp3SetVol6060[];
 extern const INT8U BspMp3SetVolRange[MP3_VOLUME_RANGE][DATA_FRAME];
 extern const INT8U BspMp3ReadVol[];
+extern const INT8U BspMp3SetEndFillAddr[];
+extern const INT8U BspMp3ReadWram[];
 
 // Lengths of the above commands
 extern const INT8U BspMp3SineWaveLen;
@@ -62,8 +96,11 @@ extern const INT8U BspMp3SetClockFLen;
 //extern const INT8U BspMp3SetVol6060Len;
 extern const INT8U BspMp3SetVolLen;
 extern const INT8U BspMp3ReadVolLen;
+extern const INT8U BspMp3SetEndFillAddrLen;
+extern const INT8U BspMp3ReadWramLen;
 
 
 void BspMp3InitVS1053();
+void BspMp3DreqIntInit(OS_EVENT *dreqSem);
 
 #endif
\ No newline at end of file
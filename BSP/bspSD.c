@@ -28,4 +28,36 @@ void BspSDInitAdafruit()
      
     LL_GPIO_Init(SD_ADAFRUIT_CS_GPIO, &GPIO_InitStruct);
     SD_ADAFRUIT_CS_DEASSERT();
+
+    /*-------- CRC unit for the data block CRC16 --------*/
+
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+    CRC->CR = CRC_CR_POLYSIZE_0;    // 16 bit polynomial, no bit reversal
+    CRC->POL = 0x1021;
+}
+
+
+// BspSDCrc16
+// CRC16-CCITT of a buffer as the card sends it after each data block,
+// computed by the CRC unit a word at a time.
+// data: the bytes to check, any alignment
+// len: number of bytes
+// crc: CRC of the bytes before data, 0 to start
+// Returns: the CRC of data continued from crc
+uint16_t BspSDCrc16(const uint8_t *data, uint32_t len, uint16_t crc)
+{
+    uint32_t word;
+
+    CRC->INIT = crc;
+    CRC->CR |= CRC_CR_RESET;
+    for (; len >= 4; len -= 4, data += 4)
+    {
+        memcpy(&word, data, 4);
+        CRC->DR = __REV(word);    // first byte in the top bits goes in first
+    }
+    while (len--)
+    {
+        *(__IO uint8_t *)&CRC->DR = *data++;
+    }
+    return (uint16_t)CRC->DR;
 }
\ No newline at end of file
@@ -25,9 +25,11 @@
 
 #define SD_SPI_DEVICE_ID  PJDF_DEVICE_ID_SPI1
 
+// Data rate the SD driver starts with, Sd2Card::init() then picks the clock per card
 //#define SD_SPI_DATARATE  LL_SPI_BAUDRATEPRESCALER_DIV2  // Tune to find optimal value SD controller will work with. OK with 16mhz HCLK
 #define SD_SPI_DATARATE  LL_SPI_BAUDRATEPRESCALER_DIV4  // Tune to find optimal value SD controller will work with. OK with 80MHz HCLK
 
 void BspSDInitAdafruit();
+uint16_t BspSDCrc16(const uint8_t *data, uint32_t len, uint16_t crc);
 
 #endif
\ No newline at end of file
@@ -10,6 +10,12 @@
 
 #include "bsp.h"
 
+// Semaphore posted when a SPI1 DMA transfer completes
+static OS_EVENT *spi1DmaSem = 0;
+
+// Receive sink for write-only DMA transfers
+static uint8_t spi1DmaDummy;
+
 // BspSPI1Init
 // Initializes the SPI1 memory mapped register block and enables it for use
 // as a master SPI device.
@@ -49,17 +55,61 @@ void BspSPI1Init()
 }
 
 
+// SPI_WaitTxDone
+// Waits until the last frame has left the shift register, then throws away
+// whatever the device clocked back. The RX FIFO holds only 4 bytes so a
+// write-only transfer overruns it; the overrun flag is cleared here so the
+// next full duplex transfer starts clean.
+static void SPI_WaitTxDone(SPI_TypeDef *spi)
+{
+    while (LL_SPI_GetTxFIFOLevel(spi) != LL_SPI_TX_FIFO_EMPTY);
+    while (LL_SPI_IsActiveFlag_BSY(spi));
+    while (LL_SPI_GetRxFIFOLevel(spi) != LL_SPI_RX_FIFO_EMPTY) LL_SPI_ReceiveData8(spi);
+    LL_SPI_ClearFlag_OVR(spi);
+}
+
 // SPI_SendBuffer
-// Sends the given data to the given SPI device
+// Sends the given data to the given SPI device. Write only: the TX FIFO is
+// kept full and nothing is read back until the end, so frames go out back to
+// back instead of waiting a byte time for each RXNE. Two bytes are written
+// per access; with 8 bit frames the SPI unpacks them, low byte first.
 void SPI_SendBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength)
-{    
-    for (int i = 0; i < bufLength; i++) {
-        while(!LL_SPI_IsActiveFlag_TXE(spi)); 
+{
+    int i = 0;
+
+    // TXE means at least half of the 32 bit FIFO is free
+    for (; i + 1 < bufLength; i += 2) {
+        while(!LL_SPI_IsActiveFlag_TXE(spi));
+        LL_SPI_TransmitData16(spi, (uint16_t)(buffer[i] | (buffer[i + 1] << 8)));
+    }
+    if (i < bufLength) {
+        while(!LL_SPI_IsActiveFlag_TXE(spi));
         LL_SPI_TransmitData8(spi, buffer[i]);
-        while(!LL_SPI_IsActiveFlag_RXNE(spi));
-        LL_SPI_ReceiveData8(spi);
     }
- }
+    SPI_WaitTxDone(spi);
+}
+
+// SPI_SendRepeat16
+// Sends the same 16 bit value count times using 16 bit frames, most
+// significant byte first. Used for RGB565 fills: one FIFO access per pixel
+// and no buffer to prepare. The SPI is back in 8 bit mode on return.
+void SPI_SendRepeat16(SPI_TypeDef *spi, uint16_t value, uint32_t count)
+{
+    // The frame size may only change while the SPI is disabled
+    LL_SPI_Disable(spi);
+    LL_SPI_SetDataWidth(spi, LL_SPI_DATAWIDTH_16BIT);
+    LL_SPI_Enable(spi);
+
+    while (count-- > 0) {
+        while(!LL_SPI_IsActiveFlag_TXE(spi));
+        LL_SPI_TransmitData16(spi, value);
+    }
+    SPI_WaitTxDone(spi);
+
+    LL_SPI_Disable(spi);
+    LL_SPI_SetDataWidth(spi, LL_SPI_DATAWIDTH_8BIT);
+    LL_SPI_Enable(spi);
+}
 
 // SPI_GetBuffer
 // Sends the given data to the given SPI device.
@@ -85,3 +135,90 @@ void SPI_SetDataRate(SPI_TypeDef *spi, uint16_t value)
   LL_SPI_SetBaudRatePrescaler(spi, value);
 }
 
+
+// BspSPI1DmaInit
+// Routes SPI1 RX/TX to DMA1 channels 2/3 and enables the transfer complete
+// interrupt. Transfers are started with SPI_DmaStart().
+// doneSem: semaphore posted from the interrupt when a transfer completes
+void BspSPI1DmaInit(OS_EVENT *doneSem)
+{
+    spi1DmaSem = doneSem;
+    
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+    
+    // Request 1 on channel 2 is SPI1_RX, on channel 3 SPI1_TX
+    MODIFY_REG(DMA1_CSELR->CSELR, DMA_CSELR_C2S | DMA_CSELR_C3S,
+               (SPI1_DMA_REQUEST << DMA_CSELR_C2S_Pos) | (SPI1_DMA_REQUEST << DMA_CSELR_C3S_Pos));
+    
+    SPI1_DMA_RX_CHANNEL->CCR = 0;
+    SPI1_DMA_TX_CHANNEL->CCR = 0;
+    SPI1_DMA_RX_CHANNEL->CPAR = (uint32_t)&SPI1->DR;
+    SPI1_DMA_TX_CHANNEL->CPAR = (uint32_t)&SPI1->DR;
+    
+    NVIC_SetPriority(SPI1_DMA_RX_IRQn, SPI1_DMA_IRQ_PRIO);
+    NVIC_EnableIRQ(SPI1_DMA_RX_IRQn);
+}
+
+// SPI_DmaStart
+// Starts a full duplex DMA transfer on SPI1 and returns immediately. The
+// transfer is complete when the semaphore given to BspSPI1DmaInit() is posted.
+// txBuffer: data to send
+// rxBuffer: receives the device output, may equal txBuffer. If NULL the
+//    received data is discarded.
+// bufLength: number of bytes, 1..65535
+void SPI_DmaStart(SPI_TypeDef *spi, uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t bufLength)
+{
+    if (spi != SPI1) while(1); // only SPI1 has DMA channels assigned
+    
+    // Discard anything left in the RX FIFO
+    while (LL_SPI_IsActiveFlag_RXNE(spi)) LL_SPI_ReceiveData8(spi);
+    
+    DMA1->IFCR = SPI1_DMA_RX_IFCR | SPI1_DMA_TX_IFCR;
+    
+    // RX channel: peripheral to memory, completion interrupt ends the transfer
+    SPI1_DMA_RX_CHANNEL->CNDTR = bufLength;
+    if (rxBuffer != NULL)
+    {
+        SPI1_DMA_RX_CHANNEL->CMAR = (uint32_t)rxBuffer;
+        SPI1_DMA_RX_CHANNEL->CCR = DMA_CCR_MINC | DMA_CCR_PL_1 | DMA_CCR_TCIE | DMA_CCR_TEIE;
+    }
+    else
+    {
+        SPI1_DMA_RX_CHANNEL->CMAR = (uint32_t)&spi1DmaDummy;
+        SPI1_DMA_RX_CHANNEL->CCR = DMA_CCR_PL_1 | DMA_CCR_TCIE | DMA_CCR_TEIE;
+    }
+    
+    // TX channel: memory to peripheral
+    SPI1_DMA_TX_CHANNEL->CNDTR = bufLength;
+    SPI1_DMA_TX_CHANNEL->CMAR = (uint32_t)txBuffer;
+    SPI1_DMA_TX_CHANNEL->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_PL_1;
+    
+    // Enable order from the reference manual: RX request, channels, TX request
+    SET_BIT(spi->CR2, SPI_CR2_RXDMAEN);
+    SET_BIT(SPI1_DMA_RX_CHANNEL->CCR, DMA_CCR_EN);
+    SET_BIT(SPI1_DMA_TX_CHANNEL->CCR, DMA_CCR_EN);
+    SET_BIT(spi->CR2, SPI_CR2_TXDMAEN);
+}
+
+// SPI1 RX DMA interrupt, the last received byte completes the transfer
+void DMA1_Channel2_IRQHandler(void)
+{
+    OS_CPU_SR  cpu_sr;
+    
+    OS_ENTER_CRITICAL();    // Tell uC/OS-II that we are starting an ISR
+    OSIntNesting++;
+    OS_EXIT_CRITICAL();
+    
+    if (DMA1->ISR & (DMA_ISR_TCIF2 | DMA_ISR_TEIF2))
+    {
+        DMA1->IFCR = SPI1_DMA_RX_IFCR;
+        
+        CLEAR_BIT(SPI1_DMA_TX_CHANNEL->CCR, DMA_CCR_EN);
+        CLEAR_BIT(SPI1_DMA_RX_CHANNEL->CCR, DMA_CCR_EN);
+        CLEAR_BIT(SPI1->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+        
+        if (spi1DmaSem != 0) OSSemPost(spi1DmaSem);
+    }
+    
+    OSIntExit();            // Tell uC/OS-II that we are leaving the ISR
+}
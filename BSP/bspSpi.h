@@ -15,11 +15,28 @@
 
 #define PJDF_SPI1 SPI1 // Address of SPI1 memory mapped register block
 
+// DMA1 channels serving SPI1
+#define SPI1_DMA_REQUEST        1
+#define SPI1_DMA_RX_CHANNEL     DMA1_Channel2
+#define SPI1_DMA_TX_CHANNEL     DMA1_Channel3
+#define SPI1_DMA_RX_IFCR        DMA_IFCR_CGIF2
+#define SPI1_DMA_TX_IFCR        DMA_IFCR_CGIF3
+#define SPI1_DMA_RX_IRQn        DMA1_Channel2_IRQn
+#define SPI1_DMA_IRQ_PRIO       4
+
+// Transfers at least this long go through DMA, shorter ones are polled
+#define SPI_DMA_MIN_LENGTH      16
+#define SPI_DMA_MAX_LENGTH      0xFFFF
+
 // Application interface to hardware
 
 void BspSPI1Init();
 void SPI_SendBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength);
 void SPI_GetBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength);
+void SPI_SendRepeat16(SPI_TypeDef *spi, uint16_t value, uint32_t count);
 void SPI_SetDataRate(SPI_TypeDef *spi, uint16_t value);
 
+void BspSPI1DmaInit(OS_EVENT *doneSem);
+void SPI_DmaStart(SPI_TypeDef *spi, uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t bufLength);
+
 #endif /* __SPI_H */
\ No newline at end of file
@@ -97,4 +97,16 @@ char ReadByte()
     uint16_t c =LL_USART_ReceiveData8(COMM);
     LL_USART_DisableIT_RXNE(COMM);
     return c;
-}
\ No newline at end of file
+}
+
+/**
+  * @brief  Get a character from the HyperTerminal if one was received
+  * @param  c: receives the character
+  * @retval 1 if a character was read, 0 if none is waiting
+  */
+uint8_t TryReadByte(char *c)
+{
+    if (!LL_USART_IsActiveFlag_RXNE(COMM)) return 0;
+    *c = LL_USART_ReceiveData8(COMM);
+    return 1;
+}
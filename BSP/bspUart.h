@@ -29,6 +29,7 @@
 void UartInit(uint32_t baud);
 void PrintByte(char c);
 char ReadByte();
+uint8_t TryReadByte(char *c);
 
 
 #endif /* __BSPUART_H */
\ No newline at end of file
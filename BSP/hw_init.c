@@ -18,6 +18,12 @@ void Hw_init(void) {
     SystemClock_Config80();
     UartInit(115200);
     NVIC_SetPriority(PendSV_IRQn, 0xFF); // Lowest possible priority
+    
+    // DWT cycle counter, timestamps for the SPI arbitration stats and trace,
+    // the DREQ waits and the streaming telemetry
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 void SetSysTick(uint32_t ticksPerSec)
@@ -19,4 +19,14 @@
 
 #define PJDF_CTRL_LCD_SET_SPI_HANDLE 0x3  // Passes the required SPI handle to the LCD driver to enable it to talk to the ILI9341
 
+// Sends one RGB565 color to the pixels of the current address window using
+// 16 bit SPI frames. Selects the data interface.
+#define PJDF_CTRL_LCD_FILL 0x4  // pArgs: PjdfLcdFill
+
+typedef struct _PjdfLcdFill
+{
+    INT16U color;   // RGB565
+    INT32U count;   // number of pixels
+} PjdfLcdFill;
+
 #endif
\ No newline at end of file
@@ -18,5 +18,9 @@
 
 
 #define PJDF_CTRL_MP3_SET_SPI_HANDLE 0x3  // Passes the required SPI handle to the MP3 driver to enable it to talk to the VS1053
+#define PJDF_CTRL_MP3_SET_DREQ_HOOK  0x4  // Passes a PjdfMp3DreqHook called with the cycles spent waiting for each DREQ
+
+// Called by the driver after it waited for DREQ, with the DWT cycles the wait took
+typedef void (*PjdfMp3DreqHook)(INT32U cycles);
 
 #endif
\ No newline at end of file
@@ -18,5 +18,9 @@
 #define PJDF_CTRL_SD_RELEASE_SPI 0x4  // Release exclusive access to the SD's SPI
 
 #define PJDF_CTRL_SD_SET_SPI_HANDLE 0x5  // Passes the required SPI handle to the SD driver to enable it to talk to the SD card
+#define PJDF_CTRL_SD_SET_SCK_RATE 0x6  // Sets the SD SPI clock to the SPI kernel clock / 2^(1 + rate), pArgs: INT8U rate 0..7
+#define PJDF_CTRL_SD_GET_SCK_HZ 0x7  // Gets the SD SPI clock, pArgs: INT32U Hz
+
+#define PJDF_SD_SCK_RATE_MAX 7  // slowest rate accepted by PJDF_CTRL_SD_SET_SCK_RATE
 
 #endif
\ No newline at end of file
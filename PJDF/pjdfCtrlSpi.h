@@ -17,4 +17,110 @@
 #define PJDF_CTRL_SPI_RELEASE_LOCK   0x02   // Release exclusive SPI lock
 #define PJDF_CTRL_SPI_SET_DATARATE   0x03   // Set transmission rate of the SPI interface
 
+// Asynchronous DMA transfers. pArgs is the buffer and *pSize its length.
+// The caller must hold the lock and keep the chip selected until the
+// transfer has been waited for. Read() and Write() already use DMA for
+// bulk transfers and only return once the transfer is done.
+#define PJDF_CTRL_SPI_DMA_WRITE      0x04   // Start sending a buffer, received data is discarded
+#define PJDF_CTRL_SPI_DMA_READ       0x05   // Start a full duplex transfer, received data overwrites the buffer
+#define PJDF_CTRL_SPI_DMA_WAIT       0x06   // Wait for the transfer started above to complete
+
+// Bus arbitration. A transaction takes the lock for one client and brings
+// the bus to that client's configuration; SPI_CR1 is only written when the
+// configuration actually changes, e.g. the bus passes from the SD card to
+// the MP3 decoder. WAIT_FOR_LOCK/SET_DATARATE remain for simple clients,
+// their transactions are in the background class.
+//
+// The bus is a uC/OS-II mutex with a priority ceiling (APP_SPI_MUTEX_PRIO):
+// while a task holds the bus and a higher priority task waits for it, the
+// holder runs at the ceiling, so tasks of medium priority cannot stretch
+// the wait. The mutex serves waiters by task priority, so the task
+// priorities of the SPI clients follow the class order (app_cfg.h).
+// A client in a long transaction calls YIELD between bounded slices of
+// work, so a higher class waits at most for one slice: the audio path's
+// worst case bus wait is the longest slice any other client sends without
+// yielding.
+//
+// With PJDF_SPI_LOCK_MUTEX set to 0 the bus is handed to the highest class
+// with a waiter through one semaphore per class instead, without priority
+// inheritance; kept to compare the blocking times. Within a class the
+// semaphore wakes the waiting task of highest priority, not the first one.
+#define PJDF_SPI_LOCK_MUTEX          1
+#define PJDF_CTRL_SPI_BEGIN_TRANSACTION 0x07 // pArgs: PjdfSpiTransaction. Wait for the lock, then configure the bus
+#define PJDF_CTRL_SPI_END_TRANSACTION   0x08 // Release the lock taken by BEGIN_TRANSACTION
+#define PJDF_CTRL_SPI_GET_STATS         0x09 // pArgs: PjdfSpiStats, receives the arbitration counters
+#define PJDF_CTRL_SPI_WRITE_REPEAT16    0x0A // pArgs: PjdfSpiRepeat16. Send one 16 bit value repeatedly, e.g. an RGB565 fill
+#define PJDF_CTRL_SPI_YIELD             0x0B // Inside a transaction: let a waiting higher class go first, then continue
+#define PJDF_CTRL_SPI_RESET_STATS       0x0C // Clear the wait and hold times in PjdfSpiStats
+#define PJDF_CTRL_SPI_GET_TRACE         0x0D // pArgs: PjdfSpiTrace, receives the trace. PJDF_SPI_TRACE builds only
+#define PJDF_CTRL_SPI_RESET_TRACE       0x0E // Clear the trace. PJDF_SPI_TRACE builds only
+
+// Clients of the shared bus
+#define PJDF_SPI_CLIENT_NONE         0  // WAIT_FOR_LOCK users, benchmarks
+#define PJDF_SPI_CLIENT_MP3_CMD      1  // VS1053 command interface (SCI)
+#define PJDF_SPI_CLIENT_SD           2
+#define PJDF_SPI_CLIENT_LCD          3
+#define PJDF_SPI_CLIENT_MP3_DATA     4  // VS1053 data interface (SDI)
+#define PJDF_SPI_CLIENTS             5
+
+// Priority classes, highest first
+#define PJDF_SPI_CLASS_AUDIO         0  // VS1053 commands and data feed
+#define PJDF_SPI_CLASS_AUDIO_SD      1  // SD card reads feeding the decoder
+#define PJDF_SPI_CLASS_UI            2  // LCD drawing
+#define PJDF_SPI_CLASS_BACKGROUND    3  // everything else
+#define PJDF_SPI_CLASSES             4
+
+typedef struct _PjdfSpiTransaction
+{
+    INT8U client;           // PJDF_SPI_CLIENT_xxx
+    INT8U priorityClass;    // PJDF_SPI_CLASS_xxx
+    INT16U dataRate;        // baud rate prescaler, LL_SPI_BAUDRATEPRESCALER_xxx
+} PjdfSpiTransaction;
+
+typedef struct _PjdfSpiRepeat16
+{
+    INT16U value;           // sent most significant byte first
+    INT32U count;           // number of 16 bit frames
+} PjdfSpiRepeat16;
+
+typedef struct _PjdfSpiStats
+{
+    INT32U transactions;    // BEGIN_TRANSACTION requests
+    INT32U ownerChanges;    // transactions by a different client than the last one
+    INT32U reconfigs;       // writes of the data rate to the hardware
+    INT32U reconfigsAvoided;// data rate requests that matched the hardware already
+    INT32U yields;          // transactions interrupted by YIELD for a higher class
+    INT32U acquires[PJDF_SPI_CLASSES];  // times a class got the bus
+    INT32U maxWaitUs[PJDF_SPI_CLASSES]; // longest wait for the bus per class
+    INT32U maxHoldUs[PJDF_SPI_CLASSES]; // longest time a class held the bus
+} PjdfSpiStats;
+
+// Transaction tracing. Per client the driver counts transactions and bytes
+// and keeps histograms of the time spent waiting for the bus and holding
+// it, measured with the DWT cycle counter. The last PJDF_SPI_TRACE_EVENTS
+// transactions are kept in a log. Costs about 1.5 KB of RAM.
+#define PJDF_SPI_TRACE               1
+#define PJDF_SPI_TRACE_BINS          12 // bin 0 below 2 us, bin i from 2^i us, the last open ended
+#define PJDF_SPI_TRACE_EVENTS        64
+
+typedef struct _PjdfSpiTraceEvent
+{
+    INT32U start;           // DWT cycle count when the bus was requested
+    INT16U waitUs;          // the times and byte count saturate at 0xFFFF
+    INT16U holdUs;
+    INT16U bytes;
+    INT8U client;           // PJDF_SPI_CLIENT_xxx
+    INT8U taskPrio;         // priority of the requesting task
+} PjdfSpiTraceEvent;
+
+typedef struct _PjdfSpiTrace
+{
+    INT32U transactions[PJDF_SPI_CLIENTS];
+    INT32U bytes[PJDF_SPI_CLIENTS];
+    INT32U waitHist[PJDF_SPI_CLIENTS][PJDF_SPI_TRACE_BINS];
+    INT32U holdHist[PJDF_SPI_CLIENTS][PJDF_SPI_TRACE_BINS];
+    INT32U events;          // transactions logged; the newest is at log[(events - 1) % PJDF_SPI_TRACE_EVENTS]
+    PjdfSpiTraceEvent log[PJDF_SPI_TRACE_EVENTS];
+} PjdfSpiTrace;
+
 #endif
\ No newline at end of file
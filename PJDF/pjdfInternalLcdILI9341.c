@@ -21,8 +21,12 @@ typedef struct _PjdfContextLcdILI9341
 
 static PjdfContextLcdILI9341 ili9341Context = { 0 };
 
-static const INT16U LcdSpiDataRate = LCD_SPI_DATARATE;
-static const INT32U SizeofLcdSpiDataRate = sizeof(LcdSpiDataRate);
+static const PjdfSpiTransaction LcdSpiTransaction = { PJDF_SPI_CLIENT_LCD, PJDF_SPI_CLASS_UI, LCD_SPI_DATARATE };
+static const INT32U SizeofLcdSpiTransaction = sizeof(LcdSpiTransaction);
+
+// Pixels sent by PJDF_CTRL_LCD_FILL between chances for the audio path to
+// take the bus: 1024 pixels take about 0.4 ms at 40 MHz.
+#define LCD_FILL_SLICE_PIXELS 1024
 
 
 // OpenLCD
@@ -60,18 +64,15 @@ static PjdfErrCode ReadLCD(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
     PjdfContextLcdILI9341 *pContext = (PjdfContextLcdILI9341*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0); // wait for exclusive access
-    if (retval != PJDF_ERR_NONE) while(1);
-
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&LcdSpiDataRate, (INT32U*)&SizeofLcdSpiDataRate); 
+    // wait for exclusive access, the arbiter sets the LCD data rate if needed
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)&LcdSpiTransaction, (INT32U*)&SizeofLcdSpiTransaction);
     if (retval != PJDF_ERR_NONE) while(1);
 
     LCD_ILI9341_CS_ASSERT(); // assert LCD SPI
     retval = Read(hSPI, pBuffer, pCount);
     LCD_ILI9341_CS_DEASSERT(); // de-assert LCD SPI
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
     if (retval != PJDF_ERR_NONE) while(1);
     return retval;
 }
@@ -96,22 +97,57 @@ static PjdfErrCode WriteLCD(DriverInternal *pDriver, void* pBuffer, INT32U* pCou
     PjdfContextLcdILI9341 *pContext = (PjdfContextLcdILI9341*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0);  // wait for exclusive access
-    if (retval != PJDF_ERR_NONE) while(1);
-    
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&LcdSpiDataRate, (INT32U*)&SizeofLcdSpiDataRate); 
+    // wait for exclusive access, the arbiter sets the LCD data rate if needed
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)&LcdSpiTransaction, (INT32U*)&SizeofLcdSpiTransaction);
     if (retval != PJDF_ERR_NONE) while(1);
 
     LCD_ILI9341_CS_ASSERT(); // assert LCD SPI
     retval = Write(hSPI, pBuffer, pCount);
     LCD_ILI9341_CS_DEASSERT(); // de-assert LCD SPI
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
     if (retval != PJDF_ERR_NONE) while(1);
     return retval;
 }
 
+// FillLCD
+// Sends the given color count times to the ILI9341 data interface, in
+// slices of LCD_FILL_SLICE_PIXELS with 16 bit SPI frames. Between slices the
+// bus goes to any waiting client of a higher class. The ILI9341 keeps
+// writing the address window across chip select pulses.
+static void FillLCD(PjdfContextLcdILI9341 *pContext, PjdfLcdFill *pFill)
+{
+    PjdfErrCode retval;
+    HANDLE hSPI = pContext->spiHandle;
+    PjdfSpiRepeat16 repeat;
+    INT32U sizeofRepeat = sizeof(repeat);
+    INT32U remaining = pFill->count;
+
+    LCD_ILI9341_DC_HIGH(); // pixels go to the data interface
+    repeat.value = pFill->color;
+    
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)&LcdSpiTransaction, (INT32U*)&SizeofLcdSpiTransaction);
+    if (retval != PJDF_ERR_NONE) while(1);
+    while (remaining > 0)
+    {
+        repeat.count = (remaining > LCD_FILL_SLICE_PIXELS) ? LCD_FILL_SLICE_PIXELS : remaining;
+        
+        LCD_ILI9341_CS_ASSERT(); // assert LCD SPI
+        retval = Ioctl(hSPI, PJDF_CTRL_SPI_WRITE_REPEAT16, &repeat, &sizeofRepeat);
+        LCD_ILI9341_CS_DEASSERT(); // de-assert LCD SPI
+        if (retval != PJDF_ERR_NONE) while(1);
+        remaining -= repeat.count;
+        
+        if (remaining > 0)
+        {
+            retval = Ioctl(hSPI, PJDF_CTRL_SPI_YIELD, 0, 0);
+            if (retval != PJDF_ERR_NONE) while(1);
+        }
+    }
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
+    if (retval != PJDF_ERR_NONE) while(1);
+}
+
 // IoctlLCD
 // pDriver: pointer to an initialized ILI9341 LCD driver
 // request: a request code chosen from those in pjdfCtrlLcdILI9341.h
@@ -143,6 +179,10 @@ static PjdfErrCode IoctlLCD(DriverInternal *pDriver, INT8U request, void* pArgs,
         }
         pContext->spiHandle = handle;
         break;
+    case PJDF_CTRL_LCD_FILL:
+        if (pArgs == NULL || *pSize != sizeof(PjdfLcdFill)) return PJDF_ERR_ARG;
+        FillLCD(pContext, (PjdfLcdFill*)pArgs);
+        break;
     default:
         retval = PJDF_ERR_UNKNOWN_CTRL_REQUEST;
         break;
@@ -18,12 +18,16 @@ typedef struct _PjdfContextMp3VS1053
 {
     HANDLE spiHandle; // SPI communication link to VS1053
     INT8U chipSelect; // 0 means command, 1 means data
+    OS_EVENT *dreqSem; // posted by the DREQ rising edge interrupt
+    PjdfMp3DreqHook dreqHook; // reports DREQ wait times, may be NULL
 } PjdfContextMp3VS1053;
 
 static PjdfContextMp3VS1053 mp3VS1053Context = { 0 };
 
-static const INT16U Mp3SpiDataRate = MP3_SPI_DATARATE;
-static const INT32U SizeofMp3SpiDataRate = sizeof(Mp3SpiDataRate);
+// Command and data traffic are separate SPI clients so the bus trace tells them apart
+static const PjdfSpiTransaction Mp3CmdSpiTransaction = { PJDF_SPI_CLIENT_MP3_CMD, PJDF_SPI_CLASS_AUDIO, MP3_SPI_DATARATE };
+static const PjdfSpiTransaction Mp3DataSpiTransaction = { PJDF_SPI_CLIENT_MP3_DATA, PJDF_SPI_CLASS_AUDIO, MP3_SPI_DATARATE };
+static const INT32U SizeofMp3SpiTransaction = sizeof(PjdfSpiTransaction);
 
 // OpenMP3
 // Nothing to do.
@@ -40,6 +44,43 @@ static PjdfErrCode CloseMP3(DriverInternal *pDriver)
     return Close(pContext->spiHandle);
 }
 
+// WaitForDreq
+// Blocks until the VS1053 raises DREQ. Called inside an SPI transaction; the
+// transaction is ended while waiting so other SPI devices can use the bus and
+// begun again before returning, which restores the VS1053 data rate if
+// another device changed it.
+// The time spent waiting is reported to the DREQ hook, if one was set.
+// pTransaction: the transaction the caller began
+static void WaitForDreq(PjdfContextMp3VS1053 *pContext, const PjdfSpiTransaction *pTransaction)
+{
+    PjdfErrCode retval;
+    INT8U err;
+    INT32U start;
+    
+    if (MP3_VS1053_DREQ_IS_SET()) return;
+    start = DWT->CYCCNT;
+    
+    while (!MP3_VS1053_DREQ_IS_SET())
+    {
+        // Device not ready so release it until the DREQ interrupt fires
+        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
+        if (retval != PJDF_ERR_NONE) while(1);
+        
+        // Discard edges seen while we were busy, then re-check the pin so an
+        // edge arriving now is not lost
+        OSSemSet(pContext->dreqSem, 0, &err);
+        if (!MP3_VS1053_DREQ_IS_SET())
+        {
+            OSSemPend(pContext->dreqSem, MP3_DREQ_TIMEOUT_TICKS, &err);
+        }
+        
+        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)pTransaction, (INT32U*)&SizeofMp3SpiTransaction);
+        if (retval != PJDF_ERR_NONE) while(1);
+    }
+    
+    if (pContext->dreqHook != NULL) pContext->dreqHook(DWT->CYCCNT - start);
+}
+
 // ReadMP3
 // Writes the contents of the buffer to the given device, and concurrently
 // gets the resulting data back from the device via full duplex SPI. 
@@ -60,16 +101,13 @@ static PjdfErrCode ReadMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
     PjdfContextMp3VS1053 *pContext = (PjdfContextMp3VS1053*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0);   // wait for exclusive access
+    // wait for exclusive access, the arbiter sets the VS1053 data rate if needed
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)&Mp3CmdSpiTransaction, (INT32U*)&SizeofMp3SpiTransaction);
     if (retval != PJDF_ERR_NONE) while(1);
     
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&Mp3SpiDataRate, (INT32U*)&SizeofMp3SpiDataRate); 
-    if (retval != PJDF_ERR_NONE) while(1);
-
     // Wait for device ready
-    while (!LL_GPIO_IsInputPinSet(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin));
-    
+    WaitForDreq(pContext, &Mp3CmdSpiTransaction);
+
     switch (pContext->chipSelect) {
     case 0: /* send command */
         MP3_VS1053_MCS_ASSERT(); // assert command chip-select
@@ -79,7 +117,7 @@ static PjdfErrCode ReadMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
     default:
         while(1); // must be in command mode
     }
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
     if (retval != PJDF_ERR_NONE) while(1);
     return retval;
 }
@@ -94,6 +132,10 @@ static PjdfErrCode ReadMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
 //
 // The above selection will persist until changed by another call to Ioctl()
 //
+// In data mode the buffer is sent in MP3_DECODER_BUF_SIZE bursts, back to back
+// for as long as DREQ stays high. When DREQ drops the caller blocks on the
+// DREQ interrupt with the SPI bus released.
+//
 // pDriver: pointer to an initialized VS1053 MP3 driver
 // pBuffer: the data to write to the device
 // pCount: the number of bytes to write
@@ -103,46 +145,50 @@ static PjdfErrCode WriteMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCou
     PjdfErrCode retval;
     PjdfContextMp3VS1053 *pContext = (PjdfContextMp3VS1053*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
+    INT8U *pData = (INT8U*)pBuffer;
+    INT32U remaining = *pCount;
+    INT32U burst;
+    const PjdfSpiTransaction *pTransaction = (pContext->chipSelect == 0) ? &Mp3CmdSpiTransaction : &Mp3DataSpiTransaction;
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0); // wait for exclusive access
-    if (retval != PJDF_ERR_NONE) while(1);
-    
-    // Wait for device ready
-    while (!LL_GPIO_IsInputPinSet(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin))
-    {
-        // Device not ready so release it and delay before trying again
-        retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
-        if (retval != PJDF_ERR_NONE) while(1);
-        
-        OSTimeDly(5); // can optimize this to handle highest audio bit rate while allowing delay for other tasks 
-        
-        retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0); // wait for exclusive access
-        if (retval != PJDF_ERR_NONE) while(1);
-    }
-        
-        
-    
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&Mp3SpiDataRate, (INT32U*)&SizeofMp3SpiDataRate); 
+    // wait for exclusive access, the arbiter sets the VS1053 data rate if needed
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_BEGIN_TRANSACTION, (void*)pTransaction, (INT32U*)&SizeofMp3SpiTransaction);
     if (retval != PJDF_ERR_NONE) while(1);
-
     
     switch (pContext->chipSelect) {
     case 0: /* send command */
+        // Wait for device ready
+        WaitForDreq(pContext, pTransaction);
+        
         MP3_VS1053_MCS_ASSERT(); // assert command chip-select
         retval = Write(hSPI, pBuffer, pCount);
         MP3_VS1053_MCS_DEASSERT(); // de-assert command chip-select
         break;
     case 1:  /* send data */
-        MP3_VS1053_DCS_ASSERT(); // assert data chip-select
-        retval = Write(hSPI, pBuffer, pCount);
-        MP3_VS1053_DCS_DEASSERT(); // de-assert data chip-select
+        while (remaining > 0)
+        {
+            // DREQ high guarantees room for at least one burst
+            WaitForDreq(pContext, pTransaction);
+            
+            do
+            {
+                burst = (remaining > MP3_DECODER_BUF_SIZE) ? MP3_DECODER_BUF_SIZE : remaining;
+                MP3_VS1053_DCS_ASSERT(); // assert data chip-select
+                retval = Write(hSPI, pData, &burst);
+                MP3_VS1053_DCS_DEASSERT(); // de-assert data chip-select
+                if (retval != PJDF_ERR_NONE) break;
+                pData += burst;
+                remaining -= burst;
+            } while (remaining > 0 && MP3_VS1053_DREQ_IS_SET());
+            
+            if (retval != PJDF_ERR_NONE) break;
+        }
+        *pCount -= remaining;
         break;
     default:
         while(1);
     }
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
-    if (retval != PJDF_ERR_NONE) while(1);
+    
+    if (Ioctl(hSPI, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0) != PJDF_ERR_NONE) while(1);
     return retval;
 }
 
@@ -177,6 +223,13 @@ static PjdfErrCode IoctlMP3(DriverInternal *pDriver, INT8U request, void* pArgs,
         }
         pContext->spiHandle = handle;
         break;
+    case PJDF_CTRL_MP3_SET_DREQ_HOOK:
+        if (*pSize < sizeof(PjdfMp3DreqHook))
+        {
+            return PJDF_ERR_ARG;
+        }
+        pContext->dreqHook = *((PjdfMp3DreqHook*)pArgs);
+        break;
     default:
         retval = PJDF_ERR_UNKNOWN_CTRL_REQUEST;
         break;
@@ -197,7 +250,12 @@ PjdfErrCode InitMp3VS1053(DriverInternal *pDriver, char *pName)
     pDriver->maxRefCount = 1; // only one open handle allowed
     pDriver->deviceContext = &mp3VS1053Context;
     
+    // Semaphore signalled by the DREQ interrupt when the decoder wants data
+    mp3VS1053Context.dreqSem = OSSemCreate(0);
+    if (mp3VS1053Context.dreqSem == NULL) while (1);  // not enough semaphores available
+    
     BspMp3InitVS1053(); // Initialize related GPIO
+    BspMp3DreqIntInit(mp3VS1053Context.dreqSem); // DREQ rising edge interrupt
   
     // Assign implemented functions to the interface pointers
     pDriver->Open = OpenMP3;
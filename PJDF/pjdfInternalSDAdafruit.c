@@ -19,12 +19,12 @@ typedef struct _PjdfContextSD
     HANDLE spiHandle; // SPI communication link to SD card on Adafruit shield
     BOOLEAN spiLocked; // true iff we have exclusive access to the SPI
     BOOLEAN csAsserted; // true iff SPI chip select is asserted
+    PjdfSpiTransaction transaction; // SPI transaction, its data rate is set by PJDF_CTRL_SD_SET_SCK_RATE
 } PjdfContextSD;
 
 static PjdfContextSD SDContext = { 0 };
 
-static const INT16U SDSpiDataRate = SD_SPI_DATARATE;
-static const INT32U SizeofSDSpiDataRate = sizeof(SDSpiDataRate);
+static const INT32U SizeofSDSpiTransaction = sizeof(PjdfSpiTransaction);
 
 // OpenSDAdafruit
 // Nothing to do.
@@ -66,10 +66,7 @@ static PjdfErrCode ReadSDAdafruit(DriverInternal *pDriver, void* pBuffer, INT32U
     if (!pContext->spiLocked) while(1);
     if (!pContext->csAsserted) while(1);
     
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&SDSpiDataRate, (INT32U*)&SizeofSDSpiDataRate); 
-    if (retval != PJDF_ERR_NONE) while(1);
-    
+    // the SD data rate was set when the lock was taken (PJDF_CTRL_SD_LOCK_SPI)
     retval = Read(hSPI, pBuffer, pCount);
     
     return retval;
@@ -98,10 +95,7 @@ static PjdfErrCode WriteSDAdafruit(DriverInternal *pDriver, void* pBuffer, INT32
     if (!pContext->spiLocked) while(1);
     //if (!pContext->csAsserted) while(1); // TODO: does initialization require no assert?
     
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&SDSpiDataRate, (INT32U*)&SizeofSDSpiDataRate); 
-    if (retval != PJDF_ERR_NONE) while(1);
-    
+    // the SD data rate was set when the lock was taken (PJDF_CTRL_SD_LOCK_SPI)
     retval = Write(hSPI, pBuffer, pCount);
         
     return retval;
@@ -116,6 +110,8 @@ static PjdfErrCode WriteSDAdafruit(DriverInternal *pDriver, void* pBuffer, INT32
 static PjdfErrCode IoctlSDAdafruit(DriverInternal *pDriver, INT8U request, void* pArgs, INT32U* pSize)
 {
     HANDLE handle;
+    INT16U dataRate;
+    INT32U length;
     PjdfErrCode retval = PJDF_ERR_NONE;
     PjdfContextSD *pContext = (PjdfContextSD*) pDriver->deviceContext;
     switch (request)
@@ -133,13 +129,13 @@ static PjdfErrCode IoctlSDAdafruit(DriverInternal *pDriver, INT8U request, void*
     case PJDF_CTRL_SD_LOCK_SPI:
         if (pContext->spiLocked) 
             return PJDF_ERR_NONE; // already locked
-        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0);
+        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_BEGIN_TRANSACTION, &pContext->transaction, (INT32U*)&SizeofSDSpiTransaction);
         if (PJDF_IS_ERROR(retval)) while(1);
         pContext->spiLocked = true;
         break;
     case PJDF_CTRL_SD_RELEASE_SPI:
         if (!pContext->spiLocked) while(1); // not currently locked
-        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+        retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_END_TRANSACTION, 0, 0);
         if (PJDF_IS_ERROR(retval)) while(1);
         pContext->spiLocked = false;
         break;
@@ -155,6 +151,23 @@ static PjdfErrCode IoctlSDAdafruit(DriverInternal *pDriver, INT8U request, void*
         }
         pContext->spiHandle = handle;
         break;
+    case PJDF_CTRL_SD_SET_SCK_RATE:
+        if (*pSize != sizeof(INT8U) || *(INT8U*)pArgs > PJDF_SD_SCK_RATE_MAX) return PJDF_ERR_ARG;
+        // the LL prescalers are the divide by 2^(1 + rate) codes in SPI_CR1 BR
+        dataRate = (INT16U)(*(INT8U*)pArgs << SPI_CR1_BR_Pos);
+        pContext->transaction.dataRate = dataRate;
+        if (pContext->spiLocked)
+        {
+            // in a transaction already, change the clock now
+            length = sizeof(dataRate);
+            retval = Ioctl(pContext->spiHandle, PJDF_CTRL_SPI_SET_DATARATE, &dataRate, &length);
+        }
+        break;
+    case PJDF_CTRL_SD_GET_SCK_HZ:
+        if (*pSize != sizeof(INT32U)) return PJDF_ERR_ARG;
+        // SPI1 runs from PCLK2, which is HCLK (APB2 prescaler 1, see hw_init.c)
+        *(INT32U*)pArgs = SystemCoreClock >> (1 + (pContext->transaction.dataRate >> SPI_CR1_BR_Pos));
+        break;
     default:
         retval = PJDF_ERR_UNKNOWN_CTRL_REQUEST;
         break;
@@ -174,6 +187,9 @@ PjdfErrCode InitSDAdafruit(DriverInternal *pDriver, char *pName)
     pDriver->refCount = 0; // number of Open handles to the device
     pDriver->maxRefCount = 1; // only one open handle allowed
     pDriver->deviceContext = &SDContext;
+    SDContext.transaction.client = PJDF_SPI_CLIENT_SD;
+    SDContext.transaction.priorityClass = PJDF_SPI_CLASS_AUDIO_SD;
+    SDContext.transaction.dataRate = SD_SPI_DATARATE; // until Sd2Card::init() sets the clock
     
     BspSDInitAdafruit(); // Initialize related GPIO
   
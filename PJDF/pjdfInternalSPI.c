@@ -16,9 +16,267 @@
 typedef struct _PjdfContextSpi
 {
     SPI_TypeDef *spiMemMap; // Memory mapped register block for a SPI interface
+    OS_EVENT *dmaSem;       // posted by the DMA interrupt, NULL if the interface has no DMA
+    BOOLEAN dmaBusy;        // a DMA transfer was started and not yet waited for
+    INT8U owner;            // client of the last transaction, PJDF_SPI_CLIENT_xxx
+    INT16U dataRate;        // prescaler in SPI_CR1, valid if isRateKnown
+    BOOLEAN isRateKnown;
+    INT8U ownerClass;       // priority class of the client holding the bus
+    INT32U holdStart;       // DWT cycle count when the owner got the bus
+    INT8U waiting[PJDF_SPI_CLASSES];        // clients queued per class
+#if PJDF_SPI_TRACE
+    PjdfSpiTraceEvent traceEvent;   // the current transaction
+    INT32U traceBytes;
+    PjdfSpiTrace trace;
+#endif
+#if PJDF_SPI_LOCK_MUTEX
+    OS_EVENT *busMutex;     // held by the client using the bus
+#else
+    BOOLEAN isBusy;         // a client holds the bus
+    OS_EVENT *classSem[PJDF_SPI_CLASSES];   // posted to hand the bus to a queued client
+#endif
+    PjdfSpiStats stats;
 } PjdfContextSpi;
 
-static PjdfContextSpi spi1Context = { PJDF_SPI1 };
+static PjdfContextSpi spi1Context = { PJDF_SPI1, NULL, OS_FALSE, PJDF_SPI_CLIENT_NONE, 0, OS_FALSE };
+
+#if PJDF_SPI_TRACE
+#define SPI_TRACE_BYTES(pContext, n) ((pContext)->traceBytes += (n))
+
+// SpiTraceBin
+// Returns: the trace histogram bin of a duration
+static INT8U SpiTraceBin(INT32U us)
+{
+    INT8U bin = 0;
+
+    while (us > 1 && bin < PJDF_SPI_TRACE_BINS - 1)
+    {
+        us >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+static INT16U SpiTraceSaturate(INT32U value)
+{
+    return (value > 0xFFFF) ? 0xFFFF : (INT16U)value;
+}
+
+// SpiTraceStart
+// Opens the trace record of a transaction that just got the bus.
+static void SpiTraceStart(PjdfContextSpi *pContext, INT8U client, INT8U taskPrio, INT32U start, INT32U waitUs)
+{
+    if (client >= PJDF_SPI_CLIENTS) client = PJDF_SPI_CLIENT_NONE;
+    pContext->traceEvent.start = start;
+    pContext->traceEvent.waitUs = SpiTraceSaturate(waitUs);
+    pContext->traceEvent.client = client;
+    pContext->traceEvent.taskPrio = taskPrio;
+    pContext->traceBytes = 0;
+    pContext->trace.waitHist[client][SpiTraceBin(waitUs)]++;
+}
+
+// SpiTraceEnd
+// Closes the record of the current transaction and logs it.
+static void SpiTraceEnd(PjdfContextSpi *pContext, INT32U holdUs)
+{
+    OS_CPU_SR cpu_sr;
+    PjdfSpiTraceEvent *pEvent = &pContext->traceEvent;
+
+    pEvent->holdUs = SpiTraceSaturate(holdUs);
+    pEvent->bytes = SpiTraceSaturate(pContext->traceBytes);
+    
+    // The shell copies the trace with interrupts off
+    OS_ENTER_CRITICAL();
+    pContext->trace.transactions[pEvent->client]++;
+    pContext->trace.bytes[pEvent->client] += pContext->traceBytes;
+    pContext->trace.holdHist[pEvent->client][SpiTraceBin(holdUs)]++;
+    pContext->trace.log[pContext->trace.events % PJDF_SPI_TRACE_EVENTS] = *pEvent;
+    pContext->trace.events++;
+    OS_EXIT_CRITICAL();
+}
+#else
+#define SPI_TRACE_BYTES(pContext, n)
+#endif
+
+
+// SpiAcquire
+// Blocks until the bus is free or handed over by SpiRelease(), then records
+// the wait for the class and the client.
+static void SpiAcquire(PjdfContextSpi *pContext, INT8U priorityClass, INT8U client)
+{
+    OS_CPU_SR cpu_sr;
+    INT8U osErr;
+    INT8U taskPrio = OSTCBCur->OSTCBPrio;
+    INT32U start = DWT->CYCCNT;
+    INT32U us;
+#if PJDF_SPI_LOCK_MUTEX
+
+    // The count lets a holder see who waits, see SpiIsHigherWaiting()
+    OS_ENTER_CRITICAL();
+    pContext->waiting[priorityClass]++;
+    OS_EXIT_CRITICAL();
+    
+    OSMutexPend(pContext->busMutex, 0, &osErr);
+    if (osErr != OS_ERR_NONE) while(1);
+    
+    OS_ENTER_CRITICAL();
+    pContext->waiting[priorityClass]--;
+    OS_EXIT_CRITICAL();
+#else
+    BOOLEAN isFree;
+
+    OS_ENTER_CRITICAL();
+    isFree = !pContext->isBusy;
+    if (isFree)
+    {
+        pContext->isBusy = OS_TRUE;
+    }
+    else
+    {
+        pContext->waiting[priorityClass]++;
+    }
+    OS_EXIT_CRITICAL();
+    
+    if (!isFree)
+    {
+        // isBusy stays set while the bus is handed over
+        OSSemPend(pContext->classSem[priorityClass], 0, &osErr);
+        if (osErr != OS_ERR_NONE) while(1);
+    }
+#endif
+    
+    pContext->ownerClass = priorityClass;
+    pContext->holdStart = DWT->CYCCNT;
+    us = (pContext->holdStart - start) / (SystemCoreClock / 1000000u);
+    pContext->stats.acquires[priorityClass]++;
+    if (us > pContext->stats.maxWaitUs[priorityClass]) pContext->stats.maxWaitUs[priorityClass] = us;
+#if PJDF_SPI_TRACE
+    SpiTraceStart(pContext, client, taskPrio, start, us);
+#endif
+}
+
+// SpiRelease
+// Records how long the owner held the bus and releases it. With the mutex
+// the highest priority waiting task gets it, otherwise the highest priority
+// waiting task of the highest waiting class, as OSSemPost() picks it.
+static void SpiRelease(PjdfContextSpi *pContext)
+{
+    OS_CPU_SR cpu_sr;
+    INT8U priorityClass = pContext->ownerClass;
+    INT32U us = (DWT->CYCCNT - pContext->holdStart) / (SystemCoreClock / 1000000u);
+
+    if (us > pContext->stats.maxHoldUs[priorityClass]) pContext->stats.maxHoldUs[priorityClass] = us;
+#if PJDF_SPI_TRACE
+    SpiTraceEnd(pContext, us);
+#endif
+#if PJDF_SPI_LOCK_MUTEX
+    
+    if (OSMutexPost(pContext->busMutex) != OS_ERR_NONE) while(1); // not the owner
+#else
+
+    OS_ENTER_CRITICAL();
+    for (priorityClass = 0; priorityClass < PJDF_SPI_CLASSES; priorityClass++)
+    {
+        if (pContext->waiting[priorityClass] > 0) break;
+    }
+    if (priorityClass < PJDF_SPI_CLASSES)
+    {
+        pContext->waiting[priorityClass]--;
+    }
+    else
+    {
+        pContext->isBusy = OS_FALSE;
+    }
+    OS_EXIT_CRITICAL();
+    
+    if (priorityClass < PJDF_SPI_CLASSES) OSSemPost(pContext->classSem[priorityClass]);
+#endif
+}
+
+// SpiIsHigherWaiting
+// Returns: OS_TRUE if a client of a higher class than the owner is queued
+static BOOLEAN SpiIsHigherWaiting(PjdfContextSpi *pContext)
+{
+    INT8U priorityClass;
+
+    for (priorityClass = 0; priorityClass < pContext->ownerClass; priorityClass++)
+    {
+        if (pContext->waiting[priorityClass] > 0) return OS_TRUE;
+    }
+    return OS_FALSE;
+}
+
+
+// SpiConfigure
+// Brings the hardware to the given data rate unless it is there already.
+static void SpiConfigure(PjdfContextSpi *pContext, INT16U dataRate)
+{
+    if (pContext->isRateKnown && pContext->dataRate == dataRate)
+    {
+        pContext->stats.reconfigsAvoided++;
+        return;
+    }
+    SPI_SetDataRate(pContext->spiMemMap, dataRate);
+    pContext->dataRate = dataRate;
+    pContext->isRateKnown = OS_TRUE;
+    pContext->stats.reconfigs++;
+}
+
+// SpiBegin
+// Waits for the bus in the client's class, then configures it for the client.
+static void SpiBegin(PjdfContextSpi *pContext, INT8U client, INT8U priorityClass, INT16U dataRate)
+{
+    SpiAcquire(pContext, priorityClass, client);
+    
+    // The bus is held from here on, the context belongs to this client
+    pContext->stats.transactions++;
+    if (pContext->owner != client)
+    {
+        pContext->stats.ownerChanges++;
+        pContext->owner = client;
+    }
+    SpiConfigure(pContext, dataRate);
+}
+
+
+// SpiDmaStart
+// Starts a DMA transfer of up to SPI_DMA_MAX_LENGTH bytes.
+// rxBuffer: NULL to discard the received data
+static void SpiDmaStart(PjdfContextSpi *pContext, INT8U *txBuffer, INT8U *rxBuffer, INT32U count)
+{
+    if (pContext->dmaBusy) while(1); // previous transfer was not waited for
+    pContext->dmaBusy = OS_TRUE;
+    SPI_DmaStart(pContext->spiMemMap, txBuffer, rxBuffer, (uint16_t)count);
+}
+
+// SpiDmaWait
+// Blocks the calling task until the current DMA transfer completes.
+static void SpiDmaWait(PjdfContextSpi *pContext)
+{
+    INT8U osErr;
+    
+    if (!pContext->dmaBusy) return;
+    OSSemPend(pContext->dmaSem, 0, &osErr);
+    if (osErr != OS_ERR_NONE) while(1);
+    pContext->dmaBusy = OS_FALSE;
+}
+
+// SpiDmaTransfer
+// Transfers a buffer of any length by DMA, sleeping while each piece is sent.
+static void SpiDmaTransfer(PjdfContextSpi *pContext, INT8U *txBuffer, INT8U *rxBuffer, INT32U count)
+{
+    INT32U n;
+    
+    while (count > 0)
+    {
+        n = (count > SPI_DMA_MAX_LENGTH) ? SPI_DMA_MAX_LENGTH : count;
+        SpiDmaStart(pContext, txBuffer, rxBuffer, n);
+        SpiDmaWait(pContext);
+        txBuffer += n;
+        if (rxBuffer != NULL) rxBuffer += n;
+        count -= n;
+    }
+}
 
 
 
@@ -52,7 +310,18 @@ static PjdfErrCode ReadSPI(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
 {
     PjdfContextSpi *pContext = (PjdfContextSpi*) pDriver->deviceContext;
     if (pContext == NULL) while(1);
-    SPI_GetBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
+    if (pContext->dmaBusy) while(1); // an asynchronous transfer is still running
+    
+    // Bulk transfers go by DMA so the CPU is free while the bytes are clocked out
+    if (pContext->dmaSem != NULL && *pCount >= SPI_DMA_MIN_LENGTH)
+    {
+        SpiDmaTransfer(pContext, (INT8U*) pBuffer, (INT8U*) pBuffer, *pCount);
+    }
+    else
+    {
+        SPI_GetBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
+    }
+    SPI_TRACE_BYTES(pContext, *pCount);
     return PJDF_ERR_NONE;
 }
 
@@ -69,7 +338,18 @@ static PjdfErrCode WriteSPI(DriverInternal *pDriver, void* pBuffer, INT32U* pCou
 {
     PjdfContextSpi *pContext = (PjdfContextSpi*) pDriver->deviceContext;
     if (pContext == NULL) while(1);
-    SPI_SendBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
+    if (pContext->dmaBusy) while(1); // an asynchronous transfer is still running
+    
+    // Bulk transfers go by DMA so the CPU is free while the bytes are clocked out
+    if (pContext->dmaSem != NULL && *pCount >= SPI_DMA_MIN_LENGTH)
+    {
+        SpiDmaTransfer(pContext, (INT8U*) pBuffer, NULL, *pCount);
+    }
+    else
+    {
+        SPI_SendBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
+    }
+    SPI_TRACE_BYTES(pContext, *pCount);
     return PJDF_ERR_NONE;
 }
 
@@ -77,20 +357,86 @@ static PjdfErrCode WriteSPI(DriverInternal *pDriver, void* pBuffer, INT32U* pCou
 // Handles the request codes defined in pjdfCtrlSpi.h
 static PjdfErrCode IoctlSPI(DriverInternal *pDriver, INT8U request, void* pArgs, INT32U* pSize)
 {
-    INT8U osErr;
+    OS_CPU_SR cpu_sr;
+    PjdfSpiTransaction *pTransaction;
+    INT8U owner, priorityClass;
+    INT16U dataRate;
     PjdfContextSpi *pContext = (PjdfContextSpi*) pDriver->deviceContext;
     if (pContext == NULL) while(1);
     switch (request)
     {
     case PJDF_CTRL_SPI_WAIT_FOR_LOCK:
-        OSSemPend(pDriver->sem, 0, &osErr);
+        SpiAcquire(pContext, PJDF_SPI_CLASS_BACKGROUND, PJDF_SPI_CLIENT_NONE);
         break;
     case PJDF_CTRL_SPI_RELEASE_LOCK:
-        osErr = OSSemPost(pDriver->sem);
+        SpiRelease(pContext);
         break;
     case PJDF_CTRL_SPI_SET_DATARATE: // Call BSP code to adjust transmission speed of SPI
         if (*pSize != sizeof(INT16U)) while (1);
-        SPI_SetDataRate(pContext->spiMemMap, *(INT16U*)pArgs);
+        SpiConfigure(pContext, *(INT16U*)pArgs);
+        break;
+    case PJDF_CTRL_SPI_BEGIN_TRANSACTION:
+        if (pArgs == NULL || *pSize != sizeof(PjdfSpiTransaction)) return PJDF_ERR_ARG;
+        pTransaction = (PjdfSpiTransaction*)pArgs;
+        if (pTransaction->priorityClass >= PJDF_SPI_CLASSES) return PJDF_ERR_ARG;
+        SpiBegin(pContext, pTransaction->client, pTransaction->priorityClass, pTransaction->dataRate);
+        break;
+    case PJDF_CTRL_SPI_END_TRANSACTION:
+        if (pContext->dmaBusy) while(1); // a transfer must not outlive its transaction
+        SpiRelease(pContext);
+        break;
+    case PJDF_CTRL_SPI_YIELD:
+        if (pContext->dmaBusy) while(1); // a transfer must not outlive its slice
+        if (!SpiIsHigherWaiting(pContext)) break;
+        
+        // Requeue behind the waiting class and restore our configuration after
+        owner = pContext->owner;
+        priorityClass = pContext->ownerClass;
+        dataRate = pContext->dataRate;
+        pContext->stats.yields++;
+        SpiRelease(pContext);
+        SpiBegin(pContext, owner, priorityClass, dataRate);
+        break;
+    case PJDF_CTRL_SPI_RESET_STATS:
+        OS_ENTER_CRITICAL();
+        memset(&pContext->stats, 0, sizeof(pContext->stats));
+        OS_EXIT_CRITICAL();
+        break;
+#if PJDF_SPI_TRACE
+    case PJDF_CTRL_SPI_GET_TRACE:
+        if (pArgs == NULL || *pSize != sizeof(PjdfSpiTrace)) return PJDF_ERR_ARG;
+        OS_ENTER_CRITICAL();
+        *(PjdfSpiTrace*)pArgs = pContext->trace;
+        OS_EXIT_CRITICAL();
+        break;
+    case PJDF_CTRL_SPI_RESET_TRACE:
+        OS_ENTER_CRITICAL();
+        memset(&pContext->trace, 0, sizeof(pContext->trace));
+        OS_EXIT_CRITICAL();
+        break;
+#endif
+    case PJDF_CTRL_SPI_WRITE_REPEAT16:
+        if (pArgs == NULL || *pSize != sizeof(PjdfSpiRepeat16)) return PJDF_ERR_ARG;
+        if (pContext->dmaBusy) while(1); // an asynchronous transfer is still running
+        SPI_SendRepeat16(pContext->spiMemMap, ((PjdfSpiRepeat16*)pArgs)->value, ((PjdfSpiRepeat16*)pArgs)->count);
+        SPI_TRACE_BYTES(pContext, 2 * ((PjdfSpiRepeat16*)pArgs)->count);
+        break;
+    case PJDF_CTRL_SPI_GET_STATS:
+        if (pArgs == NULL || *pSize != sizeof(PjdfSpiStats)) return PJDF_ERR_ARG;
+        OS_ENTER_CRITICAL();
+        *(PjdfSpiStats*)pArgs = pContext->stats;
+        OS_EXIT_CRITICAL();
+        break;
+    case PJDF_CTRL_SPI_DMA_WRITE: // Start sending *pSize bytes at pArgs, received data is discarded
+    case PJDF_CTRL_SPI_DMA_READ:  // Start a full duplex transfer, received data overwrites pArgs
+        if (pContext->dmaSem == NULL) return PJDF_ERR_UNKNOWN_CTRL_REQUEST;
+        if (pArgs == NULL || *pSize == 0 || *pSize > SPI_DMA_MAX_LENGTH) return PJDF_ERR_ARG;
+        SpiDmaStart(pContext, (INT8U*)pArgs, 
+                    (request == PJDF_CTRL_SPI_DMA_READ) ? (INT8U*)pArgs : NULL, *pSize);
+        SPI_TRACE_BYTES(pContext, *pSize);
+        break;
+    case PJDF_CTRL_SPI_DMA_WAIT:  // Wait for the transfer started above
+        SpiDmaWait(pContext);
         break;
     default:
         while(1);
@@ -103,9 +449,12 @@ static PjdfErrCode IoctlSPI(DriverInternal *pDriver, INT8U request, void* pArgs,
 // Initializes the given SPI driver.
 PjdfErrCode InitSPI(DriverInternal *pDriver, char *pName)
 {   
+    INT8U osErr;
+    
     if (strcmp (pName, pDriver->pName) != 0) while(1); // pName should have been initialized in driversInternal[] declaration
     
-    // Initialize semaphore for serializing operations on the device 
+    // Initialize semaphore for serializing operations on the device. Access
+    // to the bus itself is arbitrated per priority class, see SpiAcquire()
     pDriver->sem = OSSemCreate(1); 
     if (pDriver->sem == NULL) while (1);  // not enough semaphores available
     pDriver->refCount = 0; // initial number of Open handles to the device
@@ -118,6 +467,24 @@ PjdfErrCode InitSPI(DriverInternal *pDriver, char *pName)
         pDriver->maxRefCount = 10; // Maximum refcount allowed for the device
         pDriver->deviceContext = (void*) &spi1Context;
         BspSPI1Init(); // init SPI1 hardware
+        
+#if PJDF_SPI_LOCK_MUTEX
+        // Bus lock with priority ceiling
+        spi1Context.busMutex = OSMutexCreate(APP_SPI_MUTEX_PRIO, &osErr);
+        if (osErr != OS_ERR_NONE) while (1);  // no event left or ceiling priority taken
+#else
+        // One queue per priority class for clients waiting for the bus
+        for (INT8U i = 0; i < PJDF_SPI_CLASSES; i++)
+        {
+            spi1Context.classSem[i] = OSSemCreate(0);
+            if (spi1Context.classSem[i] == NULL) while (1);  // not enough semaphores available
+        }
+#endif
+        
+        // Semaphore signalled by the DMA interrupt at the end of a transfer
+        spi1Context.dmaSem = OSSemCreate(0);
+        if (spi1Context.dmaSem == NULL) while (1);  // not enough semaphores available
+        BspSPI1DmaInit(spi1Context.dmaSem);
     }
   
     // Assign implemented functions to the interface pointers
@@ -0,0 +1,518 @@
+/*
+    mp3sim.c
+    Host simulator and benchmark of the MP3 streaming pipeline, used to size
+    the ring buffer, its watermarks and the SPI rates without a board.
+
+    The simulator runs the firmware's own streaming engine (mp3Stream.c),
+    stream parser (mp3StreamInfo.c) and memory audio source
+    (mp3AudioSource.c) the way Mp3StreamCycle() and Mp3ReaderCycle() drive
+    them, against models of the parts that need the board:
+
+    - VS1053: a 2 KB input FIFO drained at the bitrate of the frame being
+      decoded, taken from each frame header. DREQ is high while at least
+      32 bytes are free, like the PJDF driver expects.
+    - Feeder: the VS1053 driver sends 32 byte bursts while DREQ is high and
+      sleeps on the DREQ interrupt otherwise.
+    - Reader: every source read costs a latency drawn from a configurable
+      distribution (exponential plus occasional stalls) plus the transfer
+      time at the SD SPI rate. The bus is shared, so the feeder waits for it.
+
+    The feeder has priority over the reader, as MP3 task over reader task.
+    Time only passes in the models, so a run is repeatable for a given seed.
+
+    Usage: mp3sim [options] file.mp3...   (mp3sim -h lists the options)
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mp3Stream.h"
+#include "mp3StreamInfo.h"
+#include "mp3AudioSource.h"
+
+#define SIM_HCLK_HZ             80000000.0  // SPI1 runs off the 80 MHz APB2 clock
+#define SIM_VS1053_FIFO         2048u       // VS1053 SDI input buffer
+#define SIM_DREQ_SPACE          32u         // free FIFO bytes that raise DREQ
+
+typedef struct _SimConfig
+{
+    uint32_t mp3Div;            // MP3_SPI_DATARATE prescaler
+    uint32_t sdDiv;             // SD_SPI_DATARATE prescaler
+    uint32_t ringSize;          // MP3_STREAM_BUF_SIZE
+    uint32_t highWater;         // MP3_STREAM_HIGH_WATER, 0: ring size - read block
+    uint32_t lowWater;          // MP3_STREAM_LOW_WATER, 0: half the ring
+    uint32_t readBlock;         // MP3_STREAM_READ_BLOCK
+    uint32_t readMax;           // largest single source read
+    uint32_t feedMax;           // MP3_STREAM_FEED_MAX
+    uint32_t burst;             // MP3_DECODER_BUF_SIZE
+    double burstOverheadUs;     // chip select, DREQ check and call overhead per burst
+    double sdLatencyUs;         // mean latency of an SD read before the data flows
+    double sdStallProb;         // chance a read stalls (card busy, FAT lookup...)
+    double sdStallUs;           // length of a stall
+    uint32_t seed;
+} SimConfig;
+
+typedef struct _SimFrame
+{
+    uint32_t offset;            // from the start of the audio
+    uint32_t length;
+    double duration;            // seconds
+} SimFrame;
+
+typedef struct _Sim
+{
+    const SimConfig *cfg;
+    double mp3Bps;              // SDI bytes per second
+    double sdBps;               // SD bytes per second
+
+    Mp3AudioSource src;
+    SimFrame *frames;
+    uint32_t frameCount;
+    uint32_t audioBytes;
+    uint32_t rng;
+
+    // VS1053 model
+    double t;                   // simulated time, seconds
+    double fed;                 // bytes written to the decoder
+    double consumed;            // bytes decoded
+    uint32_t frame;             // frame being decoded
+    int isStarted;
+    int isStarving;
+
+    // Results
+    uint32_t underruns;
+    double starvedSec;
+    double minMargin;           // fewest bytes in the FIFO while playing
+    double minMarginMs;
+    uint32_t sinkCalls;
+    uint32_t bursts;
+    uint32_t dreqWaits;
+    uint32_t reads;
+    uint32_t stalls;
+    double maxReadUs;
+    double sdiBusySec;          // polled SPI: the CPU is busy for the transfer
+    double sdBusySec;
+} Sim;
+
+// SimRandom
+// Returns: a uniform number in (0, 1), xorshift32
+static double SimRandom(Sim *m)
+{
+    m->rng ^= m->rng << 13;
+    m->rng ^= m->rng >> 17;
+    m->rng ^= m->rng << 5;
+    return (m->rng + 1.0) / 4294967297.0;
+}
+
+static double SimFrameRate(const SimFrame *f)
+{
+    return (f->duration > 0) ? f->length / f->duration : 0;
+}
+
+// SimDecode
+// Runs the decoder model up to time end.
+static void SimDecode(Sim *m, double end)
+{
+    const SimFrame *f;
+    double frameEnd, avail, rate, step;
+
+    while (m->t < end)
+    {
+        if (!m->isStarted || m->frame >= m->frameCount)
+        {
+            m->t = end;
+            break;
+        }
+
+        f = &m->frames[m->frame];
+        frameEnd = f->offset + f->length;
+        avail = m->fed - m->consumed;
+        rate = SimFrameRate(f);
+
+        if (avail <= 1e-9)
+        {
+            if (!m->isStarving)
+            {
+                m->isStarving = 1;
+                m->underruns++;
+            }
+            m->starvedSec += end - m->t;
+            m->t = end;
+            break;
+        }
+
+        if (rate == 0)
+        {
+            // Not a frame (e.g. a tag in the audio range): passes straight through
+            m->consumed += (avail < frameEnd - m->consumed) ? avail : frameEnd - m->consumed;
+        }
+        else
+        {
+            step = end - m->t;
+            if (step > (frameEnd - m->consumed) / rate) step = (frameEnd - m->consumed) / rate;
+            if (step > avail / rate) step = avail / rate;
+            m->consumed += step * rate;
+            m->t += step;
+        }
+        if (m->consumed >= frameEnd - 1e-9)
+        {
+            m->consumed = frameEnd;
+            m->frame++;
+        }
+    }
+
+    // The FIFO margin counts from the start of play until the last byte is in
+    if (m->isStarted && m->fed < m->audioBytes && m->frame < m->frameCount)
+    {
+        avail = m->fed - m->consumed;
+        if (avail < m->minMargin)
+        {
+            m->minMargin = avail;
+            rate = SimFrameRate(&m->frames[m->frame]);
+            m->minMarginMs = (rate > 0) ? avail / rate * 1000.0 : 0;
+        }
+    }
+}
+
+// SimDreq
+// Returns: nonzero while the decoder can take a burst
+static int SimDreq(Sim *m)
+{
+    return m->fed - m->consumed <= SIM_VS1053_FIFO - SIM_DREQ_SPACE + 1e-6;
+}
+
+// SimDreqTime
+// Returns: the time DREQ goes high again, the FIFO is not empty
+static double SimDreqTime(Sim *m)
+{
+    double target = m->fed - (SIM_VS1053_FIFO - SIM_DREQ_SPACE);
+    double t = m->t;
+    double c = m->consumed;
+    double frameEnd, rate, bytes;
+    uint32_t i = m->frame;
+
+    while (c < target && i < m->frameCount)
+    {
+        frameEnd = m->frames[i].offset + m->frames[i].length;
+        bytes = ((frameEnd < target) ? frameEnd : target) - c;
+        rate = SimFrameRate(&m->frames[i]);
+        if (rate > 0) t += bytes / rate;
+        c += bytes;
+        if (c >= frameEnd) i++;
+    }
+    // Rounding must not stall the simulation
+    return (t > m->t) ? t : m->t + 1e-6;
+}
+
+// SimSinkWrite
+// Feeder stage sink: the VS1053 driver. Sends bursts while DREQ is high.
+static int32_t SimSinkWrite(void *ctx, uint8_t *src, uint32_t len)
+{
+    Sim *m = (Sim*)ctx;
+    uint32_t done = 0;
+    uint32_t n;
+    double dt;
+
+    (void)src;
+    m->sinkCalls++;
+    while (done < len && SimDreq(m))
+    {
+        n = len - done;
+        if (n > m->cfg->burst) n = m->cfg->burst;
+        dt = n / m->mp3Bps + m->cfg->burstOverheadUs * 1e-6;
+
+        SimDecode(m, m->t + dt);
+        m->fed += n;
+        m->isStarving = 0;
+        // The decoder starts once its FIFO is full or the whole stream is in
+        if (!m->isStarted && (!SimDreq(m) || m->fed >= m->audioBytes)) m->isStarted = 1;
+
+        m->sdiBusySec += dt;
+        m->bursts++;
+        done += n;
+    }
+    return (int32_t)done;
+}
+
+// SimSourceRead
+// Reader stage source: the SD card.
+static int32_t SimSourceRead(void *ctx, uint8_t *dst, uint32_t len)
+{
+    Sim *m = (Sim*)ctx;
+    double latencyUs;
+    double dt;
+    int32_t n;
+
+    if (len > m->cfg->readMax) len = m->cfg->readMax;
+    n = Mp3AudioRead(&m->src, dst, len);
+    if (n <= 0) return n;
+
+    latencyUs = -m->cfg->sdLatencyUs * log(SimRandom(m));
+    if (SimRandom(m) < m->cfg->sdStallProb)
+    {
+        latencyUs += m->cfg->sdStallUs;
+        m->stalls++;
+    }
+    if (latencyUs + n / m->sdBps * 1e6 > m->maxReadUs) m->maxReadUs = latencyUs + n / m->sdBps * 1e6;
+
+    dt = latencyUs * 1e-6 + n / m->sdBps;
+    SimDecode(m, m->t + dt);
+    m->sdBusySec += dt;
+    m->reads++;
+    return n;
+}
+
+// SimLoadFrames
+// Lists the frames of the audio range, each with its own duration.
+// Returns: the number of frames, 0 if the stream has none
+static uint32_t SimLoadFrames(Sim *m, const uint8_t *data, const Mp3StreamInfo *info)
+{
+    Mp3FrameHeader hdr;
+    uint32_t pos = info->audioStart;
+    uint32_t found;
+    uint32_t max = (info->audioEnd - info->audioStart) / 24 + 1;
+
+    m->frames = (SimFrame*)malloc(max * sizeof(SimFrame));
+    m->frameCount = 0;
+
+    while (pos + 4 <= info->audioEnd && m->frameCount < max)
+    {
+        if (!Mp3ParseFrameHeader(&data[pos], &hdr))
+        {
+            // Lost sync: whatever is in between plays as nothing
+            if (!Mp3InfoFindFrame(Mp3AudioReadAt, &m->src, pos + 1, info->audioEnd, info->audioEnd, &info->first, &found, &hdr))
+                found = info->audioEnd;
+            m->frames[m->frameCount].offset = pos - info->audioStart;
+            m->frames[m->frameCount].length = found - pos;
+            m->frames[m->frameCount].duration = 0;
+            m->frameCount++;
+            pos = found;
+            continue;
+        }
+        if (pos + hdr.frameLength > info->audioEnd) hdr.frameLength = (uint16_t)(info->audioEnd - pos);
+
+        m->frames[m->frameCount].offset = pos - info->audioStart;
+        m->frames[m->frameCount].length = hdr.frameLength;
+        m->frames[m->frameCount].duration = (double)hdr.samplesPerFrame / hdr.sampleRate;
+        m->frameCount++;
+        pos += hdr.frameLength;
+    }
+    return m->frameCount;
+}
+
+// SimRun
+// Streams one file through the pipeline with the given configuration.
+// Returns: 0 on success, -1 if the file is not an MP3 stream
+static int SimRun(Sim *m, const SimConfig *cfg, const uint8_t *data, uint32_t size)
+{
+    Mp3StreamInfo info;
+    Mp3Stream s;
+    uint8_t *ring;
+    uint32_t high = cfg->highWater ? cfg->highWater : cfg->ringSize - cfg->readBlock;
+    uint32_t low = cfg->lowWater ? cfg->lowWater : cfg->ringSize / 2;
+    int isPrimed = 0;
+    double playSec = 0;
+    uint32_t i;
+
+    memset(m, 0, sizeof(*m));
+    m->cfg = cfg;
+    m->mp3Bps = SIM_HCLK_HZ / cfg->mp3Div / 8;
+    m->sdBps = SIM_HCLK_HZ / cfg->sdDiv / 8;
+    m->rng = cfg->seed ? cfg->seed : 1;
+    m->minMargin = SIM_VS1053_FIFO;
+
+    Mp3AudioMemOpen(&m->src, data, size);
+    if (!Mp3InfoParse(&info, Mp3AudioReadAt, &m->src, size)) return -1;
+    if (SimLoadFrames(m, data, &info) == 0)
+    {
+        free(m->frames);
+        m->frames = NULL;
+        return -1;
+    }
+    m->audioBytes = info.audioEnd - info.audioStart;
+    for (i = 0; i < m->frameCount; i++) playSec += m->frames[i].duration;
+
+    // The source ends with the audio, as Mp3FileSourceRead() stops at audioEnd
+    Mp3AudioMemOpen(&m->src, data, info.audioEnd);
+    Mp3AudioSeek(&m->src, info.audioStart);
+
+    ring = (uint8_t*)malloc(cfg->ringSize);
+    if (Mp3StreamSetup(&s, ring, cfg->ringSize, high, low, cfg->readBlock, cfg->feedMax) != MP3_STREAM_ERR_NONE)
+    {
+        fprintf(stderr, "mp3sim: bad ring geometry %u/%u/%u/%u\n",
+                (unsigned)cfg->ringSize, (unsigned)high, (unsigned)low, (unsigned)cfg->readBlock);
+        free(ring);
+        free(m->frames);
+        exit(2);
+    }
+    Mp3StreamSetSource(&s, SimSourceRead, m);
+    Mp3StreamSetSink(&s, SimSinkWrite, m);
+    Mp3StreamAlign(&s, info.audioStart);
+
+    while (!Mp3StreamFinished(&s))
+    {
+        if (!isPrimed && Mp3StreamReady(&s)) isPrimed = 1;
+
+        if (isPrimed && Mp3StreamLevel(&s) > 0 && SimDreq(m))
+        {
+            Mp3StreamDrain(&s, cfg->feedMax);
+        }
+        else if (Mp3StreamWantsFill(&s))
+        {
+            Mp3StreamFill(&s);
+        }
+        else if (isPrimed && Mp3StreamLevel(&s) > 0)
+        {
+            // Feeder sleeps on DREQ, the reader has nothing to do
+            m->dreqWaits++;
+            SimDecode(m, SimDreqTime(m));
+        }
+        else
+        {
+            SimDecode(m, m->t + 1e-3);
+        }
+    }
+
+    // Play out what is left in the FIFO
+    m->isStarted = 1;
+    SimDecode(m, m->t + playSec + 1.0);
+
+    printf("%5u %6u %6u %6u %4u %8.1f %6.2f %9u %7.1f %8.1f %6.1f %7u %7u %7u\n",
+           (unsigned)cfg->mp3Div, (unsigned)cfg->ringSize, (unsigned)high, (unsigned)low,
+           (unsigned)m->underruns, m->starvedSec * 1000.0, playSec,
+           (unsigned)m->minMargin, m->minMarginMs, m->maxReadUs / 1000.0,
+           (m->sdiBusySec + m->sdBusySec) / playSec * 100.0,
+           (unsigned)m->bursts, (unsigned)m->dreqWaits, (unsigned)m->reads);
+
+    free(ring);
+    free(m->frames);
+    return 0;
+}
+
+static void SimUsage()
+{
+    printf("usage: mp3sim [options] file.mp3...\n"
+           "  -mp3div N      VS1053 SPI prescaler (MP3_SPI_DATARATE), default 32\n"
+           "  -sddiv N       SD SPI prescaler (SD_SPI_DATARATE), default 4\n"
+           "  -ring N        ring size (MP3_STREAM_BUF_SIZE), default 8192\n"
+           "  -high N        high watermark, default ring - block\n"
+           "  -low N         low watermark, default ring / 2\n"
+           "  -block N       read block (MP3_STREAM_READ_BLOCK), default 512\n"
+           "  -readmax N     largest source read, default 8192\n"
+           "  -feedmax N     bytes fed between flag checks, default 512\n"
+           "  -burst N       bytes per DREQ check (MP3_DECODER_BUF_SIZE), default 32\n"
+           "  -overhead US   per burst overhead, default 2\n"
+           "  -sdlat US      mean SD read latency, default 300\n"
+           "  -stallp P      chance an SD read stalls, default 0.01\n"
+           "  -stall US      SD stall length, default 20000\n"
+           "  -seed N        random seed, default 1\n"
+           "  -sweep         run every MP3 prescaler and ring size combination\n");
+}
+
+static void SimHeader(const char *name)
+{
+    printf("%s\n", name);
+    printf("%5s %6s %6s %6s %4s %8s %6s %9s %7s %8s %6s %7s %7s %7s\n",
+           "div", "ring", "high", "low", "undr", "starv ms", "play s",
+           "margin B", "marg ms", "rd max ms", "cpu %", "bursts", "dreqw", "reads");
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t sweepDiv[] = { 8, 16, 32, 64 };
+    static const uint32_t sweepRing[] = { 2048, 4096, 8192, 16384 };
+    SimConfig cfg = { 32, 4, 8192, 0, 0, 512, 8192, 512, 32, 2.0, 300.0, 0.01, 20000.0, 1 };
+    SimConfig run;
+    int isSweep = 0;
+    int argi;
+    Sim sim;
+    FILE *f;
+    uint8_t *data;
+    long size;
+    uint32_t d, r;
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        const char *o = argv[argi];
+        const char *v = (argi + 1 < argc) ? argv[argi + 1] : "0";
+
+        if (strcmp(o, "-sweep") == 0) { isSweep = 1; continue; }
+        if (strcmp(o, "-h") == 0) { SimUsage(); return 0; }
+
+        if (strcmp(o, "-mp3div") == 0) cfg.mp3Div = (uint32_t)atoi(v);
+        else if (strcmp(o, "-sddiv") == 0) cfg.sdDiv = (uint32_t)atoi(v);
+        else if (strcmp(o, "-ring") == 0) cfg.ringSize = (uint32_t)atoi(v);
+        else if (strcmp(o, "-high") == 0) cfg.highWater = (uint32_t)atoi(v);
+        else if (strcmp(o, "-low") == 0) cfg.lowWater = (uint32_t)atoi(v);
+        else if (strcmp(o, "-block") == 0) cfg.readBlock = (uint32_t)atoi(v);
+        else if (strcmp(o, "-readmax") == 0) cfg.readMax = (uint32_t)atoi(v);
+        else if (strcmp(o, "-feedmax") == 0) cfg.feedMax = (uint32_t)atoi(v);
+        else if (strcmp(o, "-burst") == 0) cfg.burst = (uint32_t)atoi(v);
+        else if (strcmp(o, "-overhead") == 0) cfg.burstOverheadUs = atof(v);
+        else if (strcmp(o, "-sdlat") == 0) cfg.sdLatencyUs = atof(v);
+        else if (strcmp(o, "-stallp") == 0) cfg.sdStallProb = atof(v);
+        else if (strcmp(o, "-stall") == 0) cfg.sdStallUs = atof(v);
+        else if (strcmp(o, "-seed") == 0) cfg.seed = (uint32_t)atoi(v);
+        else
+        {
+            SimUsage();
+            return 2;
+        }
+        argi++;
+    }
+    if (argi >= argc)
+    {
+        SimUsage();
+        return 2;
+    }
+
+    for (; argi < argc; argi++)
+    {
+        f = fopen(argv[argi], "rb");
+        if (f == NULL)
+        {
+            fprintf(stderr, "mp3sim: cannot open %s\n", argv[argi]);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = (uint8_t*)malloc(size);
+        if (fread(data, 1, size, f) != (size_t)size) size = 0;
+        fclose(f);
+
+        SimHeader(argv[argi]);
+        if (!isSweep)
+        {
+            if (SimRun(&sim, &cfg, data, (uint32_t)size) < 0)
+                fprintf(stderr, "mp3sim: %s: no MP3 frames\n", argv[argi]);
+        }
+        else
+        {
+            for (d = 0; d < sizeof(sweepDiv) / sizeof(sweepDiv[0]); d++)
+            {
+                for (r = 0; r < sizeof(sweepRing) / sizeof(sweepRing[0]); r++)
+                {
+                    run = cfg;
+                    run.mp3Div = sweepDiv[d];
+                    run.ringSize = sweepRing[r];
+                    run.highWater = 0;
+                    run.lowWater = 0;
+                    if (SimRun(&sim, &run, data, (uint32_t)size) < 0)
+                    {
+                        fprintf(stderr, "mp3sim: %s: no MP3 frames\n", argv[argi]);
+                        d = sizeof(sweepDiv);
+                        break;
+                    }
+                }
+            }
+        }
+        free(data);
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+    SdImageDevice.cpp
+    Block device over a raw SD card image file, see SdImageDevice.h.
+
+    The image is read and written with pread/pwrite, so the host page cache
+    makes the accesses themselves free and only the injected card time
+    counts. A multiple block read is modelled like Sd2Card runs CMD18: the
+    command is paid once and every other access stops the stream first.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "SdImageDevice.h"
+
+#define SD_IMAGE_BLOCK          512u
+#define SD_IMAGE_BLOCK_BITS     ((1u + SD_IMAGE_BLOCK + 2u) * 8u)  // start token, data, CRC
+
+static const SdImageLatency sdImageNoLatency = { 0, 0, 0, 0, 0, 0, 1 };
+
+SdImageDevice::SdImageDevice()
+    : fd(-1), blockCount(0), latency(sdImageNoLatency), rng(1), isStreaming(0), streamBlock(0)
+{
+    ClearStats();
+}
+
+SdImageDevice::~SdImageDevice()
+{
+    Close();
+}
+
+// Open
+// Opens the image, writable only if asked so a benchmark cannot change it.
+// path: raw image of a whole card or of a single volume
+// isWritable: nonzero to allow writeBlock()
+// Returns: 0 on success, -1 if the image cannot be opened
+int SdImageDevice::Open(const char *path, int isWritable)
+{
+    off_t size;
+
+    Close();
+    fd = open(path, isWritable ? O_RDWR : O_RDONLY);
+    if (fd < 0) return -1;
+    size = lseek(fd, 0, SEEK_END);
+    blockCount = (size > 0) ? (uint32_t)(size / SD_IMAGE_BLOCK) : 0;
+    isStreaming = 0;
+    return 0;
+}
+
+void SdImageDevice::Close()
+{
+    if (fd >= 0) close(fd);
+    fd = -1;
+    blockCount = 0;
+}
+
+void SdImageDevice::SetLatency(const SdImageLatency *l)
+{
+    latency = *l;
+    rng = l->seed ? l->seed : 1;
+}
+
+void SdImageDevice::ClearStats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t SdImageDevice::readBlock(uint32_t block, uint8_t *dst)
+{
+    if (isStreaming && block == streamBlock)
+    {
+        if (!ReadRaw(block, dst)) return false;
+        Charge(TransferUs());
+        streamBlock++;
+        stats.blocksStreamed++;
+        return true;
+    }
+    StopStream();
+    if (!ReadRaw(block, dst)) return false;
+    Command();
+    Charge(TransferUs());
+    return true;
+}
+
+// readData
+// A part of a block costs a whole one, the card clocks out the rest anyway.
+uint8_t SdImageDevice::readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t *dst)
+{
+    uint8_t buf[SD_IMAGE_BLOCK];
+
+    if (count == SD_IMAGE_BLOCK) return readBlock(block, dst);
+    if (count == 0) return true;
+    if (offset + count > SD_IMAGE_BLOCK) return false;
+    StopStream();
+    if (!ReadRaw(block, buf)) return false;
+    memcpy(dst, buf + offset, count);
+    Command();
+    Charge(TransferUs());
+    return true;
+}
+
+uint8_t SdImageDevice::readStart(uint32_t block)
+{
+    StopStream();
+    if (block >= blockCount) return false;
+    Command();
+    stats.streams++;
+    isStreaming = 1;
+    streamBlock = block;
+    return true;
+}
+
+uint8_t SdImageDevice::readStreaming(uint32_t block) const
+{
+    return isStreaming && block == streamBlock;
+}
+
+uint8_t SdImageDevice::writeBlock(uint32_t block, const uint8_t *src)
+{
+    StopStream();
+    if (block >= blockCount) return false;
+    if (pwrite(fd, src, SD_IMAGE_BLOCK, (off_t)block * SD_IMAGE_BLOCK) != (ssize_t)SD_IMAGE_BLOCK)
+        return false;
+    Command();
+    Charge(TransferUs() + latency.writeUs);
+    stats.blocksWritten++;
+    return true;
+}
+
+// Command
+// Charges the access time of a command and, by chance, a stall.
+void SdImageDevice::Command()
+{
+    stats.commands++;
+    Charge(latency.cmdUs);
+
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    if ((rng + 1.0) / 4294967297.0 < latency.stallProb)
+    {
+        stats.stalls++;
+        Charge(latency.stallUs);
+    }
+}
+
+void SdImageDevice::Charge(double us)
+{
+    struct timespec ts;
+
+    if (us <= 0) return;
+    stats.modelUs += us;
+    if (!latency.isSleep) return;
+    ts.tv_sec = (time_t)(us / 1e6);
+    ts.tv_nsec = (long)((us - ts.tv_sec * 1e6) * 1e3);
+    nanosleep(&ts, NULL);
+}
+
+double SdImageDevice::TransferUs() const
+{
+    return (latency.sckHz > 0) ? SD_IMAGE_BLOCK_BITS * 1e6 / latency.sckHz : 0;
+}
+
+// StopStream
+// Ends an open multiple block read, the stop costs a command.
+void SdImageDevice::StopStream()
+{
+    if (!isStreaming) return;
+    isStreaming = 0;
+    Command();
+}
+
+uint8_t SdImageDevice::ReadRaw(uint32_t block, uint8_t *dst)
+{
+    if (block >= blockCount) return false;
+    if (pread(fd, dst, SD_IMAGE_BLOCK, (off_t)block * SD_IMAGE_BLOCK) != (ssize_t)SD_IMAGE_BLOCK)
+        return false;
+    stats.blocksRead++;
+    return true;
+}
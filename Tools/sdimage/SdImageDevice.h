@@ -0,0 +1,79 @@
+/*
+    SdImageDevice.h
+    Block device over a raw SD card image file for host builds of SdVolume
+    and SdFile, with the card's latency injected per command and block.
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#ifndef __SDIMAGEDEVICE_H
+#define __SDIMAGEDEVICE_H
+
+#include <stdint.h>
+#include "SdBlockDevice.h"
+
+// Card timing model. A command costs cmdUs before its first block, every
+// block costs its transfer at sckHz and a written block writeUs more. Any
+// command stalls stallUs with chance stallProb. Blocks of a multiple block
+// read after the first cost the transfer only.
+typedef struct _SdImageLatency
+{
+    double cmdUs;               // access time of a read or write command
+    double sckHz;               // SPI clock of the block transfers
+    double writeUs;             // programming time of a written block
+    double stallProb;           // chance a command stalls (busy card)
+    double stallUs;             // length of a stall
+    int isSleep;                // really sleep the modelled time, not only count it
+    uint32_t seed;
+} SdImageLatency;
+
+typedef struct _SdImageStats
+{
+    uint32_t commands;          // read, write and stop commands
+    uint32_t blocksRead;
+    uint32_t blocksStreamed;    // of blocksRead, clocked out of a multiple block read
+    uint32_t blocksWritten;
+    uint32_t streams;           // multiple block reads started
+    uint32_t stalls;
+    double modelUs;             // card time the accesses took in the model
+} SdImageStats;
+
+class SdImageDevice : public SdBlockDevice
+{
+public:
+    SdImageDevice();
+    ~SdImageDevice();
+
+    int Open(const char *path, int isWritable);
+    void Close();
+    void SetLatency(const SdImageLatency *latency);
+    uint32_t BlockCount() const { return blockCount; }
+    const SdImageStats *Stats() const { return &stats; }
+    void ClearStats();
+
+    // SdBlockDevice
+    uint8_t readBlock(uint32_t block, uint8_t *dst);
+    uint8_t readData(uint32_t block, uint16_t offset, uint16_t count, uint8_t *dst);
+    uint8_t readStart(uint32_t block);
+    uint8_t readStreaming(uint32_t block) const;
+    uint8_t writeBlock(uint32_t block, const uint8_t *src);
+
+private:
+    int fd;
+    uint32_t blockCount;
+    SdImageLatency latency;
+    SdImageStats stats;
+    uint32_t rng;
+    int isStreaming;
+    uint32_t streamBlock;       // block the open multiple block read returns next
+
+    void Command();
+    void Charge(double us);
+    double TransferUs() const;
+    void StopStream();
+    uint8_t ReadRaw(uint32_t block, uint8_t *dst);
+};
+
+#endif
@@ -0,0 +1,240 @@
+/*
+    sdimage.cpp
+    Host benchmark of the firmware's FAT code (SdVolume, SdFile) on a raw
+    SD card image, to profile directory scans, seeks and sequential reads
+    without a board.
+
+    The volume is mounted on an SdImageDevice, which charges the card time
+    of every command and block to a model clock (see SdImageLatency). Each
+    phase prints the wall time the FAT code took on the host next to the
+    modelled card time, the card accesses it made and the hits and misses of
+    the volume's block cache:
+
+    - scan: walks the whole directory tree
+    - read: reads every file front to back in -chunk byte reads
+    - seek: seeks -seeks random positions per file and reads a chunk at each
+
+    Usage: sdimage [options] card.img   (sdimage -h lists the options)
+    An image of a card is made with: dd if=/dev/sdX of=card.img bs=1M
+
+    Developed for University of Washington embedded systems programming certificate
+
+    2021/3 Abhilash Sahoo wrote/arranged it
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SdFat.h"
+#include "SdImageDevice.h"
+
+#define IMG_CHUNK_MAX           8192u
+
+typedef struct _ImgConfig
+{
+    SdImageLatency latency;
+    uint32_t chunk;             // bytes per read call, 512 like MP3_STREAM_READ_BLOCK
+    uint32_t seeks;             // random seeks per file
+    int part;                   // partition, -1: first partition or super floppy
+} ImgConfig;
+
+typedef struct _ImgPhase
+{
+    const ImgConfig *cfg;
+    uint32_t dirs;
+    uint32_t files;
+    uint64_t bytes;             // read, or found by the scan
+    uint32_t errors;
+    uint32_t rng;
+} ImgPhase;
+
+typedef void (*ImgFileFunc)(ImgPhase *p, SdFile *file);
+
+static SdImageDevice imgDevice;
+static uint8_t imgBuf[IMG_CHUNK_MAX];
+
+static double ImgNowMs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// ImgRandom
+// Returns: a uniform number in [0, n), xorshift32
+static uint32_t ImgRandom(ImgPhase *p, uint32_t n)
+{
+    p->rng ^= p->rng << 13;
+    p->rng ^= p->rng >> 17;
+    p->rng ^= p->rng << 5;
+    return n ? p->rng % n : 0;
+}
+
+// ImgWalk
+// Visits every file below dir, depth first, and calls func on each file
+// opened for reading. func may be NULL to only count.
+static void ImgWalk(ImgPhase *p, SdFile *dir, ImgFileFunc func)
+{
+    dir_t entry;
+    SdFile child;
+    uint16_t index;
+    int8_t n;
+
+    dir->rewind();
+    while ((n = dir->readDir(&entry)) > 0)
+    {
+        index = (uint16_t)(dir->curPosition() / sizeof(dir_t) - 1);
+        if (DIR_IS_SUBDIR(&entry))
+        {
+            p->dirs++;
+            if (!child.open(dir, index, O_READ)) { p->errors++; continue; }
+            ImgWalk(p, &child, func);
+            child.close();
+        }
+        else
+        {
+            p->files++;
+            if (func == NULL)
+            {
+                p->bytes += entry.fileSize;
+                continue;
+            }
+            if (!child.open(dir, index, O_READ)) { p->errors++; continue; }
+            func(p, &child);
+            child.close();
+        }
+    }
+    if (n < 0) p->errors++;
+}
+
+static void ImgReadFile(ImgPhase *p, SdFile *file)
+{
+    int16_t n;
+
+    while ((n = file->read(imgBuf, (uint16_t)p->cfg->chunk)) > 0) p->bytes += n;
+    if (n < 0) p->errors++;
+}
+
+static void ImgSeekFile(ImgPhase *p, SdFile *file)
+{
+    uint32_t i;
+    int16_t n;
+
+    for (i = 0; i < p->cfg->seeks; i++)
+    {
+        if (!file->seekSet(ImgRandom(p, file->fileSize())))
+        {
+            p->errors++;
+            continue;
+        }
+        n = file->read(imgBuf, (uint16_t)p->cfg->chunk);
+        if (n < 0) p->errors++;
+        else p->bytes += n;
+    }
+}
+
+static void ImgRun(const char *name, const ImgConfig *cfg, SdFile *root, ImgFileFunc func)
+{
+    const SdImageStats *s = imgDevice.Stats();
+    ImgPhase p;
+    double t0;
+    double wallMs;
+
+    memset(&p, 0, sizeof(p));
+    p.cfg = cfg;
+    p.rng = cfg->latency.seed ? cfg->latency.seed : 1;
+    imgDevice.ClearStats();
+    SdVolume::cacheClearStats();
+
+    t0 = ImgNowMs();
+    ImgWalk(&p, root, func);
+    wallMs = ImgNowMs() - t0;
+
+    printf("%-5s %5u %6u %10llu %9.2f %9.1f %7u %7u %7u %6u %5u %7.2f %8u %7u %4u\n",
+           name, (unsigned)p.dirs, (unsigned)p.files, (unsigned long long)p.bytes,
+           wallMs, s->modelUs / 1000.0, (unsigned)s->commands, (unsigned)s->blocksRead,
+           (unsigned)s->blocksStreamed, (unsigned)s->streams, (unsigned)s->stalls,
+           (func != NULL && s->modelUs > 0) ? p.bytes / s->modelUs : 0.0,
+           (unsigned)SdVolume::cacheHits(), (unsigned)SdVolume::cacheMisses(),
+           (unsigned)p.errors);
+}
+
+static void ImgUsage()
+{
+    printf("usage: sdimage [options] card.img\n"
+           "  -cmdlat US     card access time per command, default 300\n"
+           "  -sck HZ        SD SPI clock, default 20000000\n"
+           "  -write US      programming time per written block, default 1000\n"
+           "  -stallp P      chance a command stalls, default 0.01\n"
+           "  -stall US      stall length, default 20000\n"
+           "  -sleep         really sleep the card time, for profilers\n"
+           "  -seed N        random seed, default 1\n"
+           "  -chunk N       bytes per file read, default 512\n"
+           "  -seeks N       random seeks per file, default 100\n"
+           "  -part N        partition 1-4, 0 for a super floppy, default first found\n");
+}
+
+int main(int argc, char **argv)
+{
+    ImgConfig cfg = { { 300.0, 20000000.0, 1000.0, 0.01, 20000.0, 0, 1 }, 512, 100, -1 };
+    SdVolume volume;
+    SdFile root;
+    int argi;
+    uint8_t isMounted;
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        const char *o = argv[argi];
+        const char *v = (argi + 1 < argc) ? argv[argi + 1] : "0";
+
+        if (strcmp(o, "-sleep") == 0) { cfg.latency.isSleep = 1; continue; }
+        if (strcmp(o, "-h") == 0) { ImgUsage(); return 0; }
+
+        if (strcmp(o, "-cmdlat") == 0) cfg.latency.cmdUs = atof(v);
+        else if (strcmp(o, "-sck") == 0) cfg.latency.sckHz = atof(v);
+        else if (strcmp(o, "-write") == 0) cfg.latency.writeUs = atof(v);
+        else if (strcmp(o, "-stallp") == 0) cfg.latency.stallProb = atof(v);
+        else if (strcmp(o, "-stall") == 0) cfg.latency.stallUs = atof(v);
+        else if (strcmp(o, "-seed") == 0) cfg.latency.seed = (uint32_t)atoi(v);
+        else if (strcmp(o, "-chunk") == 0) cfg.chunk = (uint32_t)atoi(v);
+        else if (strcmp(o, "-seeks") == 0) cfg.seeks = (uint32_t)atoi(v);
+        else if (strcmp(o, "-part") == 0) cfg.part = atoi(v);
+        else
+        {
+            ImgUsage();
+            return 2;
+        }
+        argi++;
+    }
+    if (argi + 1 != argc || cfg.chunk == 0 || cfg.chunk > IMG_CHUNK_MAX || cfg.part > 4)
+    {
+        ImgUsage();
+        return 2;
+    }
+
+    if (imgDevice.Open(argv[argi], 0) < 0)
+    {
+        fprintf(stderr, "sdimage: cannot open %s\n", argv[argi]);
+        return 1;
+    }
+    imgDevice.SetLatency(&cfg.latency);
+    isMounted = (cfg.part < 0) ? volume.init(&imgDevice) : volume.init(&imgDevice, (uint8_t)cfg.part);
+    if (!isMounted || !root.openRoot(&volume))
+    {
+        fprintf(stderr, "sdimage: %s: no FAT16/FAT32 volume\n", argv[argi]);
+        return 1;
+    }
+
+    printf("%s: FAT%u, %u blocks per cluster, %u clusters\n", argv[argi],
+           (unsigned)volume.fatType(), (unsigned)volume.blocksPerCluster(),
+           (unsigned)volume.clusterCount());
+    printf("%-5s %5s %6s %10s %9s %9s %7s %7s %7s %6s %5s %7s %8s %7s %4s\n",
+           "phase", "dirs", "files", "bytes", "wall ms", "card ms", "cmds",
+           "blocks", "stream", "starts", "stall", "MB/s", "hits", "misses", "err");
+    ImgRun("scan", &cfg, &root, NULL);
+    ImgRun("read", &cfg, &root, ImgReadFile);
+    ImgRun("seek", &cfg, &root, ImgSeekFile);
+    return 0;
+}